@@ -0,0 +1,58 @@
+/*
+* Backends.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "FrameArena.h"
+#include <string>
+#include <vector>
+
+namespace GreenScreen {
+
+	//a camera as the booth uses it: live view frames and pictures, both as encoded bytes
+	class CameraBackend
+	{
+	public:
+		virtual ~CameraBackend() {}
+
+		virtual bool open() = 0;
+		virtual void close() = 0;
+		virtual std::string name() const = 0;
+
+		//start pc live view, downloadLiveView fails until this succeeded
+		virtual bool startLiveView() = 0;
+		//newest live view jpeg, data stays valid until the next call
+		virtual bool downloadLiveView(const unsigned char*& data, size_t& bytes) = 0;
+
+		//fire the shutter, the picture shows up later in pollPicture
+		virtual bool takePicture() = 0;
+		//true once for every downloaded picture, picture gets the file bytes as the camera sent them
+		virtual bool pollPicture(std::vector<unsigned char>& picture) = 0;
+		//shoot RAW files instead of in-camera jpeg, false when the camera can not
+		virtual bool setRawCapture(bool /*isRaw*/) { return false; }
+	};
+
+	//a printer that takes one composed page at a time
+	class PrinterBackend
+	{
+	public:
+		virtual ~PrinterBackend() {}
+
+		virtual std::string name() const = 0;
+		//print a BGR page, scratch buffers come from arena
+		virtual bool print(const cv::Mat& page, FrameArena& arena) = 0;
+	};
+}
@@ -0,0 +1,298 @@
+/*
+* BurstComposer.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#define NOMINMAX
+#include "BurstComposer.h"
+#include "EmbeddedPreview.h"
+#include <algorithm>
+#include <thread>
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	static const int maxBurstShots = 8;
+
+	static float msSince(int64 startTick)
+	{
+		return (float)((getTickCount() - startTick) * 1000.0 / getTickFrequency());
+	}
+
+	stripLayout photoStripLayout(int shots)
+	{
+		stripLayout layout;
+		layout.columns = 2;
+		layout.rows = std::max(1, std::min(shots, maxBurstShots));
+		layout.repeatColumns = true;
+		layout.pageWidth = 2700;
+		layout.pageHeight = 4050;
+		layout.margin = 60;
+		layout.gap = 40;
+		return layout;
+	}
+
+	stripLayout gridLayout(int columns, int rows)
+	{
+		stripLayout layout;
+		layout.columns = std::max(1, columns);
+		layout.rows = std::max(1, rows);
+		layout.repeatColumns = false;
+		layout.pageWidth = 2700;
+		layout.pageHeight = 4050;
+		layout.margin = 60;
+		layout.gap = 40;
+		return layout;
+	}
+
+	Rect stripCell(const stripLayout& layout, int column, int row)
+	{
+		int cellWidth = (layout.pageWidth - 2 * layout.margin - (layout.columns - 1) * layout.gap) / layout.columns;
+		int cellHeight = (layout.pageHeight - 2 * layout.margin - (layout.rows - 1) * layout.gap) / layout.rows;
+		return Rect(layout.margin + column * (cellWidth + layout.gap), layout.margin + row * (cellHeight + layout.gap), cellWidth, cellHeight);
+	}
+
+	//centre part of a picture with the aspect of the cell
+	static Rect centreCrop(Size picture, Size cell)
+	{
+		double scale = std::max(cell.width / (double)picture.width, cell.height / (double)picture.height);
+		int width = std::min(picture.width, cvRound(cell.width / scale));
+		int height = std::min(picture.height, cvRound(cell.height / scale));
+		return Rect((picture.width - width) / 2, (picture.height - height) / 2, width, height);
+	}
+
+	//smallest libjpeg scale whose centre crop still has at least the pixels of the cell
+	//the reduced decode needs opencv 3.1, older builds decode at full size
+	static int reducedDecodeFlags(Size picture, Size cell)
+	{
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 1)
+		static const int factors[] = { 8, 4, 2 };
+		static const int flags[] = { IMREAD_REDUCED_COLOR_8, IMREAD_REDUCED_COLOR_4, IMREAD_REDUCED_COLOR_2 };
+		for (int i = 0; i < 3; i++)
+		{
+			Size reduced(picture.width / factors[i], picture.height / factors[i]);
+			Rect crop = centreCrop(reduced, cell);
+			if (crop.width >= cell.width && crop.height >= cell.height) return flags[i];
+		}
+#endif
+		return IMREAD_COLOR;
+	}
+
+	struct burstShot
+	{
+		std::vector<unsigned char> picture;
+		FrameArena arena;
+		RawDecoder raw;			//one per worker, LibRaw state is not shared between threads
+		Size decodedSize;		//decode into a block of the last size, same camera same size
+		int decodeFlags;
+		Mat matte;				//person matte of the shot at model size
+		bool ok;
+		float ms;
+
+		burstShot() : decodeFlags(IMREAD_COLOR), ok(false), ms(0) {}
+	};
+
+	struct BurstComposer::impl
+	{
+		stripLayout layout;
+		keySettings key;
+		PersonSegmenter* segmenter;
+		Size cell;
+		Mat page;
+		Mat backgroundCell;		//the theme at cell size, read by every worker
+		Mat foregroundCell;
+		std::shared_ptr<const compiledLayers> cellLayers;	//the theme layers at cell size, when it has them
+		burstShot shots[maxBurstShots];
+		std::thread workers[maxBurstShots];
+		int received;
+		bool isActive;
+
+		impl() : segmenter(NULL), received(0), isActive(false) {}
+
+		void join()
+		{
+			for (int i = 0; i < maxBurstShots; i++)
+			{
+				if (workers[i].joinable()) workers[i].join();
+			}
+		}
+
+		//decode, crop and scale straight into the first cell of this shot, key and blend it there,
+		//the other columns of a strip get a copy of the finished cell
+		void composeShot(int index)
+		{
+			burstShot& shot = shots[index];
+			int64 startTick = getTickCount();
+			shot.ok = false;
+			shot.arena.reset();
+
+			int column = layout.repeatColumns ? 0 : index % layout.columns;
+			int row = layout.repeatColumns ? index : index / layout.columns;
+			Mat target = page(stripCell(layout, column, row));
+
+			const unsigned char* data = &shot.picture[0];
+			size_t bytes = shot.picture.size();
+			Mat decoded;
+			if (isRawPicture(data, bytes))
+			{
+				//half size RAW is the reduced decode of a RAW file, the demosaic only when a cell needs more
+				bool ok = shot.raw.decodeHalf(data, bytes, decoded);
+				if (ok)
+				{
+					Rect crop = centreCrop(decoded.size(), cell);
+					if (crop.width < cell.width || crop.height < cell.height) ok = shot.raw.decodeFull(data, bytes, decoded);
+				}
+				if (!ok) decoded.release();
+			}
+			else
+			{
+				//the scale from the size in the jpeg header of this shot, a header that can not be read decodes at full size
+				int pictureWidth = 0, pictureHeight = 0;
+				int flags = jpegImageSize(data, bytes, pictureWidth, pictureHeight) ? reducedDecodeFlags(Size(pictureWidth, pictureHeight), cell) : IMREAD_COLOR;
+				Mat buffer = Mat(1, (int)bytes, CV_8UC1, (void*)data);
+				decoded = shot.decodedSize.area() > 0 && shot.decodeFlags == flags ? shot.arena.acquire(shot.decodedSize, CV_8UC3) : Mat();
+				imdecode(buffer, flags, &decoded);
+				if (!decoded.empty())
+				{
+					shot.decodedSize = decoded.size();
+					shot.decodeFlags = flags;
+				}
+			}
+			if (decoded.empty())
+			{
+				shot.ms = msSince(startTick);
+				return;
+			}
+
+			//target is a view of the page, resize writes into it without a new buffer
+			resize(decoded(centreCrop(decoded.size(), cell)), target, cell, 0, 0, INTER_AREA);
+			bool isPersonKeyed = key.mode == keyModePerson && segmenter && personKey(target, backgroundCell, *segmenter, shot.arena, shot.matte);
+			if (!isPersonKeyed) chromaKey(target, backgroundCell, key, shot.arena);
+			if (cellLayers) blendLayers(target, *cellLayers);
+			else overlayImage(target, foregroundCell, target, Point2i(0, 0));
+
+			if (layout.repeatColumns)
+			{
+				for (int c = 1; c < layout.columns; c++)
+				{
+					Mat copy = page(stripCell(layout, c, row));
+					target.copyTo(copy);
+				}
+			}
+			shot.ok = true;
+			shot.ms = msSince(startTick);
+		}
+	};
+
+	BurstComposer::BurstComposer() : d(new impl())
+	{
+	}
+
+	BurstComposer::~BurstComposer()
+	{
+		d->join();
+		delete d;
+	}
+
+	bool BurstComposer::begin(const stripLayout& layout, const keySettings& key, const Mat& background, const Mat& foreground,
+		PersonSegmenter* segmenter, const LayerStack* layers)
+	{
+		cancel();
+		if (layout.shots() <= 0 || layout.shots() > maxBurstShots) return false;
+		Rect cell = stripCell(layout, 0, 0);
+		if (cell.width <= 0 || cell.height <= 0 || background.empty()) return false;
+
+		d->layout = layout;
+		d->key = key;
+		d->segmenter = segmenter;
+		d->cell = cell.size();
+		//the page keeps its memory from one burst to the next
+		d->page.create(layout.pageHeight, layout.pageWidth, CV_8UC3);
+		d->page.setTo(Scalar(255, 255, 255));
+		if (layers && layers->isLoaded())
+		{
+			d->cellLayers = layers->at(d->cell);
+			d->backgroundCell = d->cellLayers->backdrop;
+			d->foregroundCell.release();
+		}
+		else
+		{
+			d->cellLayers.reset();
+			resize(background, d->backgroundCell, d->cell);
+			if (foreground.empty()) d->foregroundCell.release();
+			else resize(foreground, d->foregroundCell, d->cell);
+		}
+
+		d->received = 0;
+		d->isActive = true;
+		return true;
+	}
+
+	bool BurstComposer::isActive() const
+	{
+		return d->isActive;
+	}
+
+	int BurstComposer::shots() const
+	{
+		return d->isActive ? d->layout.shots() : 0;
+	}
+
+	int BurstComposer::received() const
+	{
+		return d->received;
+	}
+
+	bool BurstComposer::addShot(std::vector<unsigned char>& picture)
+	{
+		if (!d->isActive || d->received >= d->layout.shots() || picture.empty()) return false;
+		int index = d->received++;
+		//the camera buffer and the shot buffer trade places, both keep their capacity
+		d->shots[index].picture.swap(picture);
+		d->workers[index] = std::thread(&impl::composeShot, d, index);
+		return true;
+	}
+
+	bool BurstComposer::finish(Mat& page, burstTimings* timings)
+	{
+		if (!d->isActive) return false;
+		int64 waitTick = getTickCount();
+		d->join();
+		d->isActive = false;
+
+		bool ok = d->received == d->layout.shots();
+		float slowest = 0;
+		for (int i = 0; i < d->received; i++)
+		{
+			const burstShot& shot = d->shots[i];
+			ok = ok && shot.ok;
+			slowest = std::max(slowest, shot.ms);
+		}
+		if (timings)
+		{
+			timings->slowestShotMs = slowest;
+			timings->waitMs = msSince(waitTick);
+		}
+		page = d->page;
+		return ok;
+	}
+
+	void BurstComposer::cancel()
+	{
+		d->join();
+		d->isActive = false;
+		d->received = 0;
+	}
+}
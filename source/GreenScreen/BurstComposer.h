@@ -0,0 +1,87 @@
+/*
+* BurstComposer.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "KeyPipeline.h"
+#include <vector>
+
+namespace GreenScreen {
+
+	//how the shots of a burst sit on the printer page
+	struct stripLayout
+	{
+		int columns;
+		int rows;
+		bool repeatColumns;		//every column is the whole burst, the page is cut into strips
+		int pageWidth;			//the printer raster, same as the GDI printer page
+		int pageHeight;
+		int margin;
+		int gap;
+
+		int shots() const { return repeatColumns ? rows : columns * rows; }
+	};
+
+	//two 2x6 strips of shots on one 4x6 page
+	stripLayout photoStripLayout(int shots = 4);
+	//columns x rows different shots on one page
+	stripLayout gridLayout(int columns = 2, int rows = 2);
+
+	//where cell (column, row) is on the page
+	cv::Rect stripCell(const stripLayout& layout, int column, int row);
+
+	struct burstTimings
+	{
+		float slowestShotMs;	//decode, key and layout of the slowest shot
+		float waitMs;			//time finish() waited for the workers
+	};
+
+	//composes the shots of a burst straight into one printer page
+	//every shot is decoded at the smallest JPEG scale that still covers its cell, keyed and
+	//blended on its own worker right where it goes on the page, so no full size copy is ever made
+	class BurstComposer
+	{
+	public:
+		BurstComposer();
+		~BurstComposer();
+
+		//start a burst, background and foreground are the theme at any size and are scaled to the cell once
+		//the person key needs the segmenter, the shots take turns on its network
+		//a theme with layers is compiled at the cell size instead and background and foreground are not used
+		bool begin(const stripLayout& layout, const keySettings& key, const cv::Mat& background, const cv::Mat& foreground,
+			PersonSegmenter* segmenter = NULL, const LayerStack* layers = NULL);
+		bool isActive() const;
+		int shots() const;
+		int received() const;
+
+		//hand over the next downloaded picture, it is swapped out of picture and composed right away
+		bool addShot(std::vector<unsigned char>& picture);
+
+		//wait for every shot, page points to the raster until the next begin
+		//false when a shot could not be decoded, its cell is left white
+		bool finish(cv::Mat& page, burstTimings* timings = NULL);
+
+		//drop the burst, waits for the shots already on a worker
+		void cancel();
+
+	private:
+		struct impl;
+		impl* d;
+
+		BurstComposer(const BurstComposer&);
+		BurstComposer& operator=(const BurstComposer&);
+	};
+}
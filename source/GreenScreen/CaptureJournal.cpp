@@ -0,0 +1,333 @@
+/*
+* CaptureJournal.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "CaptureJournal.h"
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace GreenScreen {
+
+	static const char journalMagic[8] = { 'G', 'S', 'J', 'R', 'N', 'L', 0, 0 };
+	//2 added the key mode and the plate threshold to the record
+	static const uint32_t journalVersion = 2;
+	//the header owns a whole page so records never share a page with it
+	static const uint64_t journalHeaderSize = 4096;
+	static const uint64_t journalInitialCapacity = 1024;
+
+	struct CaptureJournal::journalHeader
+	{
+		char magic[8];
+		uint32_t version;
+		uint32_t recordSize;
+		uint64_t firstSequence;
+		uint64_t nextSequence;
+		uint64_t capacity;
+		uint32_t checksum;
+	};
+
+	//FNV-1a, only used to detect torn writes after a crash
+	uint32_t journalChecksum(const void* data, size_t length)
+	{
+		const unsigned char* bytes = (const unsigned char*)data;
+		uint32_t hash = 2166136261u;
+		for (size_t i = 0; i < length; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 16777619u;
+		}
+		//0 is reserved for "never committed"
+		return hash == 0 ? 1 : hash;
+	}
+
+	static uint32_t headerChecksum(const void* header, size_t checksumOffset)
+	{
+		return journalChecksum(header, checksumOffset);
+	}
+
+	static uint32_t recordChecksum(const captureRecord& record)
+	{
+		return journalChecksum(&record, offsetof(captureRecord, checksum));
+	}
+
+	CaptureJournal::CaptureJournal()
+		: header(NULL), view(NULL), viewSize(0),
+#ifdef _WIN32
+		file(INVALID_HANDLE_VALUE), mapping(NULL)
+#else
+		file(-1)
+#endif
+	{
+	}
+
+	CaptureJournal::~CaptureJournal()
+	{
+		close();
+	}
+
+	bool CaptureJournal::open(const std::string& path, uint64_t firstSequence)
+	{
+		close();
+		uint64_t fileSize = 0;
+
+#ifdef _WIN32
+		file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER length;
+		if (!GetFileSizeEx((HANDLE)file, &length))
+		{
+			close();
+			return false;
+		}
+		fileSize = (uint64_t)length.QuadPart;
+#else
+		file = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (file < 0) return false;
+		struct stat info;
+		if (fstat(file, &info) != 0)
+		{
+			close();
+			return false;
+		}
+		fileSize = (uint64_t)info.st_size;
+#endif
+
+		//new journal
+		if (fileSize < journalHeaderSize)
+		{
+			if (!map(journalInitialCapacity))
+			{
+				close();
+				return false;
+			}
+			memset(header, 0, sizeof(journalHeader));
+			memcpy(header->magic, journalMagic, sizeof(journalMagic));
+			header->version = journalVersion;
+			header->recordSize = sizeof(captureRecord);
+			header->firstSequence = firstSequence;
+			header->nextSequence = firstSequence;
+			header->capacity = journalInitialCapacity;
+			header->checksum = headerChecksum(header, offsetof(journalHeader, checksum));
+			flush(header, sizeof(journalHeader));
+			return true;
+		}
+
+		//existing journal, the capacity comes from the file size so a torn header can still be mapped
+		uint64_t capacity = (fileSize - journalHeaderSize) / sizeof(captureRecord);
+		if (capacity == 0 || !map(capacity))
+		{
+			close();
+			return false;
+		}
+		if (memcmp(header->magic, journalMagic, sizeof(journalMagic)) != 0 ||
+			header->version != journalVersion || header->recordSize != sizeof(captureRecord))
+		{
+			//not ours or from another version, never overwrite it
+			close();
+			return false;
+		}
+		if (header->checksum != headerChecksum(header, offsetof(journalHeader, checksum)) || header->capacity != capacity)
+		{
+			recoverHeader();
+		}
+		return true;
+	}
+
+	void CaptureJournal::close()
+	{
+		unmap();
+#ifdef _WIN32
+		if (file != INVALID_HANDLE_VALUE)
+		{
+			CloseHandle((HANDLE)file);
+			file = INVALID_HANDLE_VALUE;
+		}
+#else
+		if (file >= 0)
+		{
+			::close(file);
+			file = -1;
+		}
+#endif
+	}
+
+	uint64_t CaptureJournal::firstSequence() const
+	{
+		return header ? header->firstSequence : 0;
+	}
+
+	uint64_t CaptureJournal::nextSequence() const
+	{
+		return header ? header->nextSequence : 0;
+	}
+
+	uint64_t CaptureJournal::reserveSequence()
+	{
+		if (!header) return 0;
+		uint64_t sequence = header->nextSequence;
+		if (sequence - header->firstSequence >= header->capacity)
+		{
+			if (!grow(header->capacity * 2)) return 0;
+		}
+		header->nextSequence = sequence + 1;
+		header->checksum = headerChecksum(header, offsetof(journalHeader, checksum));
+		flush(header, sizeof(journalHeader));
+		return sequence;
+	}
+
+	bool CaptureJournal::append(captureRecord& record)
+	{
+		captureRecord* target = slot(record.sequence);
+		if (!target) return false;
+		record.checksum = recordChecksum(record);
+		memcpy(target, &record, sizeof(captureRecord));
+		flush(target, sizeof(captureRecord));
+		return true;
+	}
+
+	bool CaptureJournal::find(uint64_t sequence, captureRecord& record) const
+	{
+		const captureRecord* source = slot(sequence);
+		if (!source || source->checksum == 0) return false;
+		captureRecord copy;
+		memcpy(&copy, source, sizeof(captureRecord));
+		if (copy.sequence != sequence || copy.checksum != recordChecksum(copy)) return false;
+		record = copy;
+		return true;
+	}
+
+	captureRecord* CaptureJournal::slot(uint64_t sequence) const
+	{
+		if (!header) return NULL;
+		if (sequence < header->firstSequence || sequence >= header->nextSequence) return NULL;
+		uint64_t index = sequence - header->firstSequence;
+		if (index >= header->capacity) return NULL;
+		return (captureRecord*)(view + journalHeaderSize) + index;
+	}
+
+	//only reached after a crash in the middle of a header write, walk back to the newest committed record
+	void CaptureJournal::recoverHeader()
+	{
+		uint64_t capacity = (viewSize - journalHeaderSize) / sizeof(captureRecord);
+		captureRecord* records = (captureRecord*)(view + journalHeaderSize);
+		uint64_t first = header->firstSequence;
+		uint64_t next = first;
+		for (uint64_t i = capacity; i > 0; i--)
+		{
+			const captureRecord& r = records[i - 1];
+			if (r.checksum != 0 && r.checksum == recordChecksum(r))
+			{
+				first = r.sequence - (i - 1);
+				next = r.sequence + 1;
+				break;
+			}
+		}
+		//a reserved but uncommitted number may have been handed out, never reuse it
+		if (header->nextSequence > next && header->nextSequence - first <= capacity) next = header->nextSequence;
+		header->firstSequence = first;
+		header->nextSequence = next;
+		header->capacity = capacity;
+		header->checksum = headerChecksum(header, offsetof(journalHeader, checksum));
+		flush(header, sizeof(journalHeader));
+	}
+
+	bool CaptureJournal::grow(uint64_t minCapacity)
+	{
+		uint64_t capacity = header->capacity;
+		while (capacity < minCapacity) capacity *= 2;
+		journalHeader saved = *header;
+		unmap();
+		if (!map(capacity)) return false;
+		*header = saved;
+		header->capacity = capacity;
+		header->checksum = headerChecksum(header, offsetof(journalHeader, checksum));
+		flush(header, sizeof(journalHeader));
+		return true;
+	}
+
+	bool CaptureJournal::map(uint64_t capacity)
+	{
+		uint64_t size = journalHeaderSize + capacity * sizeof(captureRecord);
+#ifdef _WIN32
+		//the mapping extends the file when it is larger than the current size
+		mapping = CreateFileMappingA((HANDLE)file, NULL, PAGE_READWRITE, (DWORD)(size >> 32), (DWORD)(size & 0xFFFFFFFF), NULL);
+		if (!mapping) return false;
+		view = (unsigned char*)MapViewOfFile((HANDLE)mapping, FILE_MAP_ALL_ACCESS, 0, 0, (SIZE_T)size);
+		if (!view)
+		{
+			CloseHandle((HANDLE)mapping);
+			mapping = NULL;
+			return false;
+		}
+#else
+		struct stat info;
+		if (fstat(file, &info) != 0) return false;
+		if ((uint64_t)info.st_size < size && ftruncate(file, (off_t)size) != 0) return false;
+		void* address = mmap(NULL, (size_t)size, PROT_READ | PROT_WRITE, MAP_SHARED, file, 0);
+		if (address == MAP_FAILED) return false;
+		view = (unsigned char*)address;
+#endif
+		viewSize = size;
+		header = (journalHeader*)view;
+		return true;
+	}
+
+	void CaptureJournal::unmap()
+	{
+		if (view)
+		{
+#ifdef _WIN32
+			FlushViewOfFile(view, 0);
+			UnmapViewOfFile(view);
+#else
+			msync(view, (size_t)viewSize, MS_SYNC);
+			munmap(view, (size_t)viewSize);
+#endif
+		}
+#ifdef _WIN32
+		if (mapping)
+		{
+			CloseHandle((HANDLE)mapping);
+			mapping = NULL;
+		}
+#endif
+		view = NULL;
+		header = NULL;
+		viewSize = 0;
+	}
+
+	//push a written range to disk, so a power cut after a print never loses the record
+	void CaptureJournal::flush(const void* address, size_t length)
+	{
+#ifdef _WIN32
+		FlushViewOfFile(address, length);
+		FlushFileBuffers((HANDLE)file);
+#else
+		long page = sysconf(_SC_PAGESIZE);
+		uintptr_t begin = (uintptr_t)address & ~(uintptr_t)(page - 1);
+		uintptr_t end = (uintptr_t)address + length;
+		msync((void*)begin, end - begin, MS_SYNC);
+#endif
+	}
+}
@@ -0,0 +1,100 @@
+/*
+* CaptureJournal.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// this header is included from the /clr form, keep it free of <thread>, <mutex> and <atomic>,
+// the implementation lives in CaptureJournal.cpp which is compiled as native code
+
+namespace GreenScreen {
+
+	//one journal entry per capture, fixed size so a sequence number maps straight to a file offset
+	struct captureRecord
+	{
+		uint64_t sequence;
+		int64_t timestamp;		//unix time in milliseconds
+		int32_t backgroundIndex;
+		int32_t foregroundIndex;
+		int32_t hueVar;
+		int32_t saturationVar;
+		int32_t valueVar;
+		int32_t xCoordSample;
+		int32_t yCoordSample;
+		int32_t keyMode;		//keyMode of KeyPipeline.h, how the subject was cut out
+		float plateThreshold;	//clean plate key, standard deviations from the empty set
+		float captureMs;		//from "Take Photo" until the camera file was on disk
+		float composeMs;		//chroma key + foreground + rotation
+		float saveMs;
+		float printMs;
+		char masterPath[260];
+		char screenPath[260];	//screen size jpeg of the same composite, for review screens
+		char thumbPath[260];	//gallery thumbnail
+		uint32_t checksum;		//0 means the slot was reserved but never committed
+	};
+
+	//append-only, memory mapped capture journal
+	//the slot of a record is (sequence - firstSequence), so startup and lookups never scan anything
+	class CaptureJournal
+	{
+	public:
+		CaptureJournal();
+		~CaptureJournal();
+
+		//open or create the journal, firstSequence is only used when the file does not exist yet
+		bool open(const std::string& path, uint64_t firstSequence = 1);
+		void close();
+		bool isOpen() const { return header != NULL; }
+
+		//hand out the next sequence number, it is persisted before returning so numbers never repeat
+		uint64_t reserveSequence();
+		//commit a record for a sequence given by reserveSequence
+		bool append(captureRecord& record);
+		//look up a committed capture, false if the sequence was never committed or is damaged
+		bool find(uint64_t sequence, captureRecord& record) const;
+
+		uint64_t firstSequence() const;
+		uint64_t nextSequence() const;
+
+	private:
+		struct journalHeader;
+
+		bool map(uint64_t capacity);
+		void unmap();
+		bool grow(uint64_t minCapacity);
+		void flush(const void* address, size_t length);
+		captureRecord* slot(uint64_t sequence) const;
+		void recoverHeader();
+
+		journalHeader* header;
+		unsigned char* view;
+		uint64_t viewSize;
+#ifdef _WIN32
+		void* file;
+		void* mapping;
+#else
+		int file;
+#endif
+
+		CaptureJournal(const CaptureJournal&);
+		CaptureJournal& operator=(const CaptureJournal&);
+	};
+
+	//checksum used by the journal for records and header
+	uint32_t journalChecksum(const void* data, size_t length);
+}
@@ -0,0 +1,233 @@
+/*
+* CleanPlate.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "CleanPlate.h"
+#include "PixelKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	//sigma is stored in 8 bits with a quarter level of precision
+	static const float sigmaScale = 4.0f;
+
+	CleanPlate::CleanPlate() : minSigma(3.0f), liveFrames(0)
+	{
+		reset();
+	}
+
+	void CleanPlate::reset()
+	{
+		liveModel = plateModel();
+		liveModel.frames = 0;
+		printModel = plateModel();
+		printModel.frames = 0;
+		liveSum.release();
+		liveSquares.release();
+		liveFrames = 0;
+	}
+
+	void CleanPlate::addLiveFrame(const Mat& frame)
+	{
+		if (frame.empty() || frame.type() != CV_8UC3) return;
+		if (liveSum.empty() || liveSum.size() != frame.size())
+		{
+			liveSum = Mat::zeros(frame.size(), CV_32FC3);
+			liveSquares = Mat::zeros(frame.size(), CV_32FC3);
+			liveFrames = 0;
+		}
+		accumulate(frame, liveSum);
+		accumulateSquare(frame, liveSquares);
+		liveFrames++;
+	}
+
+	bool CleanPlate::finishLive()
+	{
+		if (liveFrames == 0) return false;
+		float n = (float)liveFrames;
+		float floor = minSigma * minSigma;
+		Mat mean(liveSum.size(), CV_32FC3);
+		liveModel.invVariance.create(liveSum.size(), CV_32FC3);
+		for (int y = 0; y < liveSum.rows; y++)
+		{
+			const float* sum = liveSum.ptr<float>(y);
+			const float* squares = liveSquares.ptr<float>(y);
+			float* m = mean.ptr<float>(y);
+			float* inv = liveModel.invVariance.ptr<float>(y);
+			for (int i = 0; i < liveSum.cols * 3; i++)
+			{
+				m[i] = sum[i] / n;
+				float variance = squares[i] / n - m[i] * m[i];
+				inv[i] = 1.0f / std::max(variance, floor);
+			}
+		}
+		mean.convertTo(liveModel.mean, CV_8UC3);
+		liveModel.uniformInvVariance = Vec3f(1.0f / floor, 1.0f / floor, 1.0f / floor);
+		liveModel.frames = liveFrames;
+		liveSum.release();
+		liveSquares.release();
+		return true;
+	}
+
+	bool CleanPlate::setPrintStill(const Mat& still)
+	{
+		if (!liveModel.isReady() || still.empty() || still.type() != CV_8UC3) return false;
+
+		//the median live variance per channel stands in for the noise of the still
+		std::vector<float> channel[3];
+		for (int c = 0; c < 3; c++) channel[c].reserve(liveModel.invVariance.rows * liveModel.invVariance.cols);
+		for (int y = 0; y < liveModel.invVariance.rows; y++)
+		{
+			const float* inv = liveModel.invVariance.ptr<float>(y);
+			for (int x = 0; x < liveModel.invVariance.cols; x++)
+			{
+				for (int c = 0; c < 3; c++) channel[c].push_back(inv[x * 3 + c]);
+			}
+		}
+		for (int c = 0; c < 3; c++)
+		{
+			std::vector<float>& values = channel[c];
+			std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+			printModel.uniformInvVariance[c] = values[values.size() / 2];
+		}
+		still.copyTo(printModel.mean);
+		printModel.invVariance.release();
+		printModel.frames = 1;
+		return true;
+	}
+
+	bool CleanPlate::save(const std::string& folder) const
+	{
+		if (!isReady()) return false;
+		Mat sigma(liveModel.invVariance.size(), CV_8UC3);
+		for (int y = 0; y < sigma.rows; y++)
+		{
+			const float* inv = liveModel.invVariance.ptr<float>(y);
+			uchar* s = sigma.ptr<uchar>(y);
+			for (int i = 0; i < sigma.cols * 3; i++)
+			{
+				s[i] = saturate_cast<uchar>(sigmaScale / std::sqrt(inv[i]));
+			}
+		}
+		if (!imwrite(folder + "/plate_live.png", liveModel.mean)) return false;
+		if (!imwrite(folder + "/plate_live_sigma.png", sigma)) return false;
+		if (!imwrite(folder + "/plate_print.png", printModel.mean)) return false;
+
+		FILE* f = fopen((folder + "/cleanplate.txt").c_str(), "w");
+		if (!f) return false;
+		fprintf(f, "frames %d\n", liveModel.frames);
+		fprintf(f, "print_inv_variance %g %g %g\n", printModel.uniformInvVariance[0], printModel.uniformInvVariance[1], printModel.uniformInvVariance[2]);
+		fclose(f);
+		return true;
+	}
+
+	bool CleanPlate::load(const std::string& folder)
+	{
+		FILE* f = fopen((folder + "/cleanplate.txt").c_str(), "r");
+		if (!f) return false;
+		int frames = 0;
+		float inv[3] = { 0, 0, 0 };
+		int got = fscanf(f, "frames %d\nprint_inv_variance %f %f %f", &frames, &inv[0], &inv[1], &inv[2]);
+		fclose(f);
+		if (got != 4) return false;
+
+		Mat liveMean = imread(folder + "/plate_live.png", IMREAD_COLOR);
+		Mat sigma = imread(folder + "/plate_live_sigma.png", IMREAD_COLOR);
+		Mat printMean = imread(folder + "/plate_print.png", IMREAD_COLOR);
+		if (liveMean.empty() || printMean.empty() || sigma.size() != liveMean.size()) return false;
+
+		reset();
+		float floor = minSigma * minSigma;
+		liveModel.invVariance.create(sigma.size(), CV_32FC3);
+		for (int y = 0; y < sigma.rows; y++)
+		{
+			const uchar* s = sigma.ptr<uchar>(y);
+			float* out = liveModel.invVariance.ptr<float>(y);
+			for (int i = 0; i < sigma.cols * 3; i++)
+			{
+				float deviation = s[i] / sigmaScale;
+				out[i] = 1.0f / std::max(deviation * deviation, floor);
+			}
+		}
+		liveModel.mean = liveMean;
+		liveModel.uniformInvVariance = Vec3f(1.0f / floor, 1.0f / floor, 1.0f / floor);
+		liveModel.frames = frames;
+		printModel.mean = printMean;
+		printModel.uniformInvVariance = Vec3f(inv[0], inv[1], inv[2]);
+		printModel.frames = 1;
+		return true;
+	}
+
+	//squared distance in variances, background where it stays under threshold squared
+	//the weighted squares run in the active kernels, only the sum of the three channels is left here
+	static void differenceMask(const Mat& image, const plateModel& model, float threshold, Mat& mask, FrameArena& arena)
+	{
+		float limit = threshold * threshold;
+		int values = image.cols * 3;
+		const pixelKernels& kernels = activeKernels();
+		size_t scratch = arena.mark();
+		Mat squares = arena.acquire(1, values, CV_32FC1);
+		Mat uniform;
+		if (model.invVariance.empty())
+		{
+			uniform = arena.acquire(1, values, CV_32FC1);
+			float* w = uniform.ptr<float>(0);
+			for (int i = 0; i < values; i++) w[i] = model.uniformInvVariance[i % 3];
+		}
+		float* s = squares.ptr<float>(0);
+		for (int y = 0; y < image.rows; y++)
+		{
+			const float* weight = uniform.empty() ? model.invVariance.ptr<float>(y) : uniform.ptr<float>(0);
+			kernels.weightedSquares(image.ptr<uchar>(y), model.mean.ptr<uchar>(y), weight, s, values);
+			uchar* out = mask.ptr<uchar>(y);
+			for (int x = 0; x < image.cols; x++)
+			{
+				out[x] = s[x * 3] + s[x * 3 + 1] + s[x * 3 + 2] > limit ? 255 : 0;
+			}
+		}
+		arena.rewind(scratch);
+	}
+
+	void differenceKey(Mat& image, const Mat& background, const plateModel& model, float threshold, FrameArena& arena)
+	{
+		if (image.empty() || !model.isReady() || model.mean.size() != image.size()) return;
+		if (background.type() != CV_8UC3 || background.rows < image.rows || background.cols < image.cols) return;
+
+		Mat mask = arena.acquire(image.size(), CV_8UC1);
+		size_t scratch = arena.mark();
+		Mat subject = arena.acquire(image.size(), CV_8UC1);
+		differenceMask(image, model, threshold, subject, arena);
+
+		//drop the speckles of sensor noise and close small holes in the subject
+		Mat cleaned = arena.acquire(image.size(), CV_8UC1);
+		erode(subject, cleaned, Mat());
+		dilate(cleaned, subject, Mat(), cv::Point(-1, -1), 2);
+
+		//blur mask for better results, like chromaKey
+		blur(subject, mask, cv::Size(3, 3));
+		arena.rewind(scratch);
+
+		const pixelKernels& kernels = activeKernels();
+		for (int y = 0; y < image.rows; y++)
+		{
+			kernels.replaceMasked(image.ptr<uchar>(y), background.ptr<uchar>(y), mask.ptr<uchar>(y), image.cols);
+		}
+	}
+}
@@ -0,0 +1,76 @@
+/*
+* CleanPlate.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "FrameArena.h"
+#include <string>
+
+namespace GreenScreen {
+
+	//what the empty set looks like at one resolution
+	//a pixel is background while its colour stays within threshold standard deviations of the mean
+	struct plateModel
+	{
+		cv::Mat mean;					//CV_8UC3
+		cv::Mat invVariance;			//CV_32FC3 per pixel, empty when the model uses uniformInvVariance
+		cv::Vec3f uniformInvVariance;	//one value per channel for the whole frame
+		int frames;
+
+		bool isReady() const { return !mean.empty(); }
+	};
+
+	//per pixel background statistics of the empty set, for backdrops that are wrinkled or unevenly lit
+	//the live model comes from a run of live view frames, the print model from a still of the empty set,
+	//the still has the live noise spread evenly since one picture gives no per pixel variance
+	class CleanPlate
+	{
+	public:
+		CleanPlate();
+
+		//forget both models and start collecting live frames
+		void reset();
+
+		//add one live frame in live geometry, all frames must have the same size
+		void addLiveFrame(const cv::Mat& frame);
+		//compute the live model from the frames added so far
+		bool finishLive();
+		//the print model from a still in print geometry, needs the live model first
+		bool setPrintStill(const cv::Mat& still);
+
+		const plateModel& live() const { return liveModel; }
+		const plateModel& print() const { return printModel; }
+		bool isReady() const { return liveModel.isReady() && printModel.isReady(); }
+
+		//lowest standard deviation per channel, keeps a noise free frame from keying out on every grain
+		float minSigma;
+
+		//plate_live.png, plate_live_sigma.png, plate_print.png and cleanplate.txt in folder
+		bool save(const std::string& folder) const;
+		bool load(const std::string& folder);
+
+	private:
+		plateModel liveModel;
+		plateModel printModel;
+		cv::Mat liveSum;
+		cv::Mat liveSquares;
+		int liveFrames;
+	};
+
+	//key image against the model, pixels close to the empty set are replaced by the background
+	//threshold is in standard deviations, the mask gets the same soft edge as chromaKey
+	void differenceKey(cv::Mat& image, const cv::Mat& background, const plateModel& model, float threshold, FrameArena& arena);
+}
@@ -0,0 +1,214 @@
+/*
+* ClipRecorder.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "ClipRecorder.h"
+#include <atomic>
+#include <cctype>
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define POPEN_WRITE "wb"
+#else
+#include <pthread.h>
+#include <signal.h>
+#define POPEN_WRITE "w"
+#endif
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	struct ClipRecorder::impl
+	{
+		std::vector<Mat> recording;		//ring filled by live view
+		std::vector<Mat> encoding;		//ring owned by the encoder thread
+		int width;
+		int height;
+		int head;						//next slot to write
+		int count;						//valid frames in the recording ring
+
+		std::thread worker;
+		std::atomic<bool> busy;
+		std::mutex resultLock;
+		bool hasResult;
+		clipResult result;
+
+		impl() : width(0), height(0), head(0), count(0), busy(false), hasResult(false) {}
+	};
+
+	static std::string encoderArguments(const std::string& path)
+	{
+		std::string extension = path.substr(path.find_last_of('.') + 1);
+		for (size_t i = 0; i < extension.size(); i++) extension[i] = (char)tolower(extension[i]);
+		if (extension == "gif")
+		{
+			//one palette for the whole loop looks far better than the default web palette
+			return "-vf \"split[a][b];[a]palettegen[p];[b][p]paletteuse\" -loop 0";
+		}
+		if (extension == "webp")
+		{
+			return "-c:v libwebp -loop 0 -q:v 70";
+		}
+		return "-c:v libx264 -preset veryfast -pix_fmt yuv420p -movflags +faststart";
+	}
+
+	static long long fileSize(const std::string& path)
+	{
+		FILE* f = fopen(path.c_str(), "rb");
+		if (!f) return -1;
+		fseek(f, 0, SEEK_END);
+		long long size = ftell(f);
+		fclose(f);
+		return size;
+	}
+
+	ClipRecorder::ClipRecorder() : d(new impl())
+	{
+	}
+
+	ClipRecorder::~ClipRecorder()
+	{
+		if (d->worker.joinable()) d->worker.join();
+		delete d;
+	}
+
+	void ClipRecorder::configure(int width, int height, int capacity)
+	{
+		//never resize the rings under a running encode
+		if (d->worker.joinable()) d->worker.join();
+		d->width = width;
+		d->height = height;
+		d->head = 0;
+		d->count = 0;
+		d->recording.resize(capacity);
+		d->encoding.resize(capacity);
+		for (int i = 0; i < capacity; i++)
+		{
+			d->recording[i].create(height, width, CV_8UC3);
+			d->encoding[i].create(height, width, CV_8UC3);
+		}
+	}
+
+	bool ClipRecorder::isConfigured() const
+	{
+		return !d->recording.empty() && d->width > 0 && d->height > 0;
+	}
+
+	void ClipRecorder::push(const Mat& frame)
+	{
+		if (!isConfigured() || frame.cols != d->width || frame.rows != d->height || frame.type() != CV_8UC3) return;
+		//same size and type as the slot, copyTo reuses the slot memory
+		frame.copyTo(d->recording[d->head]);
+		d->head = (d->head + 1) % (int)d->recording.size();
+		if (d->count < (int)d->recording.size()) d->count++;
+	}
+
+	bool ClipRecorder::isEncoding() const
+	{
+		return d->busy;
+	}
+
+	bool ClipRecorder::encodeAsync(const std::string& outputPath, int fps, const std::string& encoder)
+	{
+		if (d->busy || d->count < 2) return false;
+		if (fps <= 0) fps = 30;
+		if (d->worker.joinable()) d->worker.join();
+
+		//hand the recorded ring to the encoder and keep recording into the other one
+		std::swap(d->recording, d->encoding);
+		int frames = d->count;
+		int capacity = (int)d->encoding.size();
+		int first = (d->head - frames + capacity) % capacity;
+		d->head = 0;
+		d->count = 0;
+		d->busy = true;
+
+		impl* state = d;
+		d->worker = std::thread([state, outputPath, encoder, fps, frames, first, capacity]()
+		{
+			int64 tick = getTickCount();
+			std::ostringstream command;
+			command << "\"" << encoder << "\" -y -loglevel error -f rawvideo -pix_fmt bgr24 -s "
+				<< state->width << "x" << state->height << " -r " << fps << " -i - "
+				<< encoderArguments(outputPath) << " \"" << outputPath << "\"";
+#ifdef _WIN32
+			//cmd.exe strips the outer quotes of the whole line
+			std::string line = "\"" + command.str() + "\"";
+#else
+			std::string line = command.str();
+#endif
+			clipResult result;
+			result.ok = false;
+			result.path = outputPath;
+			result.frames = 0;
+			result.bytes = 0;
+
+#ifndef _WIN32
+			//an encoder that dies early must fail the clip, not the whole process: SIGPIPE is blocked on this
+			//thread only, the write gets EPIPE and the pending signal ends with the thread
+			sigset_t pipeSignal;
+			sigemptyset(&pipeSignal);
+			sigaddset(&pipeSignal, SIGPIPE);
+			pthread_sigmask(SIG_BLOCK, &pipeSignal, NULL);
+#endif
+			FILE* pipe = popen(line.c_str(), POPEN_WRITE);
+			if (pipe)
+			{
+				//forward, then back without repeating the two end frames
+				bool written = true;
+				size_t frameBytes = (size_t)state->width * state->height * 3;
+				for (int i = 0; i < frames && written; i++)
+				{
+					const Mat& frame = state->encoding[(first + i) % capacity];
+					written = fwrite(frame.data, 1, frameBytes, pipe) == frameBytes;
+					result.frames++;
+				}
+				for (int i = frames - 2; i > 0 && written; i--)
+				{
+					const Mat& frame = state->encoding[(first + i) % capacity];
+					written = fwrite(frame.data, 1, frameBytes, pipe) == frameBytes;
+					result.frames++;
+				}
+				int status = pclose(pipe);
+				result.ok = written && status == 0;
+			}
+			result.encodeMs = (float)((getTickCount() - tick) * 1000.0 / getTickFrequency());
+			result.bytes = fileSize(outputPath);
+			if (result.bytes <= 0) result.ok = false;
+
+			std::lock_guard<std::mutex> lock(state->resultLock);
+			state->result = result;
+			state->hasResult = true;
+			state->busy = false;
+		});
+		return true;
+	}
+
+	bool ClipRecorder::takeResult(clipResult& result)
+	{
+		std::lock_guard<std::mutex> lock(d->resultLock);
+		if (!d->hasResult) return false;
+		result = d->result;
+		d->hasResult = false;
+		return true;
+	}
+}
@@ -0,0 +1,67 @@
+/*
+* ClipRecorder.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include <string>
+
+// included from the /clr form: the encoder thread and its locks are hidden in ClipRecorder.cpp
+
+namespace GreenScreen {
+
+	struct clipResult
+	{
+		bool ok;
+		std::string path;
+		int frames;			//frames in the loop, forward and back
+		float encodeMs;
+		long long bytes;
+	};
+
+	//keeps the last composited live frames and turns them into a looping "boomerang" clip
+	//two rings are preallocated: live view fills one while the encoder owns the other,
+	//so recording never allocates and starting an encode is a swap, not a copy
+	class ClipRecorder
+	{
+	public:
+		ClipRecorder();
+		~ClipRecorder();
+
+		//allocate the rings, call again when the live size changes
+		void configure(int width, int height, int capacity);
+		bool isConfigured() const;
+
+		//copy one composited BGR frame into the ring, frames of another size are ignored
+		void push(const cv::Mat& frame);
+
+		//encode the recorded frames on a background thread with a local encoder (ffmpeg by default)
+		//the container comes from the extension of outputPath: .gif, .webp or .mp4
+		//fps is the live frame rate now, the governor may have changed it since configure
+		//returns false if an encode is still running or nothing was recorded
+		bool encodeAsync(const std::string& outputPath, int fps, const std::string& encoder = "ffmpeg");
+		bool isEncoding() const;
+
+		//true once per finished encode
+		bool takeResult(clipResult& result);
+
+	private:
+		struct impl;
+		impl* d;
+
+		ClipRecorder(const ClipRecorder&);
+		ClipRecorder& operator=(const ClipRecorder&);
+	};
+}
@@ -0,0 +1,936 @@
+/*
+* CompositeService.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "CompositeService.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <winsock2.h>
+#include <Windows.h>
+#else
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+#ifdef _WIN32
+	typedef SOCKET socketHandle;
+	static const socketHandle invalidSocket = INVALID_SOCKET;
+
+	//AF_UNIX came with Windows 10 1803, afunix.h is not in the 8.1 SDK of the v140 toolset
+#ifndef UNIX_PATH_MAX
+#define UNIX_PATH_MAX 108
+	struct sockaddr_un
+	{
+		ADDRESS_FAMILY sun_family;
+		char sun_path[UNIX_PATH_MAX];
+	};
+#endif
+
+	static bool startSockets()
+	{
+		static bool isStarted = false;
+		static std::mutex startLock;
+		std::lock_guard<std::mutex> lock(startLock);
+		if (isStarted) return true;
+		WSADATA data;
+		isStarted = WSAStartup(MAKEWORD(2, 2), &data) == 0;
+		return isStarted;
+	}
+
+	static void closeSocket(socketHandle s)
+	{
+		closesocket(s);
+	}
+
+	static void shutdownSocket(socketHandle s)
+	{
+		shutdown(s, SD_BOTH);
+	}
+
+	static const int sendFlags = 0;
+#else
+	typedef int socketHandle;
+	static const socketHandle invalidSocket = -1;
+
+	static bool startSockets()
+	{
+		return true;
+	}
+
+	static void closeSocket(socketHandle s)
+	{
+		::close(s);
+	}
+
+	static void shutdownSocket(socketHandle s)
+	{
+		shutdown(s, SHUT_RDWR);
+	}
+
+	//a client that went away must not kill the service with SIGPIPE
+#ifdef MSG_NOSIGNAL
+	static const int sendFlags = MSG_NOSIGNAL;
+#else
+	static const int sendFlags = 0;
+#endif
+#endif
+
+	static const char requestMagic[4] = { 'G', 'S', 'R', 'Q' };
+	static const char responseMagic[4] = { 'G', 'S', 'R', 'S' };
+	static const size_t requestHeaderSize = 17 * 4;
+	static const size_t responseHeaderSize = 9 * 4;
+	static const uint32_t maxPathLength = 4096;
+	static const uint32_t maxPictureBytes = 256u << 20;
+	static const int maxCompositeSize = 8192;
+	static const int latencySamples = 1024;
+
+	static float msSince(int64 start)
+	{
+		return (float)((getTickCount() - start) * 1000.0 / getTickFrequency());
+	}
+
+	static void putU32(unsigned char* out, uint32_t value)
+	{
+		out[0] = (unsigned char)value;
+		out[1] = (unsigned char)(value >> 8);
+		out[2] = (unsigned char)(value >> 16);
+		out[3] = (unsigned char)(value >> 24);
+	}
+
+	static uint32_t getU32(const unsigned char* in)
+	{
+		return (uint32_t)in[0] | ((uint32_t)in[1] << 8) | ((uint32_t)in[2] << 16) | ((uint32_t)in[3] << 24);
+	}
+
+	static uint32_t floatBits(float value)
+	{
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return bits;
+	}
+
+	static float bitsFloat(uint32_t bits)
+	{
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	static bool sendAll(socketHandle s, const void* data, size_t bytes)
+	{
+		const char* p = (const char*)data;
+		while (bytes > 0)
+		{
+			int chunk = (int)std::min(bytes, (size_t)(1 << 20));
+			int sent = (int)::send(s, p, chunk, sendFlags);
+			if (sent <= 0) return false;
+			p += sent;
+			bytes -= sent;
+		}
+		return true;
+	}
+
+	static bool receiveAll(socketHandle s, void* data, size_t bytes)
+	{
+		char* p = (char*)data;
+		while (bytes > 0)
+		{
+			int chunk = (int)std::min(bytes, (size_t)(1 << 20));
+			int got = (int)::recv(s, p, chunk, 0);
+			if (got <= 0) return false;
+			p += got;
+			bytes -= got;
+		}
+		return true;
+	}
+
+	static bool socketAddress(const std::string& path, sockaddr_un& address)
+	{
+		if (path.empty() || path.size() >= sizeof(address.sun_path)) return false;
+		memset(&address, 0, sizeof(address));
+		address.sun_family = AF_UNIX;
+		memcpy(address.sun_path, path.c_str(), path.size());
+		return true;
+	}
+
+	std::string defaultCompositeSocket()
+	{
+#ifdef _WIN32
+		char folder[MAX_PATH];
+		DWORD length = GetTempPathA(MAX_PATH, folder);
+		if (length == 0 || length >= MAX_PATH) return "greenscreen.sock";
+		return std::string(folder, length) + "greenscreen.sock";
+#else
+		//the runtime folder is private to the user, /tmp is shared so the name carries the uid
+		const char* runtime = getenv("XDG_RUNTIME_DIR");
+		if (runtime && runtime[0] == '/') return std::string(runtime) + "/greenscreen.sock";
+		return "/tmp/greenscreen-" + std::to_string((unsigned long)getuid()) + ".sock";
+#endif
+	}
+
+	//canonical path of a file or folder, symlinks resolved where the system can, empty when it does not exist
+	static std::string canonicalPath(const std::string& path)
+	{
+#ifdef _WIN32
+		char resolved[MAX_PATH];
+		if (!_fullpath(resolved, path.c_str(), MAX_PATH) || GetFileAttributesA(resolved) == INVALID_FILE_ATTRIBUTES) return std::string();
+#else
+		char resolved[PATH_MAX];
+		if (!realpath(path.c_str(), resolved)) return std::string();
+#endif
+		return resolved;
+	}
+
+	//theme paths come from the clients: relative to the theme folder and never outside it, absolute paths and .. included
+	static bool resolveThemePath(const std::string& themeRoot, const std::string& relative, std::string& path)
+	{
+		if (relative.empty() || relative.find('\0') != std::string::npos) return false;
+		path = canonicalPath(themeRoot + "/" + relative);
+		if (path.size() <= themeRoot.size() || path.compare(0, themeRoot.size(), themeRoot) != 0) return false;
+		return path[themeRoot.size()] == '/' || path[themeRoot.size()] == '\\';
+	}
+
+	//the picture grows as its bytes arrive, so a header alone cannot make the service allocate its length
+	static bool receivePicture(socketHandle s, std::vector<unsigned char>& picture, size_t bytes)
+	{
+		static const size_t chunkBytes = 1 << 20;
+		picture.clear();
+		while (picture.size() < bytes)
+		{
+			size_t at = picture.size();
+			size_t chunk = std::min(bytes - at, chunkBytes);
+			picture.resize(at + chunk);
+			if (!receiveAll(s, &picture[at], chunk)) return false;
+		}
+		return true;
+	}
+
+	//request header and strings, the picture is read straight into the request
+	static bool readRequest(socketHandle s, compositeRequest& request)
+	{
+		unsigned char header[requestHeaderSize];
+		if (!receiveAll(s, header, sizeof(header))) return false;
+		if (memcmp(header, requestMagic, 4) != 0) return false;
+
+		request.type = getU32(header + 4);
+		request.id = getU32(header + 8);
+		request.flags = getU32(header + 12);
+		request.width = (int)getU32(header + 16);
+		request.height = (int)getU32(header + 20);
+		request.quality = (int)getU32(header + 24);
+		request.key.xCoordSample = (int)getU32(header + 28);
+		request.key.yCoordSample = (int)getU32(header + 32);
+		request.key.hueVar = (int)getU32(header + 36);
+		request.key.saturationVar = (int)getU32(header + 40);
+		request.key.valueVar = (int)getU32(header + 44);
+		request.key.mode = (int)getU32(header + 48);
+		request.key.plateThreshold = bitsFloat(getU32(header + 52));
+		request.key.sampleWidth = 0;
+		request.key.sampleHeight = 0;
+		uint32_t backgroundLength = getU32(header + 56);
+		uint32_t foregroundLength = getU32(header + 60);
+		uint32_t pictureLength = getU32(header + 64);
+		if (backgroundLength > maxPathLength || foregroundLength > maxPathLength || pictureLength > maxPictureBytes) return false;
+
+		request.backgroundPath.resize(backgroundLength);
+		request.foregroundPath.resize(foregroundLength);
+		if (backgroundLength > 0 && !receiveAll(s, &request.backgroundPath[0], backgroundLength)) return false;
+		if (foregroundLength > 0 && !receiveAll(s, &request.foregroundPath[0], foregroundLength)) return false;
+		if (!receivePicture(s, request.picture, pictureLength)) return false;
+		return true;
+	}
+
+	static bool writeResponse(socketHandle s, const compositeResponse& response)
+	{
+		unsigned char header[responseHeaderSize];
+		memcpy(header, responseMagic, 4);
+		putU32(header + 4, response.id);
+		putU32(header + 8, response.status);
+		putU32(header + 12, floatBits(response.queueMs));
+		putU32(header + 16, floatBits(response.composeMs));
+		putU32(header + 20, (uint32_t)response.width);
+		putU32(header + 24, (uint32_t)response.height);
+		putU32(header + 28, response.flags);
+		putU32(header + 32, (uint32_t)response.body.size());
+		if (!sendAll(s, header, sizeof(header))) return false;
+		return response.body.empty() || sendAll(s, &response.body[0], response.body.size());
+	}
+
+	//themes are read once and kept at their original size, the print size and a few quick composite sizes,
+	//the least recently used theme goes when the cache is full
+	//Mats are handed out as shared headers, nobody writes into a cached image
+	struct themeCache
+	{
+		static const size_t maxSizes = 4;
+
+		struct entry
+		{
+			Mat original;
+			Mat print;					//as the print side resized it for the last picture
+			std::vector<Mat> sized;		//most recent first
+			uint64_t lastUse;
+		};
+
+		mutable std::mutex lock;
+		std::map<std::string, entry> entries;
+		size_t capacity;
+		uint64_t uses;
+		uint64_t hits;
+		uint64_t misses;
+
+		themeCache() : capacity(16), uses(0), hits(0), misses(0) {}
+
+		static std::string nameOf(const std::string& path, bool hasAlpha)
+		{
+			return path + (hasAlpha ? "|alpha" : "|color");
+		}
+
+		//size 0x0 gives the theme for the print side, at the print size of the last picture when there was one
+		bool get(const std::string& path, bool hasAlpha, cv::Size size, Mat& out)
+		{
+			std::string name = nameOf(path, hasAlpha);
+			Mat original;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				std::map<std::string, entry>::iterator found = entries.find(name);
+				if (found != entries.end())
+				{
+					entry& e = found->second;
+					e.lastUse = ++uses;
+					if (size.area() == 0 || e.original.size() == size)
+					{
+						out = size.area() == 0 && !e.print.empty() ? e.print : e.original;
+						hits++;
+						return true;
+					}
+					for (size_t i = 0; i < e.sized.size(); i++)
+					{
+						if (e.sized[i].size() != size) continue;
+						out = e.sized[i];
+						std::rotate(e.sized.begin(), e.sized.begin() + i, e.sized.begin() + i + 1);
+						hits++;
+						return true;
+					}
+					original = e.original;
+				}
+				misses++;
+			}
+
+			//disk and resize happen outside the lock, two workers may do the same work once
+			if (original.empty())
+			{
+				original = imread(path, hasAlpha ? IMREAD_UNCHANGED : IMREAD_COLOR);
+				if (original.empty()) return false;
+			}
+			Mat sized;
+			if (size.area() > 0 && original.size() != size) resize(original, sized, size, 0, 0, INTER_AREA);
+			out = sized.empty() ? original : sized;
+
+			std::lock_guard<std::mutex> guard(lock);
+			entry& e = entries[name];
+			e.original = original;
+			e.lastUse = ++uses;
+			if (!sized.empty())
+			{
+				e.sized.insert(e.sized.begin(), sized);
+				if (e.sized.size() > maxSizes) e.sized.pop_back();
+			}
+			evict();
+			return true;
+		}
+
+		//the theme at the print size of the last picture, so the next picture of the same size skips the resize
+		void keepPrint(const std::string& path, bool hasAlpha, const Mat& print)
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			std::map<std::string, entry>::iterator found = entries.find(nameOf(path, hasAlpha));
+			if (found != entries.end()) found->second.print = print;
+		}
+
+		void evict()
+		{
+			while (entries.size() > capacity)
+			{
+				std::map<std::string, entry>::iterator oldest = entries.begin();
+				for (std::map<std::string, entry>::iterator it = entries.begin(); it != entries.end(); ++it)
+				{
+					if (it->second.lastUse < oldest->second.lastUse) oldest = it;
+				}
+				entries.erase(oldest);
+			}
+		}
+	};
+
+	//one client, the reader thread fills the queue and the workers answer on the same socket
+	//the socket is closed with the last reference, a worker never writes to a reused handle
+	struct serviceConnection
+	{
+		socketHandle socket;
+		std::mutex writeLock;
+		std::atomic<bool> isOpen;
+		std::thread reader;
+
+		serviceConnection(socketHandle s) : socket(s), isOpen(true) {}
+		~serviceConnection() { closeSocket(socket); }
+
+		void respond(const compositeResponse& response)
+		{
+			std::lock_guard<std::mutex> lock(writeLock);
+			if (isOpen && !writeResponse(socket, response)) isOpen = false;
+		}
+	};
+
+	struct queuedRequest
+	{
+		compositeRequest request;
+		std::shared_ptr<serviceConnection> from;
+		int64 arrivedTick;
+	};
+
+	struct CompositeService::impl
+	{
+		std::string socketPath;
+		std::string themeRoot;		//canonical, every theme path of a request resolves inside it
+		socketHandle listener;
+		std::thread acceptor;
+		std::vector<std::thread> workers;
+		std::atomic<bool> isStopping;
+		bool isRunning;
+		int batchSize;
+		size_t maxQueue;
+
+		mutable std::mutex connectionLock;
+		std::vector<std::shared_ptr<serviceConnection> > connections;
+
+		mutable std::mutex queueLock;
+		std::condition_variable queueReady;
+		std::deque<queuedRequest> queue;
+		size_t maxQueueDepth;
+
+		themeCache themes;
+
+		mutable std::mutex statsLock;
+		uint64_t requests;
+		uint64_t failed;
+		uint64_t rejected;
+		uint64_t batches;
+		uint64_t batchedRequests;
+		std::vector<float> queueMs;		//rings of the last latencySamples requests
+		std::vector<float> totalMs;
+		size_t samples;
+
+		impl() : listener(invalidSocket), isStopping(false), isRunning(false), batchSize(4), maxQueue(64), maxQueueDepth(0),
+			requests(0), failed(0), rejected(0), batches(0), batchedRequests(0),
+			queueMs(latencySamples, 0.0f), totalMs(latencySamples, 0.0f), samples(0) {}
+
+		void acceptLoop();
+		void readLoop(std::shared_ptr<serviceConnection> connection);
+		void workerLoop();
+		void record(const compositeResponse& response, float totalLatencyMs);
+		compositeStats stats() const;
+		std::string statsText() const;
+	};
+
+	void CompositeService::impl::acceptLoop()
+	{
+		while (!isStopping)
+		{
+			socketHandle client = accept(listener, NULL, NULL);
+			if (client == invalidSocket)
+			{
+				if (isStopping) break;
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				continue;
+			}
+
+			std::shared_ptr<serviceConnection> connection(new serviceConnection(client));
+			std::lock_guard<std::mutex> lock(connectionLock);
+
+			//readers of clients that left are joined here, their sockets go with the last queued request
+			for (size_t i = 0; i < connections.size();)
+			{
+				if (!connections[i]->isOpen)
+				{
+					if (connections[i]->reader.joinable()) connections[i]->reader.join();
+					connections.erase(connections.begin() + i);
+				}
+				else
+				{
+					i++;
+				}
+			}
+			connections.push_back(connection);
+			connection->reader = std::thread(&impl::readLoop, this, connection);
+		}
+	}
+
+	void CompositeService::impl::readLoop(std::shared_ptr<serviceConnection> connection)
+	{
+		while (!isStopping && connection->isOpen)
+		{
+			queuedRequest item;
+			if (!readRequest(connection->socket, item.request)) break;
+			item.arrivedTick = getTickCount();
+
+			compositeResponse response = compositeResponse();
+			response.id = item.request.id;
+			if (item.request.type == compositeStatsRequest)
+			{
+				//stats skip the queue, they are what is asked when the queue is stuck
+				std::string text = statsText();
+				response.body.assign(text.begin(), text.end());
+				connection->respond(response);
+				continue;
+			}
+
+			bool isValid = item.request.type == compositeComposeRequest && !item.request.picture.empty() &&
+				!item.request.backgroundPath.empty() && !item.request.foregroundPath.empty() &&
+				item.request.width >= 0 && item.request.height >= 0 &&
+				item.request.width <= maxCompositeSize && item.request.height <= maxCompositeSize &&
+				(item.request.width > 0) == (item.request.height > 0);
+			if (!isValid)
+			{
+				response.status = compositeBadRequest;
+				record(response, 0);
+				connection->respond(response);
+				continue;
+			}
+			if (!resolveThemePath(themeRoot, item.request.backgroundPath, item.request.backgroundPath) ||
+				!resolveThemePath(themeRoot, item.request.foregroundPath, item.request.foregroundPath))
+			{
+				response.status = compositeThemeMissing;
+				record(response, 0);
+				connection->respond(response);
+				continue;
+			}
+
+			item.from = connection;
+			{
+				std::lock_guard<std::mutex> lock(queueLock);
+				if (queue.size() < maxQueue)
+				{
+					queue.push_back(std::move(item));
+					maxQueueDepth = std::max(maxQueueDepth, queue.size());
+					queueReady.notify_one();
+					continue;
+				}
+			}
+			response.status = compositeBusy;
+			{
+				std::lock_guard<std::mutex> lock(statsLock);
+				rejected++;
+			}
+			connection->respond(response);
+		}
+		connection->isOpen = false;
+		shutdownSocket(connection->socket);
+	}
+
+	//compose one request with the theme of its batch, background and foreground may come back resized
+	static uint32_t composeRequest(KeyPipeline& pipeline, const compositeRequest& request, Mat& background, Mat& foreground,
+		compositeResponse& response)
+	{
+		bool isWideScreen = (request.flags & compositeWideScreen) != 0;
+		Mat out;
+		if (request.width > 0)
+		{
+			if (!pipeline.composePreview(&request.picture[0], request.picture.size(), request.key, background, foreground,
+				request.width, request.height, isWideScreen, out)) return compositeDecodeFailed;
+		}
+		else
+		{
+			if (!pipeline.composePrint(&request.picture[0], request.picture.size(), request.key, background, foreground,
+				isWideScreen, out)) return compositeDecodeFailed;
+		}
+
+		std::vector<int> params;
+		bool isPng = (request.flags & compositePng) != 0;
+		if (!isPng)
+		{
+			params.push_back(IMWRITE_JPEG_QUALITY);
+			params.push_back(request.quality > 0 && request.quality <= 100 ? request.quality : 90);
+		}
+		if (!imencode(isPng ? ".png" : ".jpg", out, response.body, params)) return compositeEncodeFailed;
+		response.width = out.cols;
+		response.height = out.rows;
+		response.flags = isPng ? compositePng : 0;
+		return compositeOk;
+	}
+
+	static bool isSameBatch(const compositeRequest& a, const compositeRequest& b)
+	{
+		return a.backgroundPath == b.backgroundPath && a.foregroundPath == b.foregroundPath &&
+			a.width == b.width && a.height == b.height && (a.flags & compositeWideScreen) == (b.flags & compositeWideScreen);
+	}
+
+	void CompositeService::impl::workerLoop()
+	{
+		//every worker keys on its own arenas, nothing of a pipeline is shared
+		KeyPipeline pipeline;
+		std::vector<queuedRequest> batch;
+		while (true)
+		{
+			batch.clear();
+			{
+				std::unique_lock<std::mutex> lock(queueLock);
+				queueReady.wait(lock, [this]() { return isStopping || !queue.empty(); });
+				if (isStopping) return;
+
+				//the oldest request and the queued ones of the same theme and size behind it
+				batch.push_back(std::move(queue.front()));
+				queue.pop_front();
+				for (std::deque<queuedRequest>::iterator it = queue.begin(); it != queue.end() && (int)batch.size() < batchSize;)
+				{
+					if (isSameBatch(it->request, batch[0].request))
+					{
+						batch.push_back(std::move(*it));
+						it = queue.erase(it);
+					}
+					else
+					{
+						++it;
+					}
+				}
+			}
+			{
+				std::lock_guard<std::mutex> lock(statsLock);
+				batches++;
+				batchedRequests += batch.size();
+			}
+
+			//one theme lookup for the whole batch
+			const compositeRequest& first = batch[0].request;
+			cv::Size themeSize(first.width, first.height);
+			Mat background, foreground;
+			bool hasTheme = themes.get(first.backgroundPath, false, themeSize, background) &&
+				themes.get(first.foregroundPath, true, themeSize, foreground);
+			const uchar* backgroundData = background.data;
+			const uchar* foregroundData = foreground.data;
+
+			for (size_t i = 0; i < batch.size(); i++)
+			{
+				const compositeRequest& request = batch[i].request;
+				compositeResponse response = compositeResponse();
+				response.id = request.id;
+				response.queueMs = msSince(batch[i].arrivedTick);
+				int64 tick = getTickCount();
+				response.status = hasTheme ? composeRequest(pipeline, request, background, foreground, response) : compositeThemeMissing;
+				response.composeMs = msSince(tick);
+				if (response.status != compositeOk) response.body.clear();
+
+				record(response, msSince(batch[i].arrivedTick));
+				batch[i].from->respond(response);
+				batch[i].request.picture.clear();
+			}
+
+			//the print side resized the theme to the picture, the next batch of that theme finds it ready
+			if (hasTheme && first.width == 0)
+			{
+				if (background.data != backgroundData) themes.keepPrint(first.backgroundPath, false, background);
+				if (foreground.data != foregroundData) themes.keepPrint(first.foregroundPath, true, foreground);
+			}
+			batch.clear();
+		}
+	}
+
+	void CompositeService::impl::record(const compositeResponse& response, float totalLatencyMs)
+	{
+		std::lock_guard<std::mutex> lock(statsLock);
+		requests++;
+		if (response.status != compositeOk)
+		{
+			failed++;
+			return;
+		}
+		queueMs[samples % latencySamples] = response.queueMs;
+		totalMs[samples % latencySamples] = totalLatencyMs;
+		samples++;
+	}
+
+	static float percentileOf(std::vector<float> values, float fraction)
+	{
+		if (values.empty()) return 0;
+		size_t n = std::min(values.size() - 1, (size_t)(fraction * values.size()));
+		std::nth_element(values.begin(), values.begin() + n, values.end());
+		return values[n];
+	}
+
+	compositeStats CompositeService::impl::stats() const
+	{
+		compositeStats stats = compositeStats();
+		{
+			std::lock_guard<std::mutex> lock(connectionLock);
+			stats.workers = (int)workers.size();
+			for (size_t i = 0; i < connections.size(); i++)
+			{
+				if (connections[i]->isOpen) stats.connections++;
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(queueLock);
+			stats.queueDepth = (int)queue.size();
+			stats.maxQueueDepth = (int)maxQueueDepth;
+		}
+		{
+			std::lock_guard<std::mutex> lock(themes.lock);
+			stats.themeHits = themes.hits;
+			stats.themeMisses = themes.misses;
+		}
+
+		std::vector<float> queueCopy, totalCopy;
+		{
+			std::lock_guard<std::mutex> lock(statsLock);
+			stats.requests = requests;
+			stats.failed = failed;
+			stats.rejected = rejected;
+			stats.batches = batches;
+			stats.batchedRequests = batchedRequests;
+			size_t count = std::min(samples, (size_t)latencySamples);
+			queueCopy.assign(queueMs.begin(), queueMs.begin() + count);
+			totalCopy.assign(totalMs.begin(), totalMs.begin() + count);
+		}
+		stats.queueP50Ms = percentileOf(queueCopy, 0.5f);
+		stats.queueP99Ms = percentileOf(queueCopy, 0.99f);
+		stats.latencyP50Ms = percentileOf(totalCopy, 0.5f);
+		stats.latencyP90Ms = percentileOf(totalCopy, 0.9f);
+		stats.latencyP99Ms = percentileOf(totalCopy, 0.99f);
+		return stats;
+	}
+
+	std::string CompositeService::impl::statsText() const
+	{
+		compositeStats stats = this->stats();
+		char text[512];
+		snprintf(text, sizeof(text),
+			"%d workers, %d connections, queue %d (max %d), %llu requests, %llu failed, %llu busy, "
+			"%llu batches (%.2f per batch), themes %llu hits %llu misses, "
+			"queue p50 %.1f p99 %.1f ms, latency p50 %.1f p90 %.1f p99 %.1f ms\n",
+			stats.workers, stats.connections, stats.queueDepth, stats.maxQueueDepth,
+			(unsigned long long)stats.requests, (unsigned long long)stats.failed, (unsigned long long)stats.rejected,
+			(unsigned long long)stats.batches, stats.batches > 0 ? (double)stats.batchedRequests / stats.batches : 0.0,
+			(unsigned long long)stats.themeHits, (unsigned long long)stats.themeMisses,
+			stats.queueP50Ms, stats.queueP99Ms, stats.latencyP50Ms, stats.latencyP90Ms, stats.latencyP99Ms);
+		return text;
+	}
+
+	CompositeService::CompositeService() : d(new impl())
+	{
+	}
+
+	CompositeService::~CompositeService()
+	{
+		stop();
+		delete d;
+	}
+
+	bool CompositeService::start(const std::string& socketPath, const std::string& themeFolder, int workers, int batchSize, int maxQueue, int themeCapacity)
+	{
+		if (d->isRunning || !startSockets()) return false;
+		sockaddr_un address;
+		if (!socketAddress(socketPath, address)) return false;
+		std::string themeRoot = canonicalPath(themeFolder);
+		if (themeRoot.empty()) return false;
+
+		//a socket file left by a run that did not stop cleanly blocks the bind
+		std::remove(socketPath.c_str());
+		d->listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (d->listener == invalidSocket) return false;
+		//owner only, set before listen so no other user can connect in between
+		bool isBound = bind(d->listener, (const sockaddr*)&address, sizeof(address)) == 0;
+#ifndef _WIN32
+		isBound = isBound && chmod(socketPath.c_str(), S_IRUSR | S_IWUSR) == 0;
+#endif
+		if (!isBound || listen(d->listener, 16) != 0)
+		{
+			closeSocket(d->listener);
+			d->listener = invalidSocket;
+			return false;
+		}
+
+		d->socketPath = socketPath;
+		d->themeRoot = themeRoot;
+		d->batchSize = std::max(1, batchSize);
+		d->maxQueue = (size_t)std::max(1, maxQueue);
+		d->themes.capacity = (size_t)std::max(2, themeCapacity);
+		d->isStopping = false;
+		d->isRunning = true;
+
+		if (workers <= 0) workers = std::max(1, (int)std::thread::hardware_concurrency() - 1);
+		for (int i = 0; i < workers; i++)
+		{
+			d->workers.push_back(std::thread(&impl::workerLoop, d));
+		}
+		d->acceptor = std::thread(&impl::acceptLoop, d);
+		return true;
+	}
+
+	void CompositeService::stop()
+	{
+		if (!d->isRunning) return;
+		d->isStopping = true;
+
+		//shutdown wakes the blocked accept and every blocked read
+		shutdownSocket(d->listener);
+		closeSocket(d->listener);
+		if (d->acceptor.joinable()) d->acceptor.join();
+		d->listener = invalidSocket;
+		{
+			std::lock_guard<std::mutex> lock(d->connectionLock);
+			for (size_t i = 0; i < d->connections.size(); i++)
+			{
+				shutdownSocket(d->connections[i]->socket);
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(d->queueLock);
+			d->queueReady.notify_all();
+		}
+		for (size_t i = 0; i < d->workers.size(); i++)
+		{
+			if (d->workers[i].joinable()) d->workers[i].join();
+		}
+		d->workers.clear();
+		for (size_t i = 0; i < d->connections.size(); i++)
+		{
+			if (d->connections[i]->reader.joinable()) d->connections[i]->reader.join();
+		}
+		d->connections.clear();
+		d->queue.clear();
+		std::remove(d->socketPath.c_str());
+		d->isRunning = false;
+	}
+
+	bool CompositeService::isRunning() const
+	{
+		return d->isRunning;
+	}
+
+	compositeStats CompositeService::stats() const
+	{
+		return d->stats();
+	}
+
+	std::string CompositeService::statsText() const
+	{
+		return d->statsText();
+	}
+
+	struct CompositeClient::impl
+	{
+		socketHandle socket;
+
+		impl() : socket(invalidSocket) {}
+	};
+
+	CompositeClient::CompositeClient() : d(new impl())
+	{
+	}
+
+	CompositeClient::~CompositeClient()
+	{
+		close();
+		delete d;
+	}
+
+	bool CompositeClient::connect(const std::string& socketPath)
+	{
+		close();
+		sockaddr_un address;
+		if (!startSockets() || !socketAddress(socketPath, address)) return false;
+		d->socket = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (d->socket == invalidSocket) return false;
+		if (::connect(d->socket, (const sockaddr*)&address, sizeof(address)) != 0)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void CompositeClient::close()
+	{
+		if (d->socket != invalidSocket) closeSocket(d->socket);
+		d->socket = invalidSocket;
+	}
+
+	bool CompositeClient::isConnected() const
+	{
+		return d->socket != invalidSocket;
+	}
+
+	bool CompositeClient::send(const compositeRequest& request)
+	{
+		if (d->socket == invalidSocket) return false;
+		unsigned char header[requestHeaderSize];
+		memcpy(header, requestMagic, 4);
+		putU32(header + 4, request.type);
+		putU32(header + 8, request.id);
+		putU32(header + 12, request.flags);
+		putU32(header + 16, (uint32_t)request.width);
+		putU32(header + 20, (uint32_t)request.height);
+		putU32(header + 24, (uint32_t)request.quality);
+		putU32(header + 28, (uint32_t)request.key.xCoordSample);
+		putU32(header + 32, (uint32_t)request.key.yCoordSample);
+		putU32(header + 36, (uint32_t)request.key.hueVar);
+		putU32(header + 40, (uint32_t)request.key.saturationVar);
+		putU32(header + 44, (uint32_t)request.key.valueVar);
+		putU32(header + 48, (uint32_t)request.key.mode);
+		putU32(header + 52, floatBits(request.key.plateThreshold));
+		putU32(header + 56, (uint32_t)request.backgroundPath.size());
+		putU32(header + 60, (uint32_t)request.foregroundPath.size());
+		putU32(header + 64, (uint32_t)request.picture.size());
+		return sendAll(d->socket, header, sizeof(header)) &&
+			sendAll(d->socket, request.backgroundPath.data(), request.backgroundPath.size()) &&
+			sendAll(d->socket, request.foregroundPath.data(), request.foregroundPath.size()) &&
+			(request.picture.empty() || sendAll(d->socket, &request.picture[0], request.picture.size()));
+	}
+
+	bool CompositeClient::receive(compositeResponse& response)
+	{
+		if (d->socket == invalidSocket) return false;
+		unsigned char header[responseHeaderSize];
+		if (!receiveAll(d->socket, header, sizeof(header)) || memcmp(header, responseMagic, 4) != 0) return false;
+		response.id = getU32(header + 4);
+		response.status = getU32(header + 8);
+		response.queueMs = bitsFloat(getU32(header + 12));
+		response.composeMs = bitsFloat(getU32(header + 16));
+		response.width = (int)getU32(header + 20);
+		response.height = (int)getU32(header + 24);
+		response.flags = getU32(header + 28);
+		uint32_t bodyLength = getU32(header + 32);
+		if (bodyLength > maxPictureBytes) return false;
+		response.body.resize(bodyLength);
+		return bodyLength == 0 || receiveAll(d->socket, &response.body[0], bodyLength);
+	}
+}
@@ -0,0 +1,158 @@
+/*
+* CompositeService.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "KeyPipeline.h"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+// included from the /clr entry point: the sockets, workers and locks are hidden in CompositeService.cpp
+
+namespace GreenScreen {
+
+	//wire format on the local socket, every field little endian, requests and responses may be pipelined
+	//request:  "GSRQ", type, id, flags, width, height, quality, sampleX, sampleY, hueVar, saturationVar, valueVar,
+	//          mode, plateThreshold (float bits), backgroundLength, foregroundLength, pictureLength,
+	//          then the background path, the foreground path and the encoded picture
+	//          sampleX and sampleY are in pixels of the composed image, the paths are relative to the theme folder
+	//response: "GSRS", id, status, queueMs, composeMs (float bits), width, height, flags, bodyLength, then the body
+	//responses come back in the order the composites finish, the id tells them apart
+	enum compositeRequestType
+	{
+		compositeComposeRequest = 1,	//picture in, encoded composite out
+		compositeStatsRequest = 2		//statsText() in the body
+	};
+
+	enum compositeFlags
+	{
+		compositeWideScreen = 1,	//landscape theme, the print is turned to portrait like in the booth
+		compositePng = 2			//png instead of jpeg
+	};
+
+	enum compositeStatus
+	{
+		compositeOk = 0,
+		compositeBadRequest = 1,
+		compositeDecodeFailed = 2,
+		compositeThemeMissing = 3,
+		compositeEncodeFailed = 4,
+		compositeBusy = 5			//queue full, try again later
+	};
+
+	struct compositeRequest
+	{
+		uint32_t type;
+		uint32_t id;
+		uint32_t flags;
+		int width;				//0 composes at print size, otherwise a quick composite at this size
+		int height;
+		int quality;			//jpeg quality, 0 for the default
+		keySettings key;
+		std::string backgroundPath;
+		std::string foregroundPath;
+		std::vector<unsigned char> picture;
+	};
+
+	struct compositeResponse
+	{
+		uint32_t id;
+		uint32_t status;
+		float queueMs;			//waiting for a worker
+		float composeMs;		//decode, key, overlay and encode
+		int width;
+		int height;
+		uint32_t flags;
+		std::vector<unsigned char> body;
+	};
+
+	struct compositeStats
+	{
+		int workers;
+		int connections;
+		int queueDepth;
+		int maxQueueDepth;
+		uint64_t requests;
+		uint64_t failed;
+		uint64_t rejected;		//queue full
+		uint64_t batches;
+		uint64_t batchedRequests;
+		uint64_t themeHits;
+		uint64_t themeMisses;
+		float queueP50Ms;		//over the last latencySamples requests
+		float queueP99Ms;
+		float latencyP50Ms;		//request in to response out
+		float latencyP90Ms;
+		float latencyP99Ms;
+	};
+
+	//headless compositing for the kiosk and the sharing station, the booth form is not involved
+	//a listener accepts connections on a local unix socket, every connection has a reader,
+	//requests go to one queue and a pool of workers, each with its own pipeline, takes them in batches:
+	//requests of the same theme and size are composed together with one theme lookup,
+	//themes are loaded once and kept at the sizes they were last used in a shared cache
+	class CompositeService
+	{
+	public:
+		CompositeService();
+		~CompositeService();
+
+		//workers 0 takes one per core but one, maxQueue requests wait at most before busy is answered
+		//a stale socket file at socketPath is replaced, the new one is for the owner only
+		//theme paths of the requests are relative to themeFolder, a path that resolves outside it is answered theme missing
+		bool start(const std::string& socketPath, const std::string& themeFolder, int workers = 0, int batchSize = 4, int maxQueue = 64, int themeCapacity = 16);
+		//stop listening, drop the connections and join every thread, queued requests are not composed
+		void stop();
+		bool isRunning() const;
+
+		compositeStats stats() const;
+		std::string statsText() const;
+
+	private:
+		struct impl;
+		impl* d;
+
+		CompositeService(const CompositeService&);
+		CompositeService& operator=(const CompositeService&);
+	};
+
+	//blocking client of the service, for the kiosk side and for testing
+	class CompositeClient
+	{
+	public:
+		CompositeClient();
+		~CompositeClient();
+
+		bool connect(const std::string& socketPath);
+		void close();
+		bool isConnected() const;
+
+		//send does not wait for the answer, several requests can be in flight
+		bool send(const compositeRequest& request);
+		bool receive(compositeResponse& response);
+
+	private:
+		struct impl;
+		impl* d;
+
+		CompositeClient(const CompositeClient&);
+		CompositeClient& operator=(const CompositeClient&);
+	};
+
+	//the default socket of the service, in a folder of the user: the user temp folder on windows,
+	//XDG_RUNTIME_DIR or else /tmp with the uid in the name elsewhere
+	std::string defaultCompositeSocket();
+}
@@ -0,0 +1,282 @@
+/*
+* EdsCamera.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "EdsCamera.h"
+#include "EDSDK.h"
+#include "EDSDKErrors.h"
+#include "EDSDKTypes.h"
+#include <mutex>
+
+namespace GreenScreen {
+
+	struct EdsCamera::impl
+	{
+		bool isSDKLoaded;
+		bool isOpen;
+		bool isLiveStream;
+		EdsCameraRef camera;
+		// live Stream canon vars
+		EdsEvfImageRef evfImage;
+		EdsStreamRef stream;
+		std::string deviceName;
+
+		//the object event handler fills this, the form drains it in pollPicture
+		std::mutex pictureLock;
+		std::vector<unsigned char> picture;
+		bool hasPicture;
+
+		impl() : isSDKLoaded(false), isOpen(false), isLiveStream(false), camera(NULL), evfImage(NULL), stream(NULL), hasPicture(false) {}
+	};
+
+	//get the first CANON camera connected to pc
+	static EdsError getFirstCamera(EdsCameraRef *camera)
+	{
+		EdsError err = EDS_ERR_OK;
+		EdsCameraListRef cameraList = NULL;
+		EdsUInt32 count = 0;
+		// Get camera list
+		err = EdsGetCameraList(&cameraList);
+		// Get number of cameras
+		if (err == EDS_ERR_OK)
+		{
+			err = EdsGetChildCount(cameraList, &count);
+			if (count == 0) err = EDS_ERR_DEVICE_NOT_FOUND;
+		}
+		// Get first camera retrieved
+		if (err == EDS_ERR_OK)err = EdsGetChildAtIndex(cameraList, 0, camera);
+
+		// Release camera list
+		if (cameraList != NULL)
+		{
+			EdsRelease(cameraList);
+			cameraList = NULL;
+		}
+		return err;
+	}
+
+	//Canon event handler, the picture is downloaded to memory and handed to the camera that asked for it
+	static EdsError EDSCALLBACK handleObjectEvent(EdsObjectEvent event, EdsBaseRef object, EdsVoid * context)
+	{
+		EdsError err = EDS_ERR_OK;
+		if (event == kEdsObjectEvent_DirItemRequestTransfer)
+		{
+			EdsStreamRef stream = NULL;
+			EdsDirectoryItemInfo dirItemInfo;
+			err = EdsGetDirectoryItemInfo(object, &dirItemInfo);
+			if (err == EDS_ERR_OK) err = EdsCreateMemoryStream(dirItemInfo.size, &stream);
+			if (err == EDS_ERR_OK) err = EdsDownload(object, dirItemInfo.size, stream);
+			if (err == EDS_ERR_OK) err = EdsDownloadComplete(object);
+			if (err == EDS_ERR_OK)
+			{
+				EdsVoid* pointer = NULL;
+				EdsUInt32 length = 0;
+				EdsGetPointer(stream, &pointer);
+				EdsGetLength(stream, &length);
+				if (pointer && length > 0 && context)
+				{
+					((EdsCamera*)context)->pictureArrived((const unsigned char*)pointer, (size_t)length);
+				}
+			}
+			if (stream) EdsRelease(stream);
+			stream = NULL;
+		}
+		if (object) EdsRelease(object);
+		return err;
+	}
+
+	//get the CANON camera name by reference
+	static std::string getDeviceName(EdsCameraRef &camera)
+	{
+		EdsDeviceInfo deviceInfo;
+		EdsError err = EDS_ERR_OK;
+		if (err == EDS_ERR_OK)
+		{
+			err = EdsGetDeviceInfo(camera, &deviceInfo);
+			if (err == EDS_ERR_OK && camera == NULL) err = EDS_ERR_DEVICE_NOT_FOUND;
+		}
+		if (err == EDS_ERR_OK) return deviceInfo.szDeviceDescription;
+		return "";
+	}
+
+	EdsCamera::EdsCamera() : d(new impl())
+	{
+	}
+
+	EdsCamera::~EdsCamera()
+	{
+		close();
+		delete d;
+	}
+
+	bool EdsCamera::open()
+	{
+		//initialize Canon SDK
+		EdsError err = EdsInitializeSDK();
+		if (err == EDS_ERR_OK)
+		{
+			d->isSDKLoaded = true;
+		}
+
+		if (err == EDS_ERR_OK)
+		{
+			err = getFirstCamera(&d->camera);
+		}
+
+		// Set object event handler
+		if (err == EDS_ERR_OK)
+		{
+			err = EdsSetObjectEventHandler(d->camera, kEdsObjectEvent_All, handleObjectEvent, this);
+		}
+
+		//Open camera
+		if (err == EDS_ERR_OK)
+		{
+			err = EdsOpenSession(d->camera);
+			if (err == EDS_ERR_OK)
+			{
+				d->deviceName = getDeviceName(d->camera);
+				d->isOpen = true;
+			}
+		}
+		if (!d->isOpen) return false;
+
+		// Set camera properties for save image
+		EdsInt32 saveTarget = kEdsSaveTo_Host;
+		err = EdsSetPropertyData(d->camera, kEdsPropID_SaveTo, 0, 4, &saveTarget);
+		EdsCapacity newCapacity = { 0x7FFFFFFF, 0x1000, 1 };
+		err = EdsSetCapacity(d->camera, newCapacity);
+		return true;
+	}
+
+	void EdsCamera::close()
+	{
+		if (d->isLiveStream)
+		{
+			EdsRelease(d->stream);
+			d->stream = NULL;
+			EdsRelease(d->evfImage);
+			d->evfImage = NULL;
+			d->isLiveStream = false;
+		}
+		if (d->isOpen)
+		{
+			// End session
+			EdsCloseSession(d->camera);
+			d->isOpen = false;
+		}
+		if (d->camera)
+		{
+			EdsRelease(d->camera);
+			d->camera = NULL;
+		}
+		if (d->isSDKLoaded)
+		{
+			EdsTerminateSDK();
+			d->isSDKLoaded = false;
+		}
+	}
+
+	std::string EdsCamera::name() const
+	{
+		return d->deviceName;
+	}
+
+	bool EdsCamera::startLiveView()
+	{
+		if (!d->isOpen) return false;
+
+		// Start Live view
+		// Get the output device for the live view image
+		EdsUInt32 device;
+		EdsError err = EdsGetPropertyData(d->camera, kEdsPropID_Evf_OutputDevice, 0, sizeof(device), &device);
+
+		// PC live view starts by setting the PC as the output device for the live view image.
+		if (err == EDS_ERR_OK)
+		{
+			device |= kEdsEvfOutputDevice_PC;
+			err = EdsSetPropertyData(d->camera, kEdsPropID_Evf_OutputDevice, 0, sizeof(device), &device);
+		}
+
+		// Create memory stream
+		err = EdsCreateMemoryStream(0, &d->stream);
+		if (err == EDS_ERR_OK)
+		{
+			// Create EvfImageRef.
+			err = EdsCreateEvfImageRef(d->stream, &d->evfImage);
+		}
+		d->isLiveStream = err == EDS_ERR_OK;
+		return d->isLiveStream;
+	}
+
+	bool EdsCamera::downloadLiveView(const unsigned char*& data, size_t& bytes)
+	{
+		if (!d->isLiveStream) return false;
+
+		// Download live view image data.
+		EdsError err = EdsDownloadEvfImage(d->camera, d->evfImage);
+		if (err != EDS_ERR_OK) return false;
+
+		// Get Pointer of evfStream
+		EdsVoid* pointer = NULL;
+		err = EdsGetPointer(d->stream, &pointer);
+		if (err != EDS_ERR_OK) return false;
+
+		// Get Length of evfStream
+		EdsUInt32 length = 0;
+		err = EdsGetLength(d->stream, &length);
+		if (err != EDS_ERR_OK) return false;
+
+		// Get image data array size
+		EdsSize imageSize;
+		err = EdsGetPropertyData(d->evfImage, kEdsPropID_Evf_CoordinateSystem, 0, sizeof(imageSize), &imageSize);
+		if (err != EDS_ERR_OK) return false;
+
+		data = (const unsigned char*)pointer;
+		bytes = (size_t)length;
+		return true;
+	}
+
+	bool EdsCamera::takePicture()
+	{
+		if (!d->isOpen) return false;
+		return EdsSendCommand(d->camera, kEdsCameraCommand_TakePicture, 0) == EDS_ERR_OK;
+	}
+
+	//large RAW only, RAW+jpeg would send two files for one shutter
+	bool EdsCamera::setRawCapture(bool isRaw)
+	{
+		if (!d->isOpen) return false;
+		EdsUInt32 quality = isRaw ? EdsImageQuality_LR : EdsImageQuality_LJF;
+		return EdsSetPropertyData(d->camera, kEdsPropID_ImageQuality, 0, sizeof(quality), &quality) == EDS_ERR_OK;
+	}
+
+	void EdsCamera::pictureArrived(const unsigned char* data, size_t bytes)
+	{
+		std::lock_guard<std::mutex> lock(d->pictureLock);
+		d->picture.assign(data, data + bytes);
+		d->hasPicture = true;
+	}
+
+	bool EdsCamera::pollPicture(std::vector<unsigned char>& picture)
+	{
+		std::lock_guard<std::mutex> lock(d->pictureLock);
+		if (!d->hasPicture) return false;
+		//swap keeps both buffers at their largest size, no new allocation for the next picture
+		picture.swap(d->picture);
+		d->hasPicture = false;
+		return true;
+	}
+}
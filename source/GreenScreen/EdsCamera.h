@@ -0,0 +1,50 @@
+/*
+* EdsCamera.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "Backends.h"
+
+namespace GreenScreen {
+
+	//the first CANON camera connected to the pc, through the EDSDK
+	class EdsCamera : public CameraBackend
+	{
+	public:
+		EdsCamera();
+		~EdsCamera();
+
+		bool open();
+		void close();
+		std::string name() const;
+
+		bool startLiveView();
+		bool downloadLiveView(const unsigned char*& data, size_t& bytes);
+
+		bool takePicture();
+		bool pollPicture(std::vector<unsigned char>& picture);
+		bool setRawCapture(bool isRaw);
+
+		//called from the EDSDK object event handler with the downloaded file
+		void pictureArrived(const unsigned char* data, size_t bytes);
+
+	private:
+		struct impl;
+		impl* d;
+
+		EdsCamera(const EdsCamera&);
+		EdsCamera& operator=(const EdsCamera&);
+	};
+}
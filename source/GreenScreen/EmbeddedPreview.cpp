@@ -0,0 +1,203 @@
+/*
+* EmbeddedPreview.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "EmbeddedPreview.h"
+#include <cstring>
+#include <vector>
+
+namespace GreenScreen {
+
+	//the CR3 boxes with previews sit in front of the sensor data, near the start of the file
+	static const size_t cr3SearchBytes = 4 << 20;
+	//tiff readers stop after a few directories, a CR2 has four
+	static const int maxTiffDirectories = 8;
+
+	static unsigned int bigEndian16(const unsigned char* p)
+	{
+		return (p[0] << 8) | p[1];
+	}
+
+	static unsigned int bigEndian32(const unsigned char* p)
+	{
+		return ((unsigned int)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+	}
+
+	bool jpegImageSize(const unsigned char* data, size_t bytes, int& width, int& height)
+	{
+		if (!data || bytes < 4 || data[0] != 0xFF || data[1] != 0xD8) return false;
+		size_t at = 2;
+		while (at + 4 <= bytes)
+		{
+			if (data[at] != 0xFF) return false;
+			unsigned char marker = data[at + 1];
+			if (marker == 0xFF)
+			{
+				at++;
+				continue;
+			}
+			if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7))
+			{
+				at += 2;
+				continue;
+			}
+			if (marker == 0xDA || marker == 0xD9) return false;
+			size_t length = bigEndian16(data + at + 2);
+			if (length < 2 || at + 2 + length > bytes) return false;
+			//baseline, extended and progressive huffman frames, the lossless raw data of a CR2 is C3
+			if (marker == 0xC0 || marker == 0xC1 || marker == 0xC2)
+			{
+				if (length < 7) return false;
+				height = (int)bigEndian16(data + at + 5);
+				width = (int)bigEndian16(data + at + 7);
+				return width > 0 && height > 0;
+			}
+			if (marker >= 0xC3 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC) return false;
+			at += 2 + length;
+		}
+		return false;
+	}
+
+	static void addCandidate(const unsigned char* file, size_t fileBytes, size_t offset, size_t bytes, std::vector<embeddedJpeg>& found)
+	{
+		if (offset == 0 || bytes == 0 || offset >= fileBytes || bytes > fileBytes - offset) return;
+		embeddedJpeg jpeg;
+		jpeg.data = file + offset;
+		jpeg.bytes = bytes;
+		if (jpegImageSize(jpeg.data, jpeg.bytes, jpeg.width, jpeg.height)) found.push_back(jpeg);
+	}
+
+	//previews of a tiff structure: strips that are one jpeg and jpeg interchange thumbnails, of every directory
+	//offsets are relative to the tiff header, which is the start of a CR2 or the exif block of a jpeg
+	static void tiffPreviews(const unsigned char* tiff, size_t size, std::vector<embeddedJpeg>& found)
+	{
+		if (size < 8) return;
+		bool isLittle = memcmp(tiff, "II*\0", 4) == 0;
+		if (!isLittle && memcmp(tiff, "MM\0*", 4) != 0) return;
+		struct reader
+		{
+			const unsigned char* p;
+			size_t size;
+			bool isLittle;
+			unsigned int u16(size_t at) const
+			{
+				if (at + 2 > size) return 0;
+				return isLittle ? (p[at] | (p[at + 1] << 8)) : bigEndian16(p + at);
+			}
+			unsigned int u32(size_t at) const
+			{
+				if (at + 4 > size) return 0;
+				return isLittle ? (p[at] | (p[at + 1] << 8) | (p[at + 2] << 16) | ((unsigned int)p[at + 3] << 24)) : bigEndian32(p + at);
+			}
+		} read = { tiff, size, isLittle };
+
+		size_t directory = read.u32(4);
+		for (int i = 0; i < maxTiffDirectories && directory >= 8 && directory + 2 <= size; i++)
+		{
+			unsigned int entries = read.u16(directory);
+			size_t stripOffset = 0, stripBytes = 0, jpegOffset = 0, jpegBytes = 0;
+			for (unsigned int e = 0; e < entries; e++)
+			{
+				size_t entry = directory + 2 + e * 12;
+				if (entry + 12 > size) break;
+				unsigned int tag = read.u16(entry);
+				unsigned int type = read.u16(entry + 2);
+				unsigned int count = read.u32(entry + 4);
+				//a single SHORT or LONG sits in the value field itself
+				size_t value = type == 3 ? read.u16(entry + 8) : read.u32(entry + 8);
+				if (count != 1 || (type != 3 && type != 4)) continue;
+				if (tag == 0x0111) stripOffset = value;
+				else if (tag == 0x0117) stripBytes = value;
+				else if (tag == 0x0201) jpegOffset = value;
+				else if (tag == 0x0202) jpegBytes = value;
+			}
+			addCandidate(tiff, size, stripOffset, stripBytes, found);
+			addCandidate(tiff, size, jpegOffset, jpegBytes, found);
+			directory = read.u32(directory + 2 + entries * 12);
+		}
+	}
+
+	//the exif block of a jpeg is a tiff structure inside the APP1 segment
+	static void jpegPreviews(const unsigned char* data, size_t bytes, std::vector<embeddedJpeg>& found)
+	{
+		size_t at = 2;
+		while (at + 4 <= bytes && data[at] == 0xFF)
+		{
+			unsigned char marker = data[at + 1];
+			if (marker == 0xDA || marker == 0xD9) return;
+			size_t length = bigEndian16(data + at + 2);
+			if (length < 2 || at + 2 + length > bytes) return;
+			if (marker == 0xE1 && length >= 8 && memcmp(data + at + 4, "Exif\0\0", 6) == 0)
+			{
+				tiffPreviews(data + at + 10, length - 8, found);
+				return;
+			}
+			at += 2 + length;
+		}
+	}
+
+	//CR3 keeps a 160x120 THMB in the movie header and a 1620x1080 PRVW in a uuid box after it
+	static void cr3Previews(const unsigned char* data, size_t bytes, std::vector<embeddedJpeg>& found)
+	{
+		size_t end = bytes < cr3SearchBytes ? bytes : cr3SearchBytes;
+		for (size_t at = 4; at + 8 <= end; at++)
+		{
+			if (data[at] != 'P' && data[at] != 'T') continue;
+			if (memcmp(data + at, "PRVW", 4) != 0 && memcmp(data + at, "THMB", 4) != 0) continue;
+			size_t boxStart = at - 4;
+			size_t boxBytes = bigEndian32(data + boxStart);
+			if (boxBytes < 16 || boxStart + boxBytes > bytes) continue;
+			//the jpeg follows a short header of sizes and flags
+			for (size_t soi = at + 4; soi + 3 <= boxStart + boxBytes && soi < at + 64; soi++)
+			{
+				if (data[soi] == 0xFF && data[soi + 1] == 0xD8 && data[soi + 2] == 0xFF)
+				{
+					addCandidate(data, bytes, soi, boxStart + boxBytes - soi, found);
+					break;
+				}
+			}
+			at = boxStart + boxBytes - 1;
+		}
+	}
+
+	bool findEmbeddedPreview(const unsigned char* data, size_t bytes, int minWidth, int minHeight, embeddedJpeg& preview)
+	{
+		if (!data || bytes < 16) return false;
+		std::vector<embeddedJpeg> found;
+		if (data[0] == 0xFF && data[1] == 0xD8) jpegPreviews(data, bytes, found);
+		else if (memcmp(data + 4, "ftyp", 4) == 0) cr3Previews(data, bytes, found);
+		else tiffPreviews(data, bytes, found);
+		if (found.empty()) return false;
+
+		int best = -1;
+		for (size_t i = 0; i < found.size(); i++)
+		{
+			const embeddedJpeg& candidate = found[i];
+			bool isBigEnough = candidate.width >= minWidth && candidate.height >= minHeight;
+			if (best < 0)
+			{
+				best = (int)i;
+				continue;
+			}
+			const embeddedJpeg& chosen = found[best];
+			bool isChosenBigEnough = chosen.width >= minWidth && chosen.height >= minHeight;
+			long long area = (long long)candidate.width * candidate.height;
+			long long chosenArea = (long long)chosen.width * chosen.height;
+			if (isBigEnough != isChosenBigEnough ? isBigEnough : (isBigEnough ? area < chosenArea : area > chosenArea)) best = (int)i;
+		}
+		preview = found[best];
+		return true;
+	}
+}
@@ -0,0 +1,39 @@
+/*
+* EmbeddedPreview.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include <cstddef>
+
+namespace GreenScreen {
+
+	//a jpeg stored inside a camera file, data points into the file bytes
+	struct embeddedJpeg
+	{
+		const unsigned char* data;
+		size_t bytes;
+		int width;
+		int height;
+	};
+
+	//size of a baseline or progressive jpeg from its frame header, false for anything opencv can not decode
+	bool jpegImageSize(const unsigned char* data, size_t bytes, int& width, int& height);
+
+	//the previews a camera writes next to the picture: the exif thumbnail of a jpeg,
+	//the IFD0 preview and IFD1 thumbnail of a CR2, the PRVW and THMB images of a CR3
+	//picks the smallest one of at least minWidth x minHeight, or the largest when none is that big
+	//false when the file has none, nothing is decoded or copied
+	bool findEmbeddedPreview(const unsigned char* data, size_t bytes, int minWidth, int minHeight, embeddedJpeg& preview);
+}
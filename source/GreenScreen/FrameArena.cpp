@@ -0,0 +1,122 @@
+/*
+* FrameArena.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "FrameArena.h"
+#include <cstring>
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	FrameArena::FrameArena()
+	{
+		memset(&stats, 0, sizeof(stats));
+	}
+
+	FrameArena::~FrameArena()
+	{
+		for (int c = 0; c < classCount; c++)
+		{
+			for (size_t i = 0; i < classes[c].size(); i++)
+			{
+				fastFree(classes[c][i].data);
+			}
+		}
+	}
+
+	//classes are 2^k, 1.25 * 2^k, 1.5 * 2^k and 1.75 * 2^k bytes, so a block wastes at most a quarter
+	int FrameArena::sizeClass(size_t bytes, size_t& classBytes)
+	{
+		if (bytes < 64) bytes = 64;
+		int power = 0;
+		while (((size_t)1 << (power + 1)) <= bytes) power++;
+		size_t base = (size_t)1 << power;
+		for (int step = 0; step < 4; step++)
+		{
+			size_t candidate = base + (base / 4) * step;
+			if (candidate >= bytes)
+			{
+				classBytes = candidate;
+				return power * 4 + step;
+			}
+		}
+		classBytes = base * 2;
+		return (power + 1) * 4;
+	}
+
+	void FrameArena::rewind(size_t mark)
+	{
+		while (handedOut.size() > mark)
+		{
+			block& b = classes[handedOut.back().classIndex][handedOut.back().index];
+			b.used = false;
+			stats.bytesInUse -= b.bytes;
+			handedOut.pop_back();
+		}
+	}
+
+	Mat FrameArena::acquire(int rows, int cols, int type)
+	{
+		if (rows <= 0 || cols <= 0) return Mat();
+		size_t bytes = (size_t)rows * cols * CV_ELEM_SIZE(type);
+		size_t classBytes = 0;
+		int c = sizeClass(bytes, classBytes);
+		if (c >= classCount) return Mat(rows, cols, type);
+
+		stats.acquires++;
+		std::vector<block>& blocks = classes[c];
+		for (size_t i = 0; i < blocks.size(); i++)
+		{
+			if (!blocks[i].used)
+			{
+				blocks[i].used = true;
+				stats.bytesInUse += blocks[i].bytes;
+				blockRef ref = { c, i };
+				handedOut.push_back(ref);
+				return Mat(rows, cols, type, blocks[i].data);
+			}
+		}
+
+		//miss, this is the only place the arena touches the heap
+		block fresh;
+		fresh.data = (unsigned char*)fastMalloc(classBytes);
+		fresh.bytes = classBytes;
+		fresh.used = true;
+		blocks.push_back(fresh);
+		blockRef ref = { c, blocks.size() - 1 };
+		handedOut.push_back(ref);
+		stats.blockAllocations++;
+		stats.bytesReserved += classBytes;
+		stats.bytesInUse += classBytes;
+		if (stats.bytesReserved > stats.peakBytes) stats.peakBytes = stats.bytesReserved;
+		return Mat(rows, cols, type, fresh.data);
+	}
+
+	//only between frames, erasing blocks would move the ones still handed out
+	void FrameArena::trim()
+	{
+		if (!handedOut.empty()) return;
+		for (int c = 0; c < classCount; c++)
+		{
+			for (size_t i = 0; i < classes[c].size(); i++)
+			{
+				fastFree(classes[c][i].data);
+			}
+			std::vector<block>().swap(classes[c]);
+		}
+		stats.bytesReserved = 0;
+	}
+}
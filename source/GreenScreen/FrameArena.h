@@ -0,0 +1,83 @@
+/*
+* FrameArena.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include <cstdint>
+#include <vector>
+
+namespace GreenScreen {
+
+	struct arenaCounters
+	{
+		uint64_t acquires;		//buffers handed out
+		uint64_t blockAllocations;	//blocks the arena took from the heap, flat in steady state; other heap use is not counted
+		uint64_t bytesReserved;	//memory currently owned by the arena
+		uint64_t peakBytes;		//highest bytesReserved seen
+		uint64_t bytesInUse;	//handed out since the last reset
+	};
+
+	//scratch buffers for one frame or one print
+	//blocks are grouped in size classes (four per power of two) and handed out again after reset(),
+	//so once the arena is warm a frame only reuses memory it already owns
+	class FrameArena
+	{
+	public:
+		FrameArena();
+		~FrameArena();
+
+		//every buffer handed out is free again, Mats from before the reset must not be used
+		void reset() { rewind(0); }
+
+		//free only what was handed out after mark(), for temporaries that die inside one stage
+		size_t mark() const { return handedOut.size(); }
+		void rewind(size_t mark);
+
+		//a Mat on arena memory, allocates only when no free block of the size class is left
+		//the Mat does not own its data, OpenCV functions writing to it with the same size and type reuse it
+		cv::Mat acquire(int rows, int cols, int type);
+		cv::Mat acquire(cv::Size size, int type) { return acquire(size.height, size.width, type); }
+
+		//give back all memory, only does something right after reset()
+		void trim();
+
+		const arenaCounters& counters() const { return stats; }
+
+	private:
+		struct block
+		{
+			unsigned char* data;
+			size_t bytes;
+			bool used;
+		};
+
+		struct blockRef
+		{
+			int classIndex;
+			size_t index;
+		};
+
+		static int sizeClass(size_t bytes, size_t& classBytes);
+
+		static const int classCount = 4 * 48;
+		std::vector<block> classes[classCount];
+		std::vector<blockRef> handedOut;	//in acquire order, so rewind can pop back to a mark
+		arenaCounters stats;
+
+		FrameArena(const FrameArena&);
+		FrameArena& operator=(const FrameArena&);
+	};
+}
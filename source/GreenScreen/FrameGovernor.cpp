@@ -0,0 +1,265 @@
+/*
+* FrameGovernor.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "FrameGovernor.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+namespace GreenScreen {
+
+	static const char* stageNames[liveStageCount] = { "download", "decode", "key", "compose", "display", "total" };
+
+	//a step up needs this much room under the budget, well below it so the next window does not go over again
+	static const float roomToStepUp = 0.6f;
+
+	frameHistogram::frameHistogram()
+	{
+		clear();
+	}
+
+	void frameHistogram::add(float ms)
+	{
+		int bucket = ms <= 0 ? 0 : (int)(ms / bucketMs);
+		counts[std::min(bucket, buckets - 1)]++;
+		frames++;
+		maxMs = std::max(maxMs, ms);
+	}
+
+	void frameHistogram::clear()
+	{
+		memset(counts, 0, sizeof(counts));
+		frames = 0;
+		maxMs = 0;
+	}
+
+	float frameHistogram::percentile(float fraction) const
+	{
+		if (frames == 0) return 0;
+		unsigned int wanted = (unsigned int)std::ceil(fraction * frames);
+		unsigned int seen = 0;
+		for (int i = 0; i < buckets - 1; i++)
+		{
+			seen += counts[i];
+			if (seen >= wanted) return std::min((float)((i + 1) * bucketMs), maxMs);
+		}
+		return maxMs;
+	}
+
+	FrameGovernor::FrameGovernor() : budget(34), maxFps(30), enabled(true), steps(0),
+		windowCount(0), calmWindows(0), calmNeeded(3), windowsSinceUp(1000), slowTotalMs(0)
+	{
+		memset(levelFrames, 0, sizeof(levelFrames));
+		memset(knobSteps, 0, sizeof(knobSteps));
+		memset(taken, 0, sizeof(taken));
+		memset(windowSums, 0, sizeof(windowSums));
+	}
+
+	void FrameGovernor::configure(float budgetMs, int fps, bool isEnabled)
+	{
+		budget = budgetMs > 0 ? budgetMs : 34;
+		maxFps = fps > 0 ? fps : 30;
+		enabled = isEnabled;
+
+		//start over at full quality
+		memset(knobSteps, 0, sizeof(knobSteps));
+		steps = 0;
+		windowCount = 0;
+		memset(windowSums, 0, sizeof(windowSums));
+		calmWindows = 0;
+		calmNeeded = 3;
+		windowsSinceUp = 1000;
+	}
+
+	bool FrameGovernor::frameDone(const liveFrameCosts& costs)
+	{
+		for (int i = 0; i < liveStageCount; i++)
+		{
+			histograms[i].add(costs.ms[i]);
+			windowSums[i] += costs.ms[i];
+		}
+		levelFrames[steps]++;
+		windowTotals[windowCount++] = costs.ms[liveStageTotal];
+		if (windowCount < windowFrames) return false;
+
+		//the slow frames decide, a single hiccup of the camera should not cost quality
+		float totals[windowFrames];
+		memcpy(totals, windowTotals, sizeof(totals));
+		int slow = windowFrames * 9 / 10;
+		std::nth_element(totals, totals + slow, totals + windowFrames);
+		slowTotalMs = totals[slow];
+
+		bool isChanged = false;
+		if (enabled)
+		{
+			windowsSinceUp = std::min(windowsSinceUp + 1, 1000);
+			if (slowTotalMs > budget)
+			{
+				//over budget right after a step up, wait longer before the next one
+				if (windowsSinceUp <= 2) calmNeeded = std::min(calmNeeded * 2, 48);
+				calmWindows = 0;
+				isChanged = stepDown(windowSums);
+			}
+			else if (slowTotalMs < budget * roomToStepUp)
+			{
+				calmWindows++;
+				if (steps == 0)
+				{
+					calmNeeded = 3;
+				}
+				else if (calmWindows >= calmNeeded)
+				{
+					isChanged = stepUp();
+					calmWindows = 0;
+				}
+			}
+			else
+			{
+				calmWindows = 0;
+			}
+		}
+
+		windowCount = 0;
+		memset(windowSums, 0, sizeof(windowSums));
+		return isChanged;
+	}
+
+	bool FrameGovernor::stepDown(const float* windowMs)
+	{
+		//the stage that costs most picks the knob, the others follow when it has no step left
+		int order[knobCount] = { knobScale, knobMatte, knobFps };
+		float display = windowMs[liveStageCompose] + windowMs[liveStageDisplay];
+		if (windowMs[liveStageKey] >= windowMs[liveStageDecode] && windowMs[liveStageKey] >= display &&
+			windowMs[liveStageKey] >= windowMs[liveStageDownload])
+		{
+			order[0] = knobMatte;
+			order[1] = knobScale;
+		}
+		else if (windowMs[liveStageDownload] > windowMs[liveStageDecode] && windowMs[liveStageDownload] > display)
+		{
+			//nothing here makes the camera faster, ask it less often
+			order[0] = knobFps;
+			order[1] = knobScale;
+			order[2] = knobMatte;
+		}
+
+		for (int i = 0; i < knobCount; i++)
+		{
+			int knob = order[i];
+			if (knobSteps[knob] >= 2) continue;
+			knobSteps[knob]++;
+			taken[steps++] = knob;
+			return true;
+		}
+		return false;
+	}
+
+	bool FrameGovernor::stepUp()
+	{
+		if (steps == 0) return false;
+		knobSteps[taken[--steps]]--;
+		windowsSinceUp = 0;
+		return true;
+	}
+
+	liveQuality FrameGovernor::quality() const
+	{
+		liveQuality quality = fullLiveQuality();
+		if (!enabled) return quality;
+		static const float scales[3] = { 1.0f, 0.75f, 0.5f };
+		quality.scale = scales[knobSteps[knobScale]];
+		quality.matte = knobSteps[knobMatte] >= 1 ? matteNoBlur : matteFull;
+		quality.reuseMatte = knobSteps[knobMatte] >= 2;
+		return quality;
+	}
+
+	int FrameGovernor::targetFps() const
+	{
+		if (!enabled) return maxFps;
+		if (knobSteps[knobFps] == 1) return std::max(1, maxFps * 2 / 3);
+		if (knobSteps[knobFps] == 2) return std::max(1, maxFps / 2);
+		return maxFps;
+	}
+
+	int FrameGovernor::intervalMs() const
+	{
+		//a tick shorter than the slow frames only queues timer messages behind them
+		int fps = targetFps();
+		return std::max((1000 + fps - 1) / fps, (int)std::ceil(slowTotalMs));
+	}
+
+	std::string FrameGovernor::describe() const
+	{
+		static const char* scaleNames[3] = { "", "scale 3/4", "scale 1/2" };
+		static const char* matteNames[3] = { "", "matte no blur", "matte every 2nd frame" };
+		std::string knobs;
+		if (knobSteps[knobScale] > 0) knobs += scaleNames[knobSteps[knobScale]];
+		if (knobSteps[knobMatte] > 0)
+		{
+			if (!knobs.empty()) knobs += ", ";
+			knobs += matteNames[knobSteps[knobMatte]];
+		}
+		if (knobs.empty()) knobs = "full quality";
+
+		char text[160];
+		snprintf(text, sizeof(text), "level %d (%s), %d fps%s", steps, knobs.c_str(), targetFps(), enabled ? "" : ", governor off");
+		return text;
+	}
+
+	std::string FrameGovernor::report() const
+	{
+		char line[256];
+		std::string text;
+		snprintf(line, sizeof(line), "%u live frames, budget %.0f ms, slow frames %.1f ms, %s\n",
+			histograms[liveStageTotal].frames, budget, slowTotalMs, describe().c_str());
+		text += line;
+
+		for (int i = 0; i < liveStageCount; i++)
+		{
+			const frameHistogram& histogram = histograms[i];
+			snprintf(line, sizeof(line), "  %-8s p50 %4.0f  p90 %4.0f  p99 %4.0f  max %6.1f ms\n", stageNames[i],
+				histogram.percentile(0.5f), histogram.percentile(0.9f), histogram.percentile(0.99f), histogram.maxMs);
+			text += line;
+		}
+
+		//only the buckets that have frames, the spread of the whole tick
+		const frameHistogram& total = histograms[liveStageTotal];
+		text += "  total ms:";
+		for (int i = 0; i < frameHistogram::buckets; i++)
+		{
+			if (total.counts[i] == 0) continue;
+			if (i == frameHistogram::buckets - 1) snprintf(line, sizeof(line), " %d+:%u", i * frameHistogram::bucketMs, total.counts[i]);
+			else snprintf(line, sizeof(line), " %d-%d:%u", i * frameHistogram::bucketMs, (i + 1) * frameHistogram::bucketMs, total.counts[i]);
+			text += line;
+		}
+		text += "\n  frames per level:";
+		for (int i = 0; i <= knobCount * 2; i++)
+		{
+			if (levelFrames[i] == 0) continue;
+			snprintf(line, sizeof(line), " %d:%u", i, levelFrames[i]);
+			text += line;
+		}
+		text += "\n";
+		return text;
+	}
+
+	void FrameGovernor::clearHistograms()
+	{
+		for (int i = 0; i < liveStageCount; i++) histograms[i].clear();
+		memset(levelFrames, 0, sizeof(levelFrames));
+	}
+}
@@ -0,0 +1,124 @@
+/*
+* FrameGovernor.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "KeyPipeline.h"
+#include <string>
+
+namespace GreenScreen {
+
+	enum liveStage
+	{
+		liveStageDownload = 0,	//EVF frame from the camera
+		liveStageDecode,
+		liveStageKey,
+		liveStageCompose,		//scale back, foreground
+		liveStageDisplay,		//copy to the form bitmap, share and clip
+		liveStageTotal,			//the whole live tick
+		liveStageCount
+	};
+
+	//what one live tick cost, per stage in liveStage order
+	struct liveFrameCosts
+	{
+		float ms[liveStageCount];
+	};
+
+	//frame times in 2 ms buckets, the last bucket takes everything slower
+	struct frameHistogram
+	{
+		static const int buckets = 41;
+		static const int bucketMs = 2;
+		unsigned int counts[buckets];
+		unsigned int frames;
+		float maxMs;
+
+		frameHistogram();
+		void add(float ms);
+		void clear();
+		//upper edge of the bucket that holds the given fraction of the frames
+		float percentile(float fraction) const;
+	};
+
+	//the knobs of the governor, each one has two steps down from full quality
+	enum governorKnob
+	{
+		knobMatte = 0,		//no blur, then a mask every second frame
+		knobScale,			//3/4, then 1/2 of the live size, the decode halves with it when it can
+		knobFps,			//2/3, then 1/2 of the fastest frame rate
+		knobCount
+	};
+
+	//holds the live view within a frame time budget
+	//measures every stage of the live tick and steps the quality down when the slow frames go over budget,
+	//the knob follows the stage that costs most, the quality comes back in reverse order once there is room again
+	//no threads, the form calls it from the live tick
+	class FrameGovernor
+	{
+	public:
+		FrameGovernor();
+
+		//budget of one live tick, the fastest frame rate to aim for, disabled keeps full quality and still measures
+		void configure(float budgetMs, int maxFps, bool isEnabled);
+		bool isEnabled() const { return enabled; }
+		float budgetMs() const { return budget; }
+
+		//account one live frame, true when the quality or the frame rate just changed
+		bool frameDone(const liveFrameCosts& costs);
+
+		//number of steps down from full quality, 0 is full quality
+		int level() const { return steps; }
+		int knobStep(int knob) const { return knobSteps[knob]; }
+		liveQuality quality() const;
+		int targetFps() const;
+		//timer interval for the target frame rate, never shorter than the slow frames of the last window take
+		//follows the frame times, so it can change when frameDone returns false
+		int intervalMs() const;
+
+		const frameHistogram& histogram(int stage) const { return histograms[stage]; }
+		//"level 2 (scale 3/4, matte no blur), 30 fps"
+		std::string describe() const;
+		//percentiles of every stage, the total histogram and the frames spent at each level
+		std::string report() const;
+		void clearHistograms();
+
+	private:
+		bool stepDown(const float* windowMs);
+		bool stepUp();
+
+		float budget;
+		int maxFps;
+		bool enabled;
+
+		frameHistogram histograms[liveStageCount];
+		unsigned int levelFrames[knobCount * 2 + 1];
+
+		//quality steps in the order they were taken, undone from the back
+		int knobSteps[knobCount];
+		int taken[knobCount * 2];
+		int steps;
+
+		//the window the decision is made on
+		static const int windowFrames = 30;
+		float windowTotals[windowFrames];
+		float windowSums[liveStageCount];
+		int windowCount;
+		int calmWindows;		//windows in a row with room to spare
+		int calmNeeded;			//before the next step up, grows when a step up had to be taken back
+		int windowsSinceUp;
+		float slowTotalMs;		//90th percentile of the last window
+	};
+}
@@ -0,0 +1,113 @@
+/*
+* GdiPrinter.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "GdiPrinter.h"
+#define NOMINMAX
+#include <Windows.h>
+
+#define SRCCOPY2             (unsigned long)0x00CC0020
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	//printing functions, this store the drivers and pointer to printer in order to call it
+	//the strings are copies, nothing points into the buffers of the spooler calls
+	struct printerInfo
+	{
+		std::wstring portName;
+		std::wstring driver;
+		std::wstring deviceName;
+	};
+
+	// this return the printer info about the primary printer setup in windows
+	static bool getPrimaryPrinter(printerInfo& out)
+	{
+		//get default printer size info
+		unsigned long size = 0;
+		GetDefaultPrinterW(NULL, &size);
+		if (!size) return false;
+		std::vector<wchar_t> defaultName(size);
+		if (!GetDefaultPrinterW(&defaultName[0], &size)) return false;
+		out.deviceName = &defaultName[0];
+
+		//list all printer in this pc
+		unsigned long pcbNeeded = 0, pcbReturned = 0;
+		EnumPrintersW(PRINTER_ENUM_LOCAL, NULL, 2, NULL, 0, &pcbNeeded, &pcbReturned);
+		if (!pcbNeeded) return false;
+
+		//if we found some printer connected, then get the drivers and name and some stuff
+		std::vector<BYTE> printerEnum(pcbNeeded);
+		if (!EnumPrintersW(PRINTER_ENUM_LOCAL, NULL, 2, &printerEnum[0], pcbNeeded, &pcbNeeded, &pcbReturned)) return false;
+
+		//fill the printerInfo
+		PRINTER_INFO_2W* printers = (PRINTER_INFO_2W*)&printerEnum[0];
+		for (unsigned int i = 0; i < pcbReturned; i++)
+		{
+			if (printers[i].pPrinterName && out.deviceName == printers[i].pPrinterName)
+			{
+				if (printers[i].pDriverName) out.driver = printers[i].pDriverName;
+				if (printers[i].pPortName) out.portName = printers[i].pPortName;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	std::string GdiPrinter::name() const
+	{
+		printerInfo dev;
+		if (!getPrimaryPrinter(dev)) return "";
+		return std::string(dev.deviceName.begin(), dev.deviceName.end());
+	}
+
+	// call the printer to print a BGR page
+	bool GdiPrinter::print(const Mat& page, FrameArena& arena)
+	{
+		if (page.empty()) return false;
+
+		printerInfo dev;
+		if (!getPrimaryPrinter(dev)) return false;
+
+		int width = 2700;
+		int height = 4050;
+		Mat to = arena.acquire(height, width, CV_8UC3);
+		resize(page, to, cv::Size(width, height));
+
+		//open printer
+		HDC printer = CreateDCW(dev.driver.c_str(), dev.deviceName.c_str(), dev.portName.c_str(), NULL);
+		if (!printer) return false;
+
+		bool printed = false;
+		HBITMAP hBMP = CreateBitmap(width, height, 1, 24, to.data);
+		HDC hdc = CreateCompatibleDC(printer);
+		if (hBMP && hdc)
+		{
+			HGDIOBJ previous = SelectObject(hdc, hBMP);
+			Escape(printer, STARTDOC, 8, "Happy-Doc", NULL);
+			printed = BitBlt(printer, 0, 0, width, height, hdc, 1, 1, SRCCOPY2) != 0;
+			Escape(printer, NEWFRAME, 0, NULL, NULL);
+			Escape(printer, ENDDOC, 0, NULL, NULL);
+			SelectObject(hdc, previous);
+		}
+
+		//every GDI object of the page goes back, a booth prints for hours
+		if (hdc) DeleteDC(hdc);
+		if (hBMP) DeleteObject(hBMP);
+		DeleteDC(printer);
+		return printed;
+	}
+}
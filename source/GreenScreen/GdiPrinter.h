@@ -0,0 +1,29 @@
+/*
+* GdiPrinter.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "Backends.h"
+
+namespace GreenScreen {
+
+	//the primary printer set up in windows, the page is scaled to 2700 x 4050 and sent through GDI
+	class GdiPrinter : public PrinterBackend
+	{
+	public:
+		std::string name() const;
+		bool print(const cv::Mat& page, FrameArena& arena);
+	};
+}
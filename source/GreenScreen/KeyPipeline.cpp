@@ -0,0 +1,605 @@
+/*
+* KeyPipeline.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "KeyPipeline.h"
+#include "EmbeddedPreview.h"
+#include "PixelKernels.h"
+#include <algorithm>
+#include <cstdio>
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	static int clampChannel(int n, int lower, int upper)
+	{
+		return std::max(lower, std::min(n, upper));
+	}
+
+	Mat chromaMask(const Mat& image, const keySettings& key, FrameArena& arena, int matte)
+	{
+		if (image.empty()) return Mat();
+
+		//the final mask lives as long as the caller keeps the arena, the rest only until the mask is done
+		Mat mask = arena.acquire(image.size(), CV_8UC1);
+		size_t scratch = arena.mark();
+		Mat hsv = arena.acquire(image.size(), CV_8UC3);
+		Mat dilated = arena.acquire(image.size(), CV_8UC1);
+		cvtColor(image, hsv, COLOR_BGR2HSV);
+
+		//take the sample to chroma, the same spot of the live view on a reduced live frame, a burst cell or the print
+		int xCoord = key.xCoordSample;
+		int yCoord = key.yCoordSample;
+		if (key.sampleWidth > 0 && key.sampleHeight > 0)
+		{
+			xCoord = (int)((int64)xCoord * image.cols / key.sampleWidth);
+			yCoord = (int)((int64)yCoord * image.rows / key.sampleHeight);
+		}
+		xCoord = clampChannel(xCoord, 0, image.cols - 1);
+		yCoord = clampChannel(yCoord, 0, image.rows - 1);
+
+		Vec3b sample = hsv.at<Vec3b>(yCoord, xCoord);
+		uchar hue = sample[0];
+		uchar saturation = sample[1];
+		uchar value = sample[2];
+
+		//define min and max threshold for this sample
+		Vec3b rangeMin = Vec3b(clampChannel(hue - key.hueVar, 0, 255), clampChannel(saturation - key.saturationVar, 0, 255), clampChannel(value - key.valueVar, 0, 255));
+		Vec3b rangeMax = Vec3b(clampChannel(hue + key.hueVar, 0, 255), 255, clampChannel(value + key.valueVar, 0, 255));
+
+		//from range get mask in alpha
+		inRange(hsv, rangeMin, rangeMax, mask);
+
+		//dilate 2 pixels and invert mask
+		dilate(mask, dilated, Mat(), cv::Point(-1, -1), 2, 1, 1);
+		if (matte == matteNoBlur)
+		{
+			bitwise_not(dilated, mask);
+		}
+		else
+		{
+			bitwise_not(dilated, dilated);
+
+			//blur mask for better results
+			blur(dilated, mask, cv::Size(3, 3));
+		}
+		arena.rewind(scratch);
+		return mask;
+	}
+
+	void replaceMasked(Mat& image, const Mat& background, const Mat& mask)
+	{
+		if (image.empty() || mask.size() != image.size()) return;
+		if (background.type() != CV_8UC3 || background.rows < image.rows || background.cols < image.cols) return;
+
+		const pixelKernels& kernels = activeKernels();
+		for (int y = 0; y < image.rows; y++)
+		{
+			kernels.replaceMasked(image.ptr<uchar>(y), background.ptr<uchar>(y), mask.ptr<uchar>(y), image.cols);
+		}
+	}
+
+	bool personKey(Mat& image, const Mat& background, PersonSegmenter& segmenter, FrameArena& arena, Mat& matte)
+	{
+		if (image.empty() || !segmenter.infer(image, matte)) return false;
+		size_t start = arena.mark();
+		Mat mask;
+		upsampleMatte(matte, image, mask, arena);
+		replaceMasked(image, background, mask);
+		arena.rewind(start);
+		return true;
+	}
+
+	void chromaKey(Mat& image, const Mat& background, const keySettings& key, FrameArena& arena, int matte)
+	{
+		if (image.empty()) return;
+		if (background.type() != CV_8UC3 || background.rows < image.rows || background.cols < image.cols) return;
+
+		//compute the chroma mask
+		size_t start = arena.mark();
+		Mat mask = chromaMask(image, key, arena, matte);
+		replaceMasked(image, background, mask);
+		arena.rewind(start);
+	}
+
+	void overlayImage(const Mat& background, const Mat& foreground, Mat& output, Point2i location)
+	{
+		//blending in place skips a full frame copy
+		if (output.data != background.data) background.copyTo(output);
+		if (foreground.empty() || foreground.channels() < 4) return;
+		const pixelKernels& kernels = activeKernels();
+		bool isBgra = foreground.channels() == 4 && output.channels() == 3;
+
+		// start at the row indicated by location, or at row 0 if location.y is negative.
+		for (int y = std::max(location.y, 0); y < background.rows; ++y)
+		{
+			int fY = y - location.y; // because of the translation
+
+			// we are done of we have processed all rows of the foreground image.
+			if (fY >= foreground.rows) break;
+
+			const uchar* fgRow = foreground.ptr<uchar>(fY);
+			uchar* outRow = output.ptr<uchar>(y);
+			int fgChannels = foreground.channels();
+			int outChannels = output.channels();
+
+			//the common case, a BGRA frame over a BGR picture, goes through the kernels a row at a time
+			if (isBgra)
+			{
+				int start = std::max(location.x, 0);
+				int end = std::min(background.cols, location.x + foreground.cols);
+				if (end > start) kernels.blendOver(outRow + start * 3, fgRow + (start - location.x) * 4, end - start);
+				continue;
+			}
+
+			// start at the column indicated by location,
+			// or at column 0 if location.x is negative.
+			for (int x = std::max(location.x, 0); x < background.cols; ++x)
+			{
+				int fX = x - location.x; // because of the translation.
+
+				// we are done with this row if the column is outside of the foreground image.
+				if (fX >= foreground.cols) break;
+
+				// determine the opacity of the foregrond pixel, using its fourth (alpha) channel.
+				const uchar* fgPx = fgRow + fX * fgChannels;
+				double opacity = fgPx[3] / 255.;
+
+				// but only if opacity > 0.
+				for (int c = 0; opacity > 0 && c < outChannels; ++c)
+				{
+					uchar* outPx = outRow + x * outChannels + c;
+					*outPx = (uchar)(*outPx * (1. - opacity) + fgPx[c] * opacity);
+				}
+			}
+		}
+	}
+
+	//libjpeg scales by 1/2, 1/4 and 1/8 while decoding, opencv 3.0 does not expose it
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 1)
+	static const bool hasReducedDecode = true;
+#else
+	static const bool hasReducedDecode = false;
+#endif
+
+	//decode a jpeg of a known size at the smallest scale that still has needed pixels
+	static Mat decodeScaled(const unsigned char* jpeg, size_t bytes, cv::Size source, cv::Size needed)
+	{
+		int flags = IMREAD_COLOR;
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 1)
+		if (source.width >= needed.width * 8 && source.height >= needed.height * 8) flags = IMREAD_REDUCED_COLOR_8;
+		else if (source.width >= needed.width * 4 && source.height >= needed.height * 4) flags = IMREAD_REDUCED_COLOR_4;
+		else if (source.width >= needed.width * 2 && source.height >= needed.height * 2) flags = IMREAD_REDUCED_COLOR_2;
+#endif
+		return imdecode(Mat(1, (int)bytes, CV_8UC1, (void*)jpeg), flags);
+	}
+
+	void computeLiveGeometry(cv::Size source, int liveWidth, int liveHeight, bool isWideScreen, liveGeometry& geometry)
+	{
+		geometry.source = source;
+		geometry.live = cv::Size(liveWidth, liveHeight);
+		geometry.isWideScreen = isWideScreen;
+		if (source.area() <= 0 || liveWidth <= 0 || liveHeight <= 0)
+		{
+			geometry.sourceRoi = cv::Rect();
+			geometry.mapXY.release();
+			geometry.mapWeights.release();
+			return;
+		}
+
+		if (isWideScreen)
+		{
+			geometry.sourceRoi = cv::Rect(0, 0, source.width, source.height);
+			geometry.scaleX = liveWidth / (double)source.width;
+			geometry.scaleY = liveHeight / (double)source.height;
+		}
+		else
+		{
+			//fill the live height, then keep the centre columns that fit the live width
+			double scale = liveHeight / (double)source.height;
+			int roiWidth = std::min(source.width, cvRound(liveWidth / scale));
+			geometry.sourceRoi = cv::Rect((source.width - roiWidth) / 2, 0, roiWidth, source.height);
+			geometry.scaleX = liveWidth / (double)roiWidth;
+			geometry.scaleY = scale;
+		}
+
+		//same pixel centre mapping as resize with INTER_LINEAR, relative to the roi
+		Mat mapX(liveHeight, liveWidth, CV_32FC1);
+		Mat mapY(liveHeight, liveWidth, CV_32FC1);
+		for (int y = 0; y < liveHeight; y++)
+		{
+			float* mx = mapX.ptr<float>(y);
+			float* my = mapY.ptr<float>(y);
+			float sy = (float)((y + 0.5) / geometry.scaleY - 0.5);
+			for (int x = 0; x < liveWidth; x++)
+			{
+				mx[x] = (float)((x + 0.5) / geometry.scaleX - 0.5);
+				my[x] = sy;
+			}
+		}
+		convertMaps(mapX, mapY, geometry.mapXY, geometry.mapWeights, CV_16SC2);
+	}
+
+	void applyLiveGeometry(const Mat& frame, const liveGeometry& geometry, Mat& out)
+	{
+		if (geometry.mapXY.empty()) return;
+		remap(frame(geometry.sourceRoi), out, geometry.mapXY, geometry.mapWeights, INTER_LINEAR, BORDER_REPLICATE);
+	}
+
+	liveQuality fullLiveQuality()
+	{
+		liveQuality quality;
+		quality.scale = 1;
+		quality.matte = matteFull;
+		quality.reuseMatte = false;
+		return quality;
+	}
+
+	static float msSince(int64 start)
+	{
+		return (float)((getTickCount() - start) * 1000.0 / getTickFrequency());
+	}
+
+	KeyPipeline::KeyPipeline() : liveDecodedFlags(IMREAD_COLOR), previewSource(""), previewDecodeMs(0),
+		backgroundScaledSource(NULL), plateScaledSource(NULL), liveFrames(0)
+	{
+		geometry.isWideScreen = false;
+	}
+
+	bool KeyPipeline::decodeLive(const unsigned char* jpeg, size_t bytes, int liveWidth, int liveHeight, bool isWideScreen, Mat& roi, bool canReduce)
+	{
+		live.reset();
+		if (!jpeg || bytes == 0 || liveWidth <= 0 || liveHeight <= 0) return false;
+
+		//a half size decode only when it still has a source pixel for every live pixel
+		int flags = IMREAD_COLOR;
+#if CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 1)
+		if (canReduce && liveSourceSize.area() > 0 && liveSourceSize.height / 2 >= liveHeight &&
+			(!isWideScreen || liveSourceSize.width / 2 >= liveWidth))
+		{
+			flags = IMREAD_REDUCED_COLOR_2;
+		}
+#endif
+
+		//pass raw data to opencv, decoding into a block of the previous frame size keeps the picture off the heap,
+		//the decoder still takes its own working buffers from it every frame
+		Mat buffer = Mat(1, (int)bytes, CV_8UC1, (void*)jpeg);
+		Mat decoded = liveDecodedSize.area() > 0 && flags == liveDecodedFlags ? live.acquire(liveDecodedSize, CV_8UC3) : Mat();
+		imdecode(buffer, flags, &decoded);
+		if (decoded.empty()) return false;
+		liveDecodedSize = decoded.size();
+		liveDecodedFlags = flags;
+		if (flags == IMREAD_COLOR) liveSourceSize = decoded.size();
+
+		if (geometry.source != decoded.size() || geometry.live != cv::Size(liveWidth, liveHeight) || geometry.isWideScreen != isWideScreen)
+		{
+			computeLiveGeometry(decoded.size(), liveWidth, liveHeight, isWideScreen, geometry);
+		}
+
+		//only the pixels that end up on screen are resampled, straight into a live sized buffer
+		roi = live.acquire(liveHeight, liveWidth, CV_8UC3);
+		applyLiveGeometry(decoded, geometry, roi);
+		return true;
+	}
+
+	bool KeyPipeline::decodePrint(const unsigned char* encoded, size_t bytes, bool isWideScreen, Mat& roiPrint)
+	{
+		print.reset();
+		if (!encoded || bytes == 0) return false;
+
+		Mat pic;
+		if (isRawPicture(encoded, bytes))
+		{
+			//demosaiced by LibRaw from memory, usually already done by the prefetch while the preview was shown
+			if (!raw.decodeFull(encoded, bytes, pic)) return false;
+		}
+		else
+		{
+			Mat buffer = Mat(1, (int)bytes, CV_8UC1, (void*)encoded);
+			pic = printDecodedSize.area() > 0 ? print.acquire(printDecodedSize, CV_8UC3) : Mat();
+			imdecode(buffer, IMREAD_COLOR, &pic);
+			if (pic.empty()) return false;
+			printDecodedSize = pic.size();
+		}
+
+		if (isWideScreen)
+		{
+			roiPrint = pic;
+		}
+		else
+		{
+			int printWidth = pic.rows;
+			int printHeight = pic.cols;
+			int newWidth = printHeight * (printHeight / (printWidth * 1.00f));
+			Mat scaled = print.acquire(printHeight, newWidth, CV_8UC3);
+			resize(pic, scaled, cv::Size(newWidth, printHeight));
+			roiPrint = scaled(cv::Rect((newWidth - printWidth) *.5f, 0, printWidth, printHeight));
+		}
+		return true;
+	}
+
+	bool KeyPipeline::composePreview(const unsigned char* encoded, size_t bytes, const keySettings& key,
+		const Mat& backgroundLive, const Mat& foregroundLive, int liveWidth, int liveHeight, bool isWideScreen, Mat& out,
+		const LayerStack* layers)
+	{
+		live.reset();
+		previewSource = "";
+		if (!encoded || bytes == 0 || liveWidth <= 0 || liveHeight <= 0) return false;
+
+		//cheapest source that still fills the live view: the preview the camera stored in the file,
+		//then half size RAW or a scaled decode of the jpeg, then the small exif thumbnail, then the whole picture
+		int64 startTick = getTickCount();
+		cv::Size needed(liveWidth, liveHeight);
+		embeddedJpeg embedded;
+		bool hasEmbedded = findEmbeddedPreview(encoded, bytes, liveWidth, liveHeight, embedded);
+		bool isEmbeddedBigEnough = hasEmbedded && embedded.width >= liveWidth && embedded.height >= liveHeight;
+		int pictureWidth = 0, pictureHeight = 0;
+		Mat pic;
+		if (isEmbeddedBigEnough)
+		{
+			pic = decodeScaled(embedded.data, embedded.bytes, cv::Size(embedded.width, embedded.height), needed);
+			previewSource = "embedded preview";
+		}
+		else if (isRawPicture(encoded, bytes))
+		{
+			if (!raw.decodeHalf(encoded, bytes, pic)) return false;
+			previewSource = "half size RAW";
+		}
+		else if (hasReducedDecode && jpegImageSize(encoded, bytes, pictureWidth, pictureHeight))
+		{
+			pic = decodeScaled(encoded, bytes, cv::Size(pictureWidth, pictureHeight), needed);
+			previewSource = "scaled decode";
+		}
+		else if (hasEmbedded)
+		{
+			pic = decodeScaled(embedded.data, embedded.bytes, cv::Size(embedded.width, embedded.height), needed);
+			previewSource = "exif thumbnail";
+		}
+		else
+		{
+			pic = imdecode(Mat(1, (int)bytes, CV_8UC1, (void*)encoded), IMREAD_COLOR);
+			previewSource = "full decode";
+		}
+		if (pic.empty()) return false;
+		previewDecodeMs = (float)((getTickCount() - startTick) * 1000.0 / getTickFrequency());
+
+		//the part the print keeps: all of it when wide, the centre at the live aspect when portrait
+		cv::Rect crop(0, 0, pic.cols, pic.rows);
+		if (!isWideScreen)
+		{
+			int cropWidth = std::min(pic.cols, cvRound(pic.rows * liveWidth / (double)liveHeight));
+			crop = cv::Rect((pic.cols - cropWidth) / 2, 0, cropWidth, pic.rows);
+		}
+		Mat roi = live.acquire(liveHeight, liveWidth, CV_8UC3);
+		resize(pic(crop), roi, roi.size(), 0, 0, INTER_AREA);
+
+		//live settings on a live sized frame, the plate models do not fit a still so this is the colour key
+		//or the person matte of this very picture
+		std::shared_ptr<const compiledLayers> stack = layers && layers->isLoaded() ? layers->at(roi.size()) : std::shared_ptr<const compiledLayers>();
+		const Mat& background = stack ? stack->backdrop : backgroundLive;
+		if (!(key.mode == keyModePerson && personKey(roi, background, segmenter, live, liveMatte)))
+		{
+			chromaKey(roi, background, key, live);
+		}
+		if (stack) blendLayers(roi, *stack);
+		else overlayImage(roi, foregroundLive, roi, Point2i(0, 0));
+		out = roi;
+		return true;
+	}
+
+	//the live plate resized to a reduced live size, the plate learnt at the full size otherwise
+	const plateModel& KeyPipeline::livePlate(cv::Size size)
+	{
+		const plateModel& model = plate.live();
+		if (!model.isReady() || model.mean.size() == size) return model;
+		if (plateScaled.mean.size() != size || plateScaledSource != model.mean.data)
+		{
+			resize(model.mean, plateScaled.mean, size, 0, 0, INTER_AREA);
+			if (model.invVariance.empty()) plateScaled.invVariance.release();
+			else resize(model.invVariance, plateScaled.invVariance, size, 0, 0, INTER_AREA);
+			plateScaled.uniformInvVariance = model.uniformInvVariance;
+			plateScaled.frames = model.frames;
+			plateScaledSource = model.mean.data;
+		}
+		return plateScaled;
+	}
+
+	void KeyPipeline::keyFrame(Mat& image, const Mat& background, const keySettings& key, FrameArena& arena, bool isLive, int matte)
+	{
+		const plateModel& model = isLive ? livePlate(image.size()) : plate.print();
+		if (key.mode == keyModeCleanPlate && model.isReady() && model.mean.size() == image.size())
+		{
+			differenceKey(image, background, model, key.plateThreshold, arena);
+		}
+		else if (key.mode == keyModePerson && !isLive && personKey(image, background, segmenter, arena, printMatte))
+		{
+			//the print waits for its own inference, the live view never does
+		}
+		else
+		{
+			chromaKey(image, background, key, arena, matte);
+		}
+	}
+
+	bool KeyPipeline::composeLive(const unsigned char* jpeg, size_t bytes, const keySettings& key,
+		const Mat& backgroundLive, const Mat& foregroundLive,
+		int liveWidth, int liveHeight, bool isWideScreen, Mat& out,
+		const liveQuality* quality, liveTimings* timings, const LayerStack* layers)
+	{
+		liveQuality q = quality ? *quality : fullLiveQuality();
+		int64 tick = getTickCount();
+
+		//key a smaller frame, the geometry scales straight from the EVF frame to it
+		int width = liveWidth;
+		int height = liveHeight;
+		if (q.scale > 0 && q.scale < 1)
+		{
+			width = std::max(16, cvRound(liveWidth * q.scale));
+			height = std::max(16, cvRound(liveHeight * q.scale));
+		}
+		bool isScaled = width != liveWidth || height != liveHeight;
+
+		Mat roi;
+		if (!decodeLive(jpeg, bytes, width, height, isWideScreen, roi, isScaled)) return false;
+
+		//the network starts on this frame now and runs while the next ones are downloaded and decoded
+		bool isPersonKey = key.mode == keyModePerson && segmenter.isLoaded();
+		if (isPersonKey) segmenter.submit(roi);
+		if (timings) timings->decodeMs = msSince(tick);
+		tick = getTickCount();
+
+		//a layer stack is compiled at the keyed size for the backdrop and at the live size for the overlay,
+		//otherwise the background at the reduced size is resized once per theme and quality
+		std::shared_ptr<const compiledLayers> keyedLayers, liveLayers;
+		if (layers && layers->isLoaded())
+		{
+			keyedLayers = layers->at(roi.size());
+			liveLayers = isScaled ? layers->at(cv::Size(liveWidth, liveHeight)) : keyedLayers;
+		}
+		const Mat* background = keyedLayers ? &keyedLayers->backdrop : &backgroundLive;
+		if (!keyedLayers && isScaled && !backgroundLive.empty())
+		{
+			if (backgroundScaled.size() != roi.size() || backgroundScaledSource != backgroundLive.data)
+			{
+				resize(backgroundLive(cv::Rect(0, 0, std::min(liveWidth, backgroundLive.cols), std::min(liveHeight, backgroundLive.rows))),
+					backgroundScaled, roi.size(), 0, 0, INTER_AREA);
+				backgroundScaledSource = backgroundLive.data;
+			}
+			background = &backgroundScaled;
+		}
+
+		// compute the key, chroma at the sample x,y, against the clean plate or with the newest person matte
+		bool isColourKey = !(key.mode == keyModeCleanPlate && livePlate(roi.size()).mean.size() == roi.size());
+		if (isPersonKey && segmenter.latestMatte(liveMatte))
+		{
+			//the matte is a frame or two old, the guided upsampling snaps its edge to this frame
+			size_t start = live.mark();
+			Mat mask;
+			upsampleMatte(liveMatte, roi, mask, live);
+			replaceMasked(roi, *background, mask);
+			live.rewind(start);
+		}
+		else if (q.reuseMatte && isColourKey)
+		{
+			//odd frames key with the mask of the frame before, the subject moves little in 1/30 s
+			if (liveFrames % 2 == 0 || reusedMatte.size() != roi.size())
+			{
+				size_t start = live.mark();
+				Mat mask = chromaMask(roi, key, live, q.matte);
+				mask.copyTo(reusedMatte);
+				live.rewind(start);
+			}
+			replaceMasked(roi, *background, reusedMatte);
+		}
+		else
+		{
+			keyFrame(roi, *background, key, live, true, q.matte);
+		}
+		liveFrames++;
+		if (timings) timings->keyMs = msSince(tick);
+		tick = getTickCount();
+
+		//back to the live size before the foreground, so frames and text stay sharp
+		if (isScaled)
+		{
+			Mat full = live.acquire(liveHeight, liveWidth, CV_8UC3);
+			resize(roi, full, full.size(), 0, 0, INTER_LINEAR);
+			roi = full;
+		}
+
+		//add foreground in place, every layer over the subject in one pass over the tiles they cover
+		if (liveLayers) blendLayers(roi, *liveLayers);
+		else overlayImage(roi, foregroundLive, roi, Point2i(0, 0));
+		out = roi;
+		if (timings) timings->composeMs = msSince(tick);
+		return true;
+	}
+
+	void KeyPipeline::learnLivePlate(const unsigned char* jpeg, size_t bytes, int liveWidth, int liveHeight, bool isWideScreen)
+	{
+		Mat roi;
+		if (decodeLive(jpeg, bytes, liveWidth, liveHeight, isWideScreen, roi)) plate.addLiveFrame(roi);
+	}
+
+	bool KeyPipeline::learnPrintPlate(const unsigned char* encoded, size_t bytes, bool isWideScreen)
+	{
+		Mat roiPrint;
+		if (!decodePrint(encoded, bytes, isWideScreen, roiPrint)) return false;
+		return plate.setPrintStill(roiPrint);
+	}
+
+	bool KeyPipeline::composePrintFile(const std::string& path, const keySettings& key,
+		Mat& background, Mat& foreground, bool isWideScreen, Mat& out, const LayerStack* layers)
+	{
+		FILE* f = fopen(path.c_str(), "rb");
+		if (!f) return false;
+		fseek(f, 0, SEEK_END);
+		long length = ftell(f);
+		fseek(f, 0, SEEK_SET);
+		if (length <= 0)
+		{
+			fclose(f);
+			return false;
+		}
+		if (fileBuffer.size() < (size_t)length) fileBuffer.resize(length);
+		size_t got = fread(&fileBuffer[0], 1, length, f);
+		fclose(f);
+		if (got != (size_t)length) return false;
+		return composePrint(&fileBuffer[0], got, key, background, foreground, isWideScreen, out, layers);
+	}
+
+	bool KeyPipeline::composePrint(const unsigned char* encoded, size_t bytes, const keySettings& key,
+		Mat& background, Mat& foreground, bool isWideScreen, Mat& out, const LayerStack* layers)
+	{
+		Mat roiPrint;
+		if (!decodePrint(encoded, bytes, isWideScreen, roiPrint)) return false;
+
+		if (layers && layers->isLoaded())
+		{
+			//the stack is compiled once per print size and date, then it is the key and one overlay pass
+			std::shared_ptr<const compiledLayers> stack = layers->at(roiPrint.size());
+			keyFrame(roiPrint, stack->backdrop, key, print, false);
+			blendLayers(roiPrint, *stack);
+		}
+		else
+		{
+			int printWidth = roiPrint.cols;
+			int printHeight = roiPrint.rows;
+			resize(background, background, cv::Size(printWidth, printHeight));
+			resize(foreground, foreground, cv::Size(printWidth, printHeight));
+
+			//compute the key
+			keyFrame(roiPrint, background, key, print, false);
+
+			//add foreground in place
+			overlayImage(roiPrint, foreground, roiPrint, Point2i(0, 0));
+		}
+
+		//rotate image if wide, a transpose and a flip is an exact 90 degree turn
+		if (isWideScreen)
+		{
+			Mat rotated = print.acquire(roiPrint.cols, roiPrint.rows, CV_8UC3);
+			transpose(roiPrint, rotated);
+			flip(rotated, rotated, 0);
+			out = rotated;
+		}
+		else
+		{
+			out = roiPrint;
+		}
+		return true;
+	}
+}
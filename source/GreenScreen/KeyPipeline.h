@@ -0,0 +1,191 @@
+/*
+* KeyPipeline.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "CleanPlate.h"
+#include "FrameArena.h"
+#include "LayerStack.h"
+#include "PersonSegmenter.h"
+#include "RawDecoder.h"
+#include <string>
+#include <vector>
+
+namespace GreenScreen {
+
+	enum keyMode
+	{
+		keyModeColor = 0,		//threshold around one sampled HSV colour
+		keyModeCleanPlate = 1,	//distance to the empty set, falls back to the colour key without a plate
+		keyModePerson = 2		//segmentation network, any backdrop, falls back to the colour key without a model
+	};
+
+	//the chroma key parameters picked in the form
+	struct keySettings
+	{
+		int xCoordSample;
+		int yCoordSample;
+		int hueVar;
+		int saturationVar;
+		int valueVar;
+		int mode;
+		float plateThreshold;	//standard deviations from the empty set
+		int sampleWidth;		//size of the live view the sample was picked on, the sample is scaled to
+		int sampleHeight;		//every image keyed, 0 when the sample is in pixels of the keyed image
+	};
+
+	enum matteQuality
+	{
+		matteFull = 0,		//dilate and blur the mask
+		matteNoBlur = 1		//dilate only, a hard edge for a cheaper key
+	};
+
+	//compute a chroma key: sample the key colour at the sample coords and replace it with the background
+	//default = alive process for fast solutions, temporaries come from the arena
+	void chromaKey(cv::Mat& image, const cv::Mat& background, const keySettings& key, FrameArena& arena, int matte = matteFull);
+
+	//the colour key mask alone, 255 keeps the pixel, empty when the image cannot be keyed
+	//the mask is allocated from arena and lives until the arena is rewound past it
+	cv::Mat chromaMask(const cv::Mat& image, const keySettings& key, FrameArena& arena, int matte = matteFull);
+	//replace image with background wherever mask is below 255, a hard replace: the soft edge of the mask only widens the replaced area
+	void replaceMasked(cv::Mat& image, const cv::Mat& background, const cv::Mat& mask);
+
+	//key image with a person matte inferred from it, matte keeps the model sized matte between calls
+	//false without a model or when the network failed, image is untouched then
+	bool personKey(cv::Mat& image, const cv::Mat& background, PersonSegmenter& segmenter, FrameArena& arena, cv::Mat& matte);
+
+	//blend a BGRA foreground over background into output, output may be background itself
+	void overlayImage(const cv::Mat& background, const cv::Mat& foreground, cv::Mat& output, cv::Point2i location);
+
+	//where the live frame comes from in the decoded EVF frame and how it is scaled
+	//computed once per stream size and theme, every live frame reuses it
+	struct liveGeometry
+	{
+		cv::Size source;		//decoded EVF frame
+		cv::Size live;			//live view size
+		bool isWideScreen;
+		cv::Rect sourceRoi;		//part of the EVF frame that ends up on screen, the crop happens before any resample
+		double scaleX;			//live pixels per source pixel
+		double scaleY;
+		cv::Mat mapXY;			//fixed point remap tables from live pixel to source pixel
+		cv::Mat mapWeights;
+	};
+
+	//fill geometry for a source frame and a live size, wide stretches the whole frame,
+	//portrait fills the live height with a uniform scale and keeps the centre
+	void computeLiveGeometry(cv::Size source, int liveWidth, int liveHeight, bool isWideScreen, liveGeometry& geometry);
+
+	//resample the source roi of frame to the live size into out, out must be live sized
+	void applyLiveGeometry(const cv::Mat& frame, const liveGeometry& geometry, cv::Mat& out);
+
+	//how much work a live frame gets, lowered by the frame governor when the live view falls behind
+	struct liveQuality
+	{
+		float scale;		//processing size as a fraction of the live size, the keyed frame is scaled back up
+		int matte;			//matteQuality of the colour key
+		bool reuseMatte;	//the colour key mask is computed every second frame and reused in between
+	};
+
+	//full size, full matte, a fresh mask every frame
+	liveQuality fullLiveQuality();
+
+	//what the stages of the last live frame cost
+	struct liveTimings
+	{
+		float decodeMs;		//jpeg decode and live geometry
+		float keyMs;
+		float composeMs;	//scale back to the live size and the foreground
+	};
+
+	//live and print composition, every scratch buffer comes from an arena owned by the pipeline
+	class KeyPipeline
+	{
+	public:
+		KeyPipeline();
+
+		//decode one live view jpeg, fit it to the live size, key it and add the foreground
+		//a lower quality keys a smaller frame, the decode shrinks with it when libjpeg can decode at half size
+		//out is always live sized, points to arena memory and is valid until the next composeLive
+		//a theme with layers composes its stack instead of backgroundLive and foregroundLive
+		bool composeLive(const unsigned char* jpeg, size_t bytes, const keySettings& key,
+			const cv::Mat& backgroundLive, const cv::Mat& foregroundLive,
+			int liveWidth, int liveHeight, bool isWideScreen, cv::Mat& out,
+			const liveQuality* quality = NULL, liveTimings* timings = NULL, const LayerStack* layers = NULL);
+
+		//decode a camera picture and compose it at print size, rotated to portrait when wide
+		//background and foreground are resized to the print size in place, they are not used when layers are given
+		//out points to arena memory and is valid until the next print
+		bool composePrint(const unsigned char* encoded, size_t bytes, const keySettings& key,
+			cv::Mat& background, cv::Mat& foreground, bool isWideScreen, cv::Mat& out, const LayerStack* layers = NULL);
+		bool composePrintFile(const std::string& path, const keySettings& key,
+			cv::Mat& background, cv::Mat& foreground, bool isWideScreen, cv::Mat& out, const LayerStack* layers = NULL);
+
+		//RAW pictures: start the full decode for composePrint on a worker, false for jpeg or without LibRaw
+		bool prefetchPrint(const unsigned char* encoded, size_t bytes) { return raw.prefetch(encoded, bytes); }
+		//a quick look at a camera picture at live size, from the preview stored in the file when it is big enough,
+		//cropped like the print and keyed with the live settings
+		//out points to live arena memory and is valid until the next live frame
+		bool composePreview(const unsigned char* encoded, size_t bytes, const keySettings& key,
+			const cv::Mat& backgroundLive, const cv::Mat& foregroundLive,
+			int liveWidth, int liveHeight, bool isWideScreen, cv::Mat& out, const LayerStack* layers = NULL);
+		//where the last preview came from and what its decode cost, for the log
+		const char* lastPreviewSource() const { return previewSource; }
+		float lastPreviewDecodeMs() const { return previewDecodeMs; }
+
+		//clean plate: live frames and one still of the empty set, in the same geometry the key sees
+		void learnLivePlate(const unsigned char* jpeg, size_t bytes, int liveWidth, int liveHeight, bool isWideScreen);
+		bool learnPrintPlate(const unsigned char* encoded, size_t bytes, bool isWideScreen);
+		CleanPlate& cleanPlate() { return plate; }
+
+		//person key: the live frames are inferred on the segmenter thread, stills on the calling thread
+		PersonSegmenter& personSegmenter() { return segmenter; }
+
+		FrameArena& liveArena() { return live; }
+		const liveGeometry& currentLiveGeometry() const { return geometry; }
+		FrameArena& printArena() { return print; }
+		const RawDecoder& rawDecoder() const { return raw; }
+
+	private:
+		bool decodeLive(const unsigned char* jpeg, size_t bytes, int liveWidth, int liveHeight, bool isWideScreen, cv::Mat& roi, bool canReduce = false);
+		bool decodePrint(const unsigned char* encoded, size_t bytes, bool isWideScreen, cv::Mat& roiPrint);
+		void keyFrame(cv::Mat& image, const cv::Mat& background, const keySettings& key, FrameArena& arena, bool isLive, int matte = matteFull);
+		const plateModel& livePlate(cv::Size size);
+
+		FrameArena live;
+		FrameArena print;
+		std::vector<unsigned char> fileBuffer;	//grows to the largest picture once
+		cv::Size liveDecodedSize;				//decode straight into a block of the last frame size
+		int liveDecodedFlags;
+		cv::Size liveSourceSize;				//EVF frame at full decode
+		cv::Size printDecodedSize;
+		liveGeometry geometry;					//rebuilt only when the stream size or theme changes
+		CleanPlate plate;
+		RawDecoder raw;							//LibRaw state for the preview and the print decode
+		PersonSegmenter segmenter;
+		cv::Mat liveMatte;						//model sized person mattes, live and print keep their own
+		cv::Mat printMatte;
+		const char* previewSource;
+		float previewDecodeMs;
+
+		//background and plate at the reduced live size, rebuilt when the quality or the theme changes
+		cv::Mat backgroundScaled;
+		const uchar* backgroundScaledSource;
+		plateModel plateScaled;
+		const uchar* plateScaledSource;
+		cv::Mat reusedMatte;					//colour key mask kept for the next frame
+		unsigned int liveFrames;
+	};
+}
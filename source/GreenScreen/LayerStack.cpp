@@ -0,0 +1,500 @@
+/*
+* LayerStack.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "LayerStack.h"
+#include "PixelKernels.h"
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	//the compiled sizes kept per theme: live, one reduced live size, print and the burst cell
+	static const size_t compiledCapacity = 4;
+	//the overlay is tracked in tiles of this many pixels a side
+	static const int layerTile = 32;
+
+	static float msSince(int64 start)
+	{
+		return (float)((getTickCount() - start) * 1000.0 / getTickFrequency());
+	}
+
+	static layerSpec makeLayer(int kind)
+	{
+		layerSpec layer;
+		layer.kind = kind;
+		layer.x = 0;
+		layer.y = 0;
+		layer.width = 0;
+		layer.height = 0;
+		layer.opacity = 1;
+		layer.colour = Scalar(255, 255, 255);
+		return layer;
+	}
+
+	std::vector<layerSpec> defaultLayerStack()
+	{
+		std::vector<layerSpec> layers;
+		layers.push_back(makeLayer(layerBackground));
+		layers.push_back(makeLayer(layerSubject));
+		layers.push_back(makeLayer(layerForeground));
+		return layers;
+	}
+
+	static bool parseColour(const std::string& hex, Scalar& colour)
+	{
+		if (hex.size() != 6) return false;
+		char* end = NULL;
+		long value = strtol(hex.c_str(), &end, 16);
+		if (*end != 0) return false;
+		colour = Scalar(value & 255, (value >> 8) & 255, (value >> 16) & 255);
+		return true;
+	}
+
+	bool readLayerFile(const std::string& path, std::vector<layerSpec>& layers, std::string* error)
+	{
+		std::ifstream file(path.c_str());
+		if (!file)
+		{
+			if (error) *error = "cannot open " + path;
+			return false;
+		}
+
+		std::vector<layerSpec> read;
+		int subjects = 0;
+		int number = 0;
+		std::string line;
+		while (std::getline(file, line))
+		{
+			number++;
+			if (!line.empty() && line[line.size() - 1] == '\r') line.erase(line.size() - 1);
+			size_t first = line.find_first_not_of(" \t");
+			if (first == std::string::npos || line[first] == '#') continue;
+
+			std::istringstream fields(line);
+			std::string kind;
+			fields >> kind;
+			layerSpec layer = makeLayer(layerImage);
+			float opacity = 1;
+			bool ok = true;
+			if (kind == "background" || kind == "foreground")
+			{
+				layer.kind = kind == "background" ? layerBackground : layerForeground;
+				//the box is optional, the whole frame without it
+				if (fields >> layer.x)
+				{
+					ok = !!(fields >> layer.y >> layer.width >> layer.height);
+					if (ok && fields >> opacity) layer.opacity = opacity;
+				}
+			}
+			else if (kind == "subject")
+			{
+				layer.kind = layerSubject;
+				subjects++;
+			}
+			else if (kind == "image")
+			{
+				ok = !!(fields >> layer.path >> layer.x >> layer.y >> layer.width >> layer.height);
+				if (ok && fields >> opacity) layer.opacity = opacity;
+			}
+			else if (kind == "text")
+			{
+				layer.kind = layerText;
+				std::string hex;
+				ok = (fields >> layer.x >> layer.y >> layer.height >> hex) && parseColour(hex, layer.colour);
+				std::getline(fields, layer.text);
+				size_t start = layer.text.find_first_not_of(" \t");
+				layer.text = start == std::string::npos ? std::string() : layer.text.substr(start);
+				ok = ok && !layer.text.empty() && layer.height > 0;
+			}
+			else
+			{
+				ok = false;
+			}
+
+			if (!ok)
+			{
+				if (error) *error = path + " line " + std::to_string(number) + " not understood: " + line;
+				return false;
+			}
+			layer.opacity = std::max(0.0f, std::min(layer.opacity, 1.0f));
+			read.push_back(layer);
+		}
+
+		if (subjects != 1)
+		{
+			if (error) *error = path + " needs exactly one subject line";
+			return false;
+		}
+		layers.swap(read);
+		return true;
+	}
+
+	static std::string today()
+	{
+		time_t now = time(NULL);
+		struct tm local;
+#ifdef _WIN32
+		localtime_s(&local, &now);
+#else
+		localtime_r(&now, &local);
+#endif
+		char text[32];
+		strftime(text, sizeof(text), "%d/%m/%Y", &local);
+		return text;
+	}
+
+	static std::string expandText(const std::string& text, const std::string& date)
+	{
+		std::string out = text;
+		for (size_t at = out.find("{date}"); at != std::string::npos; at = out.find("{date}", at + date.size()))
+		{
+			out.replace(at, 6, date);
+		}
+		return out;
+	}
+
+	//the box of a picture layer in frame pixels, may reach outside the frame
+	static Rect layerBox(const layerSpec& layer, Size size, Size source)
+	{
+		int x = cvRound(layer.x * size.width);
+		int y = cvRound(layer.y * size.height);
+		int width = layer.width > 0 ? cvRound(layer.width * size.width) : size.width - x;
+		int height = size.height - y;
+		if (layer.height > 0) height = cvRound(layer.height * size.height);
+		else if (layer.width > 0 && source.width > 0) height = cvRound(width * source.height / (double)source.width);
+		return Rect(x, y, width, height);
+	}
+
+	static void scaleAlpha(Mat& bgra, float opacity)
+	{
+		if (opacity >= 1) return;
+		for (int y = 0; y < bgra.rows; y++)
+		{
+			uchar* row = bgra.ptr<uchar>(y);
+			for (int x = 0; x < bgra.cols; x++) row[x * 4 + 3] = (uchar)cvRound(row[x * 4 + 3] * opacity);
+		}
+	}
+
+	//one line of antialiased text as a BGRA patch, the letters are the alpha so the colour stays clean on the edge
+	static Mat textPatch(const layerSpec& layer, Size size, const std::string& date, Point& origin)
+	{
+		std::string text = expandText(layer.text, date);
+		const int font = FONT_HERSHEY_SIMPLEX;
+		int baseline = 0;
+		Size unit = getTextSize(text, font, 1.0, 2, &baseline);
+		double scale = layer.height * size.height / std::max(1, unit.height);
+		if (layer.width > 0 && unit.width * scale > layer.width * size.width) scale = layer.width * size.width / std::max(1, unit.width);
+		int thickness = std::max(1, cvRound(scale * 2));
+		Size textSize = getTextSize(text, font, scale, thickness, &baseline);
+
+		Mat coverage = Mat::zeros(textSize.height + baseline + thickness, textSize.width + thickness, CV_8UC1);
+		putText(coverage, text, Point(thickness / 2, textSize.height + thickness / 2), font, scale, Scalar(255), thickness, LINE_AA);
+
+		Mat patch(coverage.size(), CV_8UC4);
+		Vec4b colour((uchar)layer.colour[0], (uchar)layer.colour[1], (uchar)layer.colour[2], 0);
+		for (int y = 0; y < patch.rows; y++)
+		{
+			const uchar* a = coverage.ptr<uchar>(y);
+			Vec4b* out = patch.ptr<Vec4b>(y);
+			for (int x = 0; x < patch.cols; x++)
+			{
+				out[x] = colour;
+				out[x][3] = (uchar)cvRound(a[x] * layer.opacity);
+			}
+		}
+		origin = Point(cvRound(layer.x * size.width), cvRound(layer.y * size.height));
+		return patch;
+	}
+
+	//the part of a layer inside the frame at size, BGR when it is opaque, BGRA otherwise, false when nothing shows
+	static bool layerPatch(const layerSpec& layer, const Mat& source, Size size, const std::string& date, Mat& patch, Rect& visible)
+	{
+		Mat full;
+		Rect box;
+		if (layer.kind == layerText)
+		{
+			Point origin;
+			full = textPatch(layer, size, date, origin);
+			box = Rect(origin, full.size());
+		}
+		else
+		{
+			if (source.empty()) return false;
+			box = layerBox(layer, size, source.size());
+			if (box.width <= 0 || box.height <= 0) return false;
+			//linear like the theme was always resized, so the default stack gives the same pixels as before
+			resize(source, full, box.size());
+		}
+
+		visible = box & Rect(0, 0, size.width, size.height);
+		if (visible.area() <= 0) return false;
+		patch = full(visible - box.tl());
+
+		if (patch.channels() == 1) cvtColor(patch, patch, COLOR_GRAY2BGR);
+		if (patch.channels() == 3 && layer.opacity < 1) cvtColor(patch, patch, COLOR_BGR2BGRA);
+		if (patch.channels() == 4 && layer.kind != layerText) scaleAlpha(patch, layer.opacity);
+		return true;
+	}
+
+	//src over dst, both BGRA with straight alpha, the flattened pixel blends like the two did one after the other
+	static void flattenOver(Mat& dst, const Mat& src)
+	{
+		for (int y = 0; y < dst.rows; y++)
+		{
+			uchar* d = dst.ptr<uchar>(y);
+			const uchar* s = src.ptr<uchar>(y);
+			for (int x = 0; x < dst.cols; x++, d += 4, s += 4)
+			{
+				int sa = s[3];
+				if (sa == 0) continue;
+				if (sa == 255)
+				{
+					d[0] = s[0]; d[1] = s[1]; d[2] = s[2]; d[3] = 255;
+					continue;
+				}
+				int da = d[3] * (255 - sa);
+				int oa = sa * 255 + da;
+				for (int c = 0; c < 3; c++) d[c] = (uchar)((s[c] * sa * 255 + d[c] * da + oa / 2) / oa);
+				d[3] = (uchar)((oa + 127) / 255);
+			}
+		}
+	}
+
+	static bool hasAlpha(const Mat& bgra, Rect cell)
+	{
+		for (int y = cell.y; y < cell.y + cell.height; y++)
+		{
+			const uchar* row = bgra.ptr<uchar>(y) + cell.x * 4 + 3;
+			for (int x = 0; x < cell.width; x++)
+			{
+				if (row[x * 4] != 0) return true;
+			}
+		}
+		return false;
+	}
+
+	//runs of tiles with any overlay alpha, band by band, tiles outside every layer box are not even looked at
+	static void buildRuns(compiledLayers& out, const std::vector<Rect>& boxes)
+	{
+		Size size = out.size;
+		double covered = 0;
+		for (int y0 = 0; y0 < size.height; y0 += out.tile)
+		{
+			int rows = std::min(out.tile, size.height - y0);
+			int runStart = -1;
+			for (int x0 = 0; x0 < size.width + out.tile; x0 += out.tile)
+			{
+				bool isCovered = false;
+				if (x0 < size.width)
+				{
+					Rect cell(x0, y0, std::min(out.tile, size.width - x0), rows);
+					for (size_t i = 0; i < boxes.size() && !isCovered; i++)
+					{
+						isCovered = (cell & boxes[i]).area() > 0 && hasAlpha(out.overlay, cell & boxes[i]);
+					}
+				}
+				if (isCovered && runStart < 0) runStart = x0;
+				if (!isCovered && runStart >= 0)
+				{
+					Rect run(runStart, y0, std::min(x0, size.width) - runStart, rows);
+					out.runs.push_back(run);
+					covered += run.area();
+					runStart = -1;
+				}
+			}
+		}
+		out.coverage = size.area() > 0 ? (float)(covered / size.area()) : 0;
+	}
+
+	struct LayerStack::impl
+	{
+		std::vector<layerSpec> layers;
+		std::vector<Mat> sources;		//picture of every background, foreground and image layer, at the size it was read
+		bool hasDate;
+		std::mutex cacheLock;
+		std::vector<std::shared_ptr<const compiledLayers> > compiled;	//most recently used first
+
+		impl() : hasDate(false) {}
+
+		void compile(Size size, const std::string& date, compiledLayers& out) const
+		{
+			int64 tick = getTickCount();
+			out.size = size;
+			out.date = date;
+			out.tile = layerTile;
+			out.overlayLayers = 0;
+			out.backdrop.create(size, CV_8UC3);
+			out.backdrop.setTo(Scalar::all(0));
+			out.overlay.create(size, CV_8UC4);
+			out.overlay.setTo(Scalar::all(0));
+
+			const pixelKernels& kernels = activeKernels();
+			std::vector<Rect> boxes;
+			bool isOverSubject = false;
+			for (size_t i = 0; i < layers.size(); i++)
+			{
+				if (layers[i].kind == layerSubject)
+				{
+					isOverSubject = true;
+					continue;
+				}
+				Mat patch;
+				Rect box;
+				if (!layerPatch(layers[i], sources[i], size, date, patch, box)) continue;
+
+				if (!isOverSubject)
+				{
+					//under the subject everything is baked into the backdrop once, the key never sees the layers
+					Mat target = out.backdrop(box);
+					if (patch.channels() == 3) patch.copyTo(target);
+					else for (int y = 0; y < box.height; y++) kernels.blendOver(target.ptr<uchar>(y), patch.ptr<uchar>(y), box.width);
+				}
+				else
+				{
+					if (patch.channels() == 3) cvtColor(patch, patch, COLOR_BGR2BGRA);
+					Mat target = out.overlay(box);
+					//the first layer over the subject lands on an empty overlay
+					if (boxes.empty()) patch.copyTo(target);
+					else flattenOver(target, patch);
+					boxes.push_back(box);
+					out.overlayLayers++;
+				}
+			}
+			buildRuns(out, boxes);
+			out.compileMs = msSince(tick);
+		}
+	};
+
+	LayerStack::LayerStack()
+	{
+	}
+
+	bool LayerStack::load(const std::vector<layerSpec>& layers, const std::string& folder,
+		const Mat& background, const Mat& foreground, std::string* log)
+	{
+		std::shared_ptr<impl> theme = std::make_shared<impl>();
+		theme->layers = layers;
+		std::string messages;
+		for (size_t i = 0; i < layers.size(); i++)
+		{
+			Mat source;
+			if (layers[i].kind == layerBackground) source = background;
+			else if (layers[i].kind == layerForeground) source = foreground;
+			else if (layers[i].kind == layerImage)
+			{
+				bool isAbsolute = !layers[i].path.empty() && (layers[i].path[0] == '/' || layers[i].path[0] == '\\' || layers[i].path.find(':') != std::string::npos);
+				std::string path = folder.empty() || isAbsolute ? layers[i].path : folder + "/" + layers[i].path;
+				source = imread(path, IMREAD_UNCHANGED);
+				//a missing logo leaves its layer out, the rest of the theme still prints
+				if (source.empty()) messages += "layer picture not found, left out: " + path + "\n";
+				else if (source.depth() != CV_8U) source.convertTo(source, CV_8U, source.depth() == CV_16U ? 1 / 257.0 : 1.0);
+			}
+			else if (layers[i].kind == layerText && layers[i].text.find("{date}") != std::string::npos)
+			{
+				theme->hasDate = true;
+			}
+			theme->sources.push_back(source);
+		}
+		if (log) *log = messages;
+		d = theme;
+		return true;
+	}
+
+	void LayerStack::clear()
+	{
+		d.reset();
+	}
+
+	bool LayerStack::isLoaded() const
+	{
+		return d.get() != NULL;
+	}
+
+	int LayerStack::layers() const
+	{
+		return d ? (int)d->layers.size() : 0;
+	}
+
+	std::shared_ptr<const compiledLayers> LayerStack::at(Size size) const
+	{
+		if (!d || size.width <= 0 || size.height <= 0) return std::shared_ptr<const compiledLayers>();
+		std::string date = d->hasDate ? today() : std::string();
+		{
+			std::lock_guard<std::mutex> lock(d->cacheLock);
+			for (size_t i = 0; i < d->compiled.size(); i++)
+			{
+				if (d->compiled[i]->size == size && d->compiled[i]->date == date)
+				{
+					std::shared_ptr<const compiledLayers> hit = d->compiled[i];
+					d->compiled.erase(d->compiled.begin() + i);
+					d->compiled.insert(d->compiled.begin(), hit);
+					return hit;
+				}
+			}
+		}
+
+		//compiled outside the lock, a print sized compile must not hold up the live frames
+		std::shared_ptr<compiledLayers> built = std::make_shared<compiledLayers>();
+		d->compile(size, date, *built);
+
+		std::lock_guard<std::mutex> lock(d->cacheLock);
+		for (size_t i = 0; i < d->compiled.size(); i++)
+		{
+			//another thread got there first
+			if (d->compiled[i]->size == size && d->compiled[i]->date == date) return d->compiled[i];
+		}
+		d->compiled.insert(d->compiled.begin(), built);
+		if (d->compiled.size() > compiledCapacity) d->compiled.pop_back();
+		return built;
+	}
+
+	std::string LayerStack::describe() const
+	{
+		if (!d) return "no layers";
+		static const char* names[] = { "background", "foreground", "subject", "image", "text" };
+		std::string text = std::to_string(d->layers.size()) + " layers:";
+		for (size_t i = 0; i < d->layers.size(); i++)
+		{
+			const layerSpec& layer = d->layers[i];
+			text += i == 0 ? " " : ", ";
+			text += layer.kind >= 0 && layer.kind <= layerText ? names[layer.kind] : "?";
+			if (layer.kind == layerImage) text += " " + layer.path;
+			if (layer.kind == layerText) text += " \"" + layer.text + "\"";
+		}
+		return text;
+	}
+
+	void blendLayers(Mat& image, const compiledLayers& layers)
+	{
+		if (image.size() != layers.size || image.type() != CV_8UC3 || layers.overlay.empty()) return;
+		const pixelKernels& kernels = activeKernels();
+		//every layer over the subject is in the one overlay, so each covered pixel is read and written once
+		for (size_t i = 0; i < layers.runs.size(); i++)
+		{
+			const Rect& run = layers.runs[i];
+			for (int y = run.y; y < run.y + run.height; y++)
+			{
+				kernels.blendOver(image.ptr<uchar>(y) + run.x * 3, layers.overlay.ptr<uchar>(y) + run.x * 4, run.width);
+			}
+		}
+	}
+}
@@ -0,0 +1,104 @@
+/*
+* LayerStack.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include <memory>
+#include <string>
+#include <vector>
+
+// included from the /clr form: the compile cache and its lock are hidden in LayerStack.cpp
+
+namespace GreenScreen {
+
+	enum layerKind
+	{
+		layerBackground = 0,	//the theme background
+		layerForeground = 1,	//the theme foreground png
+		layerSubject = 2,		//the keyed camera picture, exactly once
+		layerImage = 3,			//any picture file, png alpha is kept
+		layerText = 4			//one line of text, {date} is today
+	};
+
+	//one layer of a theme, positions and sizes are fractions of the composed frame
+	struct layerSpec
+	{
+		int kind;
+		std::string path;		//image layers, relative to the layer file
+		std::string text;
+		float x;
+		float y;
+		float width;			//0 fills the frame, for text 0 lets the line be as wide as it needs
+		float height;			//0 keeps the aspect of the picture, for text the height of the letters
+		float opacity;
+		cv::Scalar colour;		//text, BGR
+	};
+
+	//background, subject and foreground over the whole frame, what a theme without a layer file looks like
+	std::vector<layerSpec> defaultLayerStack();
+
+	//read a layer file, one layer per line from the bottom up, # starts a comment:
+	//  background [x y width height]
+	//  foreground [x y width height [opacity]]
+	//  subject
+	//  image logo.png x y width height [opacity]
+	//  text x y height rrggbb the text, {date} is today
+	//false with the line in error when the file is missing, a line is not understood or there is no subject
+	bool readLayerFile(const std::string& path, std::vector<layerSpec>& layers, std::string* error = NULL);
+
+	//a layer stack compiled for one frame size, immutable once built and shared between threads
+	struct compiledLayers
+	{
+		cv::Size size;
+		cv::Mat backdrop;				//BGR, every layer under the subject, what the key puts behind the subject
+		cv::Mat overlay;				//BGRA, every layer over the subject flattened into one
+		std::vector<cv::Rect> runs;		//runs of tiles where the overlay has any alpha, only these are blended
+		int tile;
+		int overlayLayers;
+		float coverage;					//fraction of the frame inside the runs
+		float compileMs;
+		std::string date;				//what {date} was when compiled
+	};
+
+	//the layers of the current theme, compiled on first use for every size it is composed at
+	//(live, the governor's reduced live sizes, the print and the burst cell) and kept for the next frames
+	//copies share the theme and its compiled sizes, load gives this copy a theme of its own, so a print job
+	//that copied the stack keeps composing the theme it started with while the form moves on to the next
+	class LayerStack
+	{
+	public:
+		LayerStack();
+
+		//folder resolves the image paths, background and foreground are the theme pictures at any size
+		bool load(const std::vector<layerSpec>& layers, const std::string& folder,
+			const cv::Mat& background, const cv::Mat& foreground, std::string* log = NULL);
+		void clear();
+		bool isLoaded() const;
+		int layers() const;
+
+		//the stack at size, compiled now when this size was not used lately or the date changed, thread safe
+		std::shared_ptr<const compiledLayers> at(cv::Size size) const;
+
+		std::string describe() const;
+
+	private:
+		struct impl;
+		std::shared_ptr<impl> d;
+	};
+
+	//blend the overlay of layers over a BGR image of the same size, one pass over the covered tiles only
+	void blendLayers(cv::Mat& image, const compiledLayers& layers);
+}
@@ -0,0 +1,395 @@
+/*
+* LiveShare.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "LiveShare.h"
+#include <atomic>
+#include <cstring>
+#include <new>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+namespace GreenScreen {
+
+	static const char shareMagic[8] = { 'G', 'S', 'L', 'I', 'V', 'E', 0, 0 };
+	static const uint32_t shareVersion = 1;
+	//the header owns a whole page, every slot starts on a page and its pixels on a cache line
+	static const size_t shareHeaderSize = 4096;
+	static const size_t slotPixelsOffset = 64;
+
+	struct shareHeader
+	{
+		char magic[8];			//written last, a reader never sees a half made header
+		uint32_t version;
+		uint32_t slotCount;
+		uint64_t slotBytes;
+		uint32_t maxWidth;
+		uint32_t maxHeight;
+		uint32_t stride;
+		uint32_t reserved;
+		std::atomic<uint64_t> latest;	//sequence of the newest complete frame
+	};
+
+	struct shareSlot
+	{
+		std::atomic<uint64_t> version;	//odd while the writer is in the slot
+		uint64_t sequence;
+		int64_t captureUs;
+		int64_t publishUs;
+		int32_t width;
+		int32_t height;
+		int32_t stride;
+		int32_t format;
+	};
+
+	static size_t alignUp(size_t value, size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	int64_t liveShareClockUs()
+	{
+#ifdef _WIN32
+		LARGE_INTEGER counter, frequency;
+		QueryPerformanceCounter(&counter);
+		QueryPerformanceFrequency(&frequency);
+		return (int64_t)(counter.QuadPart / frequency.QuadPart * 1000000 + counter.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart);
+#else
+		timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (int64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+#endif
+	}
+
+	//a named block of memory shared between processes
+	//readers map it read and write too: a 64 bit atomic load is a locked compare exchange on 32 bit x86
+	struct sharedRegion
+	{
+		unsigned char* view;
+		size_t size;
+#ifdef _WIN32
+		HANDLE mapping;
+#else
+		std::string path;
+		bool isOwner;
+#endif
+
+#ifdef _WIN32
+		sharedRegion() : view(NULL), size(0), mapping(NULL) {}
+#else
+		sharedRegion() : view(NULL), size(0), isOwner(false) {}
+#endif
+
+		bool create(const std::string& name, size_t bytes)
+		{
+			release();
+#ifdef _WIN32
+			//a reader may still hold the ring of a previous run, it is reused when it is big enough
+			mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((uint64_t)bytes >> 32), (DWORD)bytes, ("Local\\" + name).c_str());
+			if (!mapping) return false;
+			view = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+			if (!view)
+			{
+				release();
+				return false;
+			}
+			MEMORY_BASIC_INFORMATION info;
+			if (VirtualQuery(view, &info, sizeof(info)) == 0 || info.RegionSize < bytes)
+			{
+				release();
+				return false;
+			}
+			size = bytes;
+#else
+			//a ring left by a crashed run is dropped, readers still mapping it notice the frames stop and reopen
+			path = "/" + name;
+			shm_unlink(path.c_str());
+			int fd = shm_open(path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+			if (fd < 0) return false;
+			isOwner = true;
+			if (ftruncate(fd, (off_t)bytes) != 0)
+			{
+				::close(fd);
+				release();
+				return false;
+			}
+			void* address = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (address == MAP_FAILED)
+			{
+				release();
+				return false;
+			}
+			view = (unsigned char*)address;
+			size = bytes;
+#endif
+			return true;
+		}
+
+		bool openExisting(const std::string& name)
+		{
+			release();
+#ifdef _WIN32
+			mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, ("Local\\" + name).c_str());
+			if (!mapping) return false;
+			view = (unsigned char*)MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+			MEMORY_BASIC_INFORMATION info;
+			if (!view || VirtualQuery(view, &info, sizeof(info)) == 0)
+			{
+				release();
+				return false;
+			}
+			size = info.RegionSize;
+#else
+			path = "/" + name;
+			int fd = shm_open(path.c_str(), O_RDWR, 0);
+			if (fd < 0) return false;
+			struct stat info;
+			if (fstat(fd, &info) != 0 || info.st_size <= 0)
+			{
+				::close(fd);
+				return false;
+			}
+			void* address = mmap(NULL, (size_t)info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			::close(fd);
+			if (address == MAP_FAILED) return false;
+			view = (unsigned char*)address;
+			size = (size_t)info.st_size;
+#endif
+			return true;
+		}
+
+		void release()
+		{
+#ifdef _WIN32
+			if (view) UnmapViewOfFile(view);
+			if (mapping) CloseHandle(mapping);
+			mapping = NULL;
+#else
+			if (view) munmap(view, size);
+			if (isOwner) shm_unlink(path.c_str());
+			isOwner = false;
+#endif
+			view = NULL;
+			size = 0;
+		}
+
+		shareHeader* header() const
+		{
+			return (shareHeader*)view;
+		}
+
+		shareSlot* slot(uint64_t sequence) const
+		{
+			const shareHeader* h = header();
+			return (shareSlot*)(view + shareHeaderSize + (size_t)(sequence % h->slotCount) * (size_t)h->slotBytes);
+		}
+	};
+
+	struct LiveSharePublisher::impl
+	{
+		sharedRegion region;
+		uint64_t published;
+
+		impl() : published(0) {}
+	};
+
+	LiveSharePublisher::LiveSharePublisher() : d(new impl())
+	{
+	}
+
+	LiveSharePublisher::~LiveSharePublisher()
+	{
+		close();
+		delete d;
+	}
+
+	bool LiveSharePublisher::open(const std::string& name, int maxWidth, int maxHeight, int slots)
+	{
+		close();
+		if (name.empty() || maxWidth <= 0 || maxHeight <= 0 || slots < 2) return false;
+
+		size_t stride = alignUp((size_t)maxWidth * 3, 64);
+		size_t slotBytes = alignUp(slotPixelsOffset + stride * maxHeight, 4096);
+		if (!d->region.create(name, shareHeaderSize + slotBytes * slots)) return false;
+
+		//the header is filled before the magic, and the atomics are made in place
+		shareHeader* header = d->region.header();
+		memset(d->region.view, 0, shareHeaderSize);
+		header->version = shareVersion;
+		header->slotCount = (uint32_t)slots;
+		header->slotBytes = slotBytes;
+		header->maxWidth = (uint32_t)maxWidth;
+		header->maxHeight = (uint32_t)maxHeight;
+		header->stride = (uint32_t)stride;
+		new (&header->latest) std::atomic<uint64_t>(0);
+		//slot versions are never reset, a reader of a reused ring must not see an old version come back
+		//a new mapping is zero filled, so they start at 0
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(header->magic, shareMagic, sizeof(shareMagic));
+		d->published = 0;
+		return true;
+	}
+
+	void LiveSharePublisher::close()
+	{
+		//a reader that still maps the ring sees no new frames, never a broken one
+		d->region.release();
+	}
+
+	bool LiveSharePublisher::isOpen() const
+	{
+		return d->region.view != NULL;
+	}
+
+	bool LiveSharePublisher::publish(const unsigned char* pixels, int width, int height, int stride, int format, int64_t captureUs)
+	{
+		shareHeader* header = d->region.header();
+		if (!header || !pixels || width <= 0 || height <= 0) return false;
+		if ((uint32_t)width > header->maxWidth || (uint32_t)height > header->maxHeight) return false;
+		size_t rowBytes = (size_t)width * 3;
+
+		uint64_t sequence = d->published + 1;
+		shareSlot* slot = d->region.slot(sequence);
+		unsigned char* target = (unsigned char*)slot + slotPixelsOffset;
+
+		//odd version first, then the frame, then the next even version: a reader that saw the same even version
+		//before and after using the pixels knows they were not touched
+		uint64_t version = slot->version.load(std::memory_order_relaxed);
+		if (version & 1) version++;	//a writer that died inside the slot
+		slot->version.store(version + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+
+		slot->sequence = sequence;
+		slot->captureUs = captureUs;
+		slot->width = width;
+		slot->height = height;
+		slot->stride = (int32_t)header->stride;
+		slot->format = format;
+		for (int y = 0; y < height; y++)
+		{
+			memcpy(target + (size_t)y * header->stride, pixels + (size_t)y * stride, rowBytes);
+		}
+		slot->publishUs = liveShareClockUs();
+
+		slot->version.store(version + 2, std::memory_order_release);
+		header->latest.store(sequence, std::memory_order_release);
+		d->published = sequence;
+		return true;
+	}
+
+	uint64_t LiveSharePublisher::published() const
+	{
+		return d->published;
+	}
+
+	struct LiveShareReader::impl
+	{
+		sharedRegion region;
+	};
+
+	LiveShareReader::LiveShareReader() : d(new impl())
+	{
+	}
+
+	LiveShareReader::~LiveShareReader()
+	{
+		close();
+		delete d;
+	}
+
+	bool LiveShareReader::open(const std::string& name)
+	{
+		close();
+		if (!d->region.openExisting(name)) return false;
+
+		//a ring that is not made yet or does not fit its own header is not used
+		const shareHeader* header = d->region.header();
+		bool isValid = d->region.size >= shareHeaderSize && memcmp(header->magic, shareMagic, sizeof(shareMagic)) == 0;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		isValid = isValid && header->version == shareVersion && header->slotCount >= 2 &&
+			header->stride >= header->maxWidth * 3 && header->slotBytes >= slotPixelsOffset + (uint64_t)header->stride * header->maxHeight &&
+			shareHeaderSize + header->slotBytes * header->slotCount <= d->region.size;
+		if (!isValid)
+		{
+			close();
+			return false;
+		}
+		return true;
+	}
+
+	void LiveShareReader::close()
+	{
+		d->region.release();
+	}
+
+	bool LiveShareReader::isOpen() const
+	{
+		return d->region.view != NULL;
+	}
+
+	uint64_t LiveShareReader::latestSequence() const
+	{
+		shareHeader* header = d->region.header();
+		return header ? header->latest.load(std::memory_order_acquire) : 0;
+	}
+
+	bool LiveShareReader::acquireLatest(uint64_t after, liveShareFrame& frame) const
+	{
+		shareHeader* header = d->region.header();
+		if (!header) return false;
+		uint64_t sequence = header->latest.load(std::memory_order_acquire);
+		if (sequence == 0 || sequence <= after) return false;
+
+		shareSlot* slot = d->region.slot(sequence);
+		uint64_t version = slot->version.load(std::memory_order_acquire);
+		if (version & 1) return false;
+
+		liveShareFrame found;
+		found.sequence = slot->sequence;
+		found.captureUs = slot->captureUs;
+		found.publishUs = slot->publishUs;
+		found.width = slot->width;
+		found.height = slot->height;
+		found.stride = slot->stride;
+		found.format = slot->format;
+		found.pixels = (const unsigned char*)slot + slotPixelsOffset;
+		found.version = version;
+
+		//the writer lapped the ring between the two loads, the next poll gets a newer frame
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot->version.load(std::memory_order_relaxed) != version || found.sequence != sequence) return false;
+		if (found.width <= 0 || found.height <= 0 || (uint32_t)found.width > header->maxWidth || (uint32_t)found.height > header->maxHeight) return false;
+		frame = found;
+		return true;
+	}
+
+	bool LiveShareReader::isStillValid(const liveShareFrame& frame) const
+	{
+		shareHeader* header = d->region.header();
+		if (!header) return false;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		return d->region.slot(frame.sequence)->version.load(std::memory_order_relaxed) == frame.version;
+	}
+}
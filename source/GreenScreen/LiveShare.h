@@ -0,0 +1,100 @@
+/*
+* LiveShare.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// this header is included from the /clr form, keep it free of <thread>, <mutex> and <atomic>,
+// the implementation lives in LiveShare.cpp which is compiled as native code
+
+namespace GreenScreen {
+
+	enum liveShareFormat
+	{
+		liveShareBGR24 = 1		//3 bytes per pixel, the live composite as the pipeline makes it
+	};
+
+	//one frame as a reader sees it, pixels point into the shared memory
+	struct liveShareFrame
+	{
+		const unsigned char* pixels;
+		int width;
+		int height;
+		int stride;
+		int format;
+		uint64_t sequence;		//1 for the first published frame, a gap means the reader missed frames
+		int64_t captureUs;		//liveShareClockUs when the live jpeg was downloaded
+		int64_t publishUs;		//liveShareClockUs when the frame was complete in the ring
+		uint64_t version;		//slot version at acquire, checked again by isStillValid
+	};
+
+	//monotonic microseconds, the same clock in every process of the machine
+	int64_t liveShareClockUs();
+
+	//the live composite in a named shared memory ring, one writer and any number of readers
+	//every slot has a sequence lock: readers use the pixels in place and check afterwards that
+	//the writer did not come back to the slot meanwhile, nobody ever waits for anybody
+	class LiveSharePublisher
+	{
+	public:
+		LiveSharePublisher();
+		~LiveSharePublisher();
+
+		//create the ring, frames up to maxWidth x maxHeight, slots frames before a slot is reused
+		bool open(const std::string& name, int maxWidth, int maxHeight, int slots = 4);
+		void close();
+		bool isOpen() const;
+
+		//copy one frame into the next slot, the only copy the frame gets on its way to the readers
+		bool publish(const unsigned char* pixels, int width, int height, int stride, int format, int64_t captureUs);
+		uint64_t published() const;
+
+	private:
+		struct impl;
+		impl* d;
+
+		LiveSharePublisher(const LiveSharePublisher&);
+		LiveSharePublisher& operator=(const LiveSharePublisher&);
+	};
+
+	class LiveShareReader
+	{
+	public:
+		LiveShareReader();
+		~LiveShareReader();
+
+		//map a ring made by a publisher, false while there is none
+		bool open(const std::string& name);
+		void close();
+		bool isOpen() const;
+
+		//newest complete frame with a sequence after the given one, false when there is nothing newer
+		bool acquireLatest(uint64_t after, liveShareFrame& frame) const;
+		//true if the writer did not touch the slot since acquireLatest, use the pixels only when this holds
+		bool isStillValid(const liveShareFrame& frame) const;
+		//sequence of the newest frame, 0 before the first one
+		uint64_t latestSequence() const;
+
+	private:
+		struct impl;
+		impl* d;
+
+		LiveShareReader(const LiveShareReader&);
+		LiveShareReader& operator=(const LiveShareReader&);
+	};
+}
@@ -1,12 +1,50 @@
 #include "MyForm.h"
+#include "CompositeService.h"
 
 using namespace System;
 using namespace System::Windows::Forms;
 
+//--serve [socket] composes for the kiosk and the sharing station without the booth form or the camera,
+//with the themes of the Resource folder
+//--workers n sizes the pool, enter prints the stats, q and enter stops
+static void serveHeadless()
+{
+	String^ socketPath = GreenScreen::commandLineValue("--serve");
+	if (socketPath->Length == 0 || socketPath->StartsWith("--")) socketPath = gcnew String(GreenScreen::defaultCompositeSocket().c_str());
+	int workers = 0;
+	Int32::TryParse(GreenScreen::commandLineValue("--workers"), workers);
+
+	std::string kernelLog;
+	GreenScreen::selectPixelKernels(GreenScreen::toNativeString(GreenScreen::commandLineValue("--kernels")), &kernelLog);
+	Console::WriteLine(gcnew String(kernelLog.c_str()));
+
+	String^ themeFolder = IO::Directory::GetCurrentDirectory() + "\\Resource";
+	GreenScreen::CompositeService service;
+	if (!service.start(GreenScreen::toNativeString(socketPath), GreenScreen::toNativeString(themeFolder), workers))
+	{
+		Console::WriteLine("could not listen on " + socketPath);
+		return;
+	}
+	Console::WriteLine("compositing on " + socketPath + ", enter prints the stats, q and enter stops");
+	String^ line = Console::ReadLine();
+	while (line != nullptr && line != "q")
+	{
+		Console::Write(gcnew String(service.statsText().c_str()));
+		line = Console::ReadLine();
+	}
+	Console::Write(gcnew String(service.statsText().c_str()));
+	service.stop();
+}
+
 [STAThread]//leave this as is
 void main(array<String^>^ args) {
+	if (GreenScreen::commandLineSwitch("--serve"))
+	{
+		serveHeadless();
+		return;
+	}
 	Application::EnableVisualStyles();
 	Application::SetCompatibleTextRenderingDefault(false);
 	GreenScreen::MyForm form;
 	Application::Run(%form);
-}
\ No newline at end of file
+}
@@ -16,13 +16,20 @@
 
 #pragma once
 #include "opencv/cv.hpp"
-#include "EDSDK.h"
-#include "EDSDKErrors.h"
-#include "EDSDKTypes.h"
+#include "BurstComposer.h"
+#include "CaptureJournal.h"
+#include "ClipRecorder.h"
+#include "EdsCamera.h"
+#include "FrameGovernor.h"
+#include "GdiPrinter.h"
+#include "KeyPipeline.h"
+#include "LiveShare.h"
+#include "OutputPyramid.h"
+#include "PixelKernels.h"
+#include "PrintJob.h"
+#include "SimulatedBackends.h"
 #include <Windows.h>
 
-#define SRCCOPY2             (unsigned long)0x00CC0020
-
 namespace GreenScreen {
 
 	using namespace System;
@@ -39,213 +46,87 @@ namespace GreenScreen {
 
 	//INITIAL***********************
 	//OUTSIDE VARS
-	//canon vars
-	EdsError err = EDS_ERR_OK;
-	bool isSDKLoaded = false;
+	//camera and printer, the canon and the windows default printer unless started with --simulate
+	CameraBackend* cameraBackend = NULL;
+	PrinterBackend* printerBackend = NULL;
 	bool isOpen = false;
 	bool allowPrint = true;
 	bool isRequesting = false;
-	EdsCameraRef camera = NULL;
-	char* fileName;
-	// live Stream canon vars
-	EdsEvfImageRef evfImage = NULL;
-	EdsStreamRef stream = NULL;
-	unsigned char* data = NULL;
-	unsigned long size = 0;
 	bool isLiveStream = false;
+	//downloaded picture, keeps its capacity between captures
+	std::vector<unsigned char> pictureBuffer;
 
 	//******************************************
 	//Image processing var
 	int xCoordSample = 10;
 	int yCoordSample = 10;
+	//the live view size when the sample was picked, 0 until it is picked on the live view
+	int sampleWidth = 0;
+	int sampleHeight = 0;
 	int hueVar = 20;
 	int saturationVar = 50;
 	int valueVar = 65;
+	//colour key or clean plate, and how far from the empty set a pixel must be to stay
+	int keyingMode = keyModeColor;
+	float plateThreshold = 4.0f;
 	Mat background;
 	Mat backgroundLive;
 	Mat foreground;
 	Mat foregroundLive;
+	//logo, date, sponsor strip and the rest of a theme with a layer file, compiled per size into one overlay pass
+	LayerStack themeLayers;
 	Mat composeImage;
 	Mat composeImageLive;
 
-	//OUTSIDE METHODS
-	//get the first CANON camera connected to pc
-	EdsError getFirstCamera(EdsCameraRef *camera)
-	{
-		EdsError err = EDS_ERR_OK;
-		EdsCameraListRef cameraList = NULL;
-		EdsUInt32 count = 0;
-		// Get camera list
-		err = EdsGetCameraList(&cameraList);
-		// Get number of cameras
-		if (err == EDS_ERR_OK)
-		{
-			err = EdsGetChildCount(cameraList, &count);
-			if (count == 0) err = EDS_ERR_DEVICE_NOT_FOUND;
-		}
-		// Get first camera retrieved
-		if (err == EDS_ERR_OK)err = EdsGetChildAtIndex(cameraList, 0, camera);
-
-		// Release camera list
-		if (cameraList != NULL)
-		{
-			EdsRelease(cameraList);
-			cameraList = NULL;
-		}
-		return err;
-	}
-
-	//Canon event handler
-	static EdsError EDSCALLBACK handleObjectEvent(EdsObjectEvent event, EdsBaseRef object, EdsVoid * context)
-	{
-		EdsError err = EDS_ERR_OK;
-		if (event == kEdsObjectEvent_DirItemRequestTransfer)
-		{
-			EdsStreamRef stream = NULL;
-			EdsDirectoryItemInfo dirItemInfo;
-			err = EdsGetDirectoryItemInfo(object, &dirItemInfo);
-			err = EdsCreateFileStream(fileName, kEdsFileCreateDisposition_CreateAlways, kEdsAccess_ReadWrite, &stream);
-			err = EdsDownload(object, dirItemInfo.size, stream);
-			err = EdsDownloadComplete(object);
-			EdsRelease(stream);
-			stream = NULL;
-			return err;
-		}
-		if (object) EdsRelease(object);
-	}
-
-	//get the CANON camera name by reference
-	static char* getDeviceName(EdsCameraRef &camera)
-	{
-		EdsDeviceInfo deviceInfo;
-		EdsError err = EDS_ERR_OK;
-		if (err == EDS_ERR_OK)
-		{
-			err = EdsGetDeviceInfo(camera, &deviceInfo);
-			if (err == EDS_ERR_OK && camera == NULL) err = EDS_ERR_DEVICE_NOT_FOUND;
-		}
-		if (err == EDS_ERR_OK) return deviceInfo.szDeviceDescription;
-		return "";
-	}
-
-	float clamp(int n, int lower, int upper) {
-		return max(lower, min(n, upper));
-	}
+	//capture journal, replaces the scan of the Save folder for numbering
+	CaptureJournal journal;
+	//last composited live frames for boomerang clips
+	ClipRecorder clipRecorder;
+	//keying and compositing, owns the live and print scratch arenas
+	KeyPipeline pipeline;
+	//burst shots composed on workers straight into one print page
+	BurstComposer burstComposer;
+	//full size print jobs, off the form thread
+	PrintWorker printWorker;
+	//every live composite for other processes on this pc (encoders, second screens), see Tools/LiveShareMonitor
+	LiveSharePublisher liveShare;
+	//live quality and frame rate against the frame time budget
+	FrameGovernor governor;
 
+	//OUTSIDE METHODS
 	int lerp(int a, int b, float f)
 	{
 		return a + (int)(f * (float)(b - a));
 	}
 
-	//compute a chroma key: by default sample (10,10) image coords, and default = alive process for fast solutions
-	void chromaKey(Mat& image, bool isLive = true)
+	//the key parameters as picked in the form
+	keySettings currentKeySettings()
 	{
-		if (image.empty()) return;
-
-		//convert image to HSV and create a empty mask with same size
-		Mat hsv;
-		Mat mask = Mat(cv::Size(image.cols, image.rows), CV_8UC1);
-		cvtColor(image, hsv, CV_BGR2HSV);
-
-		//take the sample to chroma
-		int xCoord, yCoord;
-		xCoord = xCoordSample;
-		yCoord = yCoordSample;
-
-		if (!isLive)
-		{
-			float scaleFactor = (5184.00f / 720.00f);
-			int xNew = xCoord * scaleFactor;
-			int yNew = yCoord * scaleFactor;
-			if (xNew > 0 && xNew > 5184 && yNew > 0 && yNew < 3400)
-			{
-				xCoord *= scaleFactor;
-				yCoord *= scaleFactor;
-			}
-		}
-
-		Vec3b sample = hsv.at<Vec3b>(xCoord, yCoord);
-		uchar hue = sample[0];
-		uchar saturation = sample[1];
-		uchar value = sample[2];
-
-		//define min and max threshold for this sample
-		Vec3b rangeMin = Vec3b(clamp(hue - hueVar, 0, 255), clamp(saturation - saturationVar, 0, 255), clamp(value - valueVar, 0, 255));
-		Vec3b rangeMax = Vec3b(clamp(hue + hueVar, 0, 255), 255, clamp(value + valueVar, 0, 255));
-
-		//from range get mask in alpha
-		inRange(hsv, rangeMin, rangeMax, mask);
-		mask.convertTo(mask, CV_8UC1);
-
-		//dilate 2 pixels and invert mask
-		dilate(mask, mask, Mat(), cv::Point(-1, -1), 2, 1, 1);
-		bitwise_not(mask, mask);
-
-		//blur mask for better results
-		blur(mask, mask, cv::Size(3, 3));
-		//return at original 
-		cvtColor(hsv, image, CV_HSV2BGR);
-		//compute the chroma mask
-		for (int y = 0; y < image.rows; y++)
-		{
-			for (int x = 0; x < image.cols; x++)
-			{
-				int val = mask.at<uchar>(cv::Point(x, y));
-				if (isLive)
-				{
-					Vec3b BGpixel = backgroundLive.at<Vec3b>(cv::Point(x, y));
-					if (val < 255)
-					{
-						image.at<Vec3b>(cv::Point(x, y)) = BGpixel;
-					}
-				}
-				else
-				{
-					Vec3b BGpixel = background.at<Vec3b>(cv::Point(x, y));
-					if (val < 255)
-					{
-						image.at<Vec3b>(cv::Point(x, y)) = BGpixel;
-					}
-				}
-			}
-		}
+		keySettings key;
+		key.xCoordSample = xCoordSample;
+		key.yCoordSample = yCoordSample;
+		key.hueVar = hueVar;
+		key.saturationVar = saturationVar;
+		key.valueVar = valueVar;
+		key.mode = keyingMode;
+		key.plateThreshold = plateThreshold;
+		key.sampleWidth = sampleWidth;
+		key.sampleHeight = sampleHeight;
+		return key;
 	}
 
-	void overlayImage(const cv::Mat &background, const cv::Mat &foreground, cv::Mat &output, cv::Point2i location)
+	//copy a managed string to a std::string, the HGlobal buffer is released before returning
+	static std::string toNativeString(System::String^ text)
 	{
-		background.copyTo(output);
-		// start at the row indicated by location, or at row 0 if location.y is negative.
-		for (int y = max(location.y, 0); y < background.rows; ++y)
-		{
-			int fY = y - location.y; // because of the translation
-
-			// we are done of we have processed all rows of the foreground image.
-			if (fY >= foreground.rows) break;
-
-			// start at the column indicated by location, 
-			// or at column 0 if location.x is negative.
-			for (int x = max(location.x, 0); x < background.cols; ++x)
-			{
-				int fX = x - location.x; // because of the translation.
-
-				// we are done with this row if the column is outside of the foreground image.
-				if (fX >= foreground.cols)break;
-
-				// determine the opacity of the foregrond pixel, using its fourth (alpha) channel.
-				double opacity = ((double)foreground.data[fY * foreground.step + fX * foreground.channels() + 3]) / 255.;
+		IntPtr ptr = Marshal::StringToHGlobalAnsi(text);
+		std::string out((const char*)ptr.ToPointer());
+		Marshal::FreeHGlobal(ptr);
+		return out;
+	}
 
-				// but only if opacity > 0.
-				for (int c = 0; opacity > 0 && c < output.channels(); ++c)
-				{
-					unsigned char foregroundPx =
-						foreground.data[fY * foreground.step + fX * foreground.channels() + c];
-					unsigned char backgroundPx =
-						background.data[y * background.step + x * background.channels() + c];
-					output.data[y*output.step + output.channels()*x + c] =
-						backgroundPx * (1. - opacity) + foregroundPx * opacity;
-				}
-			}
-		}
+	static float elapsedMs(int64 startTick)
+	{
+		return (float)((getTickCount() - startTick) * 1000.0 / getTickFrequency());
 	}
 
 	static bool clearDirectory(System::String^ folder)
@@ -265,92 +146,32 @@ namespace GreenScreen {
 		return false;
 	}
 
-	//printing functions, this store the drivers and pointer to printer in order to call it
-	struct printerInfo
+	//true when the app was started with a command line switch, like --raw
+	static bool commandLineSwitch(System::String^ name)
 	{
-		LPCWSTR portName;
-		LPCWSTR driver;
-		LPCWSTR deviceName;
-		LPCWSTR output = NULL;
-	};
-
-	// this return the printer info about the primary printer setup in windows
-	printerInfo getPrimaryPrinter()
-	{
-		printerInfo out;
-		unsigned long size = 0;
-		LPWSTR defaultName = NULL;
-		//get default printer size info
-		GetDefaultPrinter(NULL, &size);
-		if (size)
-		{
-			TCHAR* buffer = new TCHAR[size];
-			GetDefaultPrinter(buffer, &size);
-			defaultName = buffer;
-		}
-		// if we found some printer then try to get all info to struct printerInfo
-		if (defaultName)
+		cli::array<System::String^>^ args = Environment::GetCommandLineArgs();
+		for (int i = 1; i < args->Length; i++)
 		{
-			out.deviceName = defaultName;
-			LPBYTE pPrinterEnum;
-			unsigned long pcbNeeded, pcbReturned;
-			PRINTER_INFO_2* printerInfo = NULL;
-
-			//list all printer in this pc
-			EnumPrinters(PRINTER_ENUM_LOCAL, NULL, 2, NULL, 0, &pcbNeeded, &pcbReturned);
-
-			//if we found some printer connected, then get the drivers and name and some stuff
-			pPrinterEnum = new BYTE[pcbNeeded];
-			if (EnumPrinters(PRINTER_ENUM_LOCAL, NULL, 2, pPrinterEnum, pcbNeeded, &pcbNeeded, &pcbReturned))
-			{
-				printerInfo = ((PRINTER_INFO_2*)pPrinterEnum);
-				wstring wsdefaultName(defaultName);
-				string sdefaultName(wsdefaultName.begin(), wsdefaultName.end());
-
-				//fill the printerInfo
-				for (unsigned int i = 0; i < pcbReturned; i++)
-				{
-					LPWSTR name = printerInfo[i].pPrinterName;
-					wstring wsname(name);
-					string sname(wsname.begin(), wsname.end());
-					if (sname == sdefaultName)
-					{
-						out.driver = printerInfo[i].pDriverName;
-						out.portName = printerInfo[i].pPortName;
-					}
-				}
-			}
+			if (args[i] == name) return true;
 		}
-		return out;
+		return false;
 	}
 
-	// call the printer to print some file in some folder, we need pass .bmp file
-	void printInPrinter( Mat out)
+	//the simulated backends replace the hardware when the app is started with --simulate
+	static bool isSimulated()
 	{
-		if (out.empty()) return;
-
-		printerInfo dev = getPrimaryPrinter();
-
-		int width = 2700;
-		int height = 4050;
-		Mat to;
-		resize(out, to, cv::Size(width, height));
-
-		//open printer
-		HBITMAP hBMP = CreateBitmap(width, height, 1, 24, to.data);
-		HDC printer = CreateDC(dev.driver, dev.deviceName, dev.portName, NULL);
+		return commandLineSwitch("--simulate");
+	}
 
-		if (printer)
+	//value after a command line switch, like --kernels avx2, empty when it is not there
+	static System::String^ commandLineValue(System::String^ name)
+	{
+		cli::array<System::String^>^ args = Environment::GetCommandLineArgs();
+		for (int i = 1; i + 1 < args->Length; i++)
 		{
-			HDC hdc = CreateCompatibleDC(printer);
-			SelectObject(hdc, hBMP);
-			Escape(printer, STARTDOC, 8, "Happy-Doc", NULL);
-			BitBlt(printer, 0, 0, width, height, hdc, 1, 1, SRCCOPY2);
-			Escape(printer, NEWFRAME, 0, NULL, NULL);
-			Escape(printer, ENDDOC, 0, NULL, NULL);
-
-			DeleteDC(printer);
+			if (args[i] == name) return args[i + 1];
 		}
+		return "";
 	}
 
 
@@ -375,7 +196,38 @@ namespace GreenScreen {
 		System::String^ resourcePath = Directory::GetCurrentDirectory() + "\\Resource";
 		System::String^ bgFolder = resourcePath + "/background";
 		System::String^ fgFolder = resourcePath + "/foreground";
+		//optional, layers/<background name>.txt stacks more pictures and text on that theme
+		System::String^ layerFolder = resourcePath + "/layers";
 		int saveIncremental = 0;
+		bool isJournalNumberingLost = false;
+		System::String^ journalPath = savePath + "\\captures.journal";
+		System::String^ screenFolder = savePath + "/screen";
+		System::String^ thumbFolder = savePath + "/thumbs";
+		System::String^ clipFolder = savePath + "/clips";
+		System::String^ clipExtension = ".gif";
+		bool isClipMode = false;
+		int clipFrames = 36;
+		System::String^ keyModePath = savePath + "\\keymode.txt";
+		int plateFrames = 30;
+		int plateFramesLeft = 0;
+		bool isPlateRequest = false;
+		//the capture on the print worker
+		System::String^ printSavePath = "";
+		bool isRawPrint = false;
+		const uchar* printBackgroundSource = NULL;
+		const uchar* printForegroundSource = NULL;
+		//burst mode: --burst-shots n (default 4) and --burst-layout strip|grid
+		bool isBurstMode = false;
+		int burstShots = 4;
+		bool isBurstGrid = false;
+		int backgroundIndex = -1;
+		int foregroundIndex = -1;
+		int64 captureRequestTick = 0;
+		//two display bitmaps, one is shown while the next frame is written to the other
+		cli::array<Bitmap^>^ liveBitmaps = gcnew cli::array<Bitmap^>(2);
+		int liveBitmapIndex = 0;
+		long long liveFrameCount = 0;
+		uint64_t liveAllocationsReported = 0;
 
 		List<System::String^> backgroundList;
 		List<System::String^> foregroundList;
@@ -395,8 +247,7 @@ namespace GreenScreen {
 			{
 				if (File::Exists(backgroundList[index]))
 				{
-					char* imgPath = (char*)(void*)Marshal::StringToHGlobalAnsi(backgroundList[index]);
-					out = imread(imgPath);
+					out = imread(toNativeString(backgroundList[index]));
 				}
 			}
 			return out;
@@ -409,8 +260,7 @@ namespace GreenScreen {
 			{
 				if (File::Exists(foregroundList[index]))
 				{
-					char* imgPath = (char*)(void*)Marshal::StringToHGlobalAnsi(foregroundList[index]);
-					out = imread(imgPath, CV_LOAD_IMAGE_UNCHANGED);
+					out = imread(toNativeString(foregroundList[index]), CV_LOAD_IMAGE_UNCHANGED);
 				}
 			}
 			return out;
@@ -421,6 +271,7 @@ namespace GreenScreen {
 			Random^ r = gcnew Random();
 			//background random
 			int randBackgroundNum = r->Next(0, resouceSize + 1);
+			backgroundIndex = randBackgroundNum;
 			background = getBackground(randBackgroundNum);
 			if (!background.empty())
 			{
@@ -429,11 +280,93 @@ namespace GreenScreen {
 			
 			//foreground random
 			int randForegroundNum = r->Next(0, resouceSize + 1);
+			foregroundIndex = randForegroundNum;
 			foreground = getForeground(randForegroundNum);
 			if (!foreground.empty())
 			{
 				cv::resize(foreground, foregroundLive, cv::Size(liveStreamWidth, liveStreamHeight));
 			}
+			loadThemeLayers(randBackgroundNum);
+		}
+
+		//the layer file of the background, without one the theme is the background and the foreground as always
+		void loadThemeLayers(int index)
+		{
+			themeLayers.clear();
+			if (index < 0 || index > resouceSize || !Directory::Exists(layerFolder)) return;
+			System::String^ layerFile = layerFolder + "/" + Path::GetFileNameWithoutExtension(backgroundList[index]) + ".txt";
+			if (!File::Exists(layerFile)) return;
+
+			std::vector<layerSpec> layers;
+			std::string message;
+			if (!readLayerFile(toNativeString(layerFile), layers, &message))
+			{
+				Console::WriteLine(gcnew System::String(message.c_str()) + ", using the foreground alone");
+				return;
+			}
+			themeLayers.load(layers, toNativeString(layerFolder), background, foreground, &message);
+			if (!message.empty()) Console::Write(gcnew System::String(message.c_str()));
+
+			//the live size is compiled now, the print size with the first print of the theme
+			std::shared_ptr<const compiledLayers> live = themeLayers.at(cv::Size(liveStreamWidth, liveStreamHeight));
+			Console::WriteLine("theme " + gcnew System::String(themeLayers.describe().c_str()));
+			if (live)
+			{
+				Console::WriteLine("live overlay: " + live->overlayLayers + " layers over the subject in one pass, " + (int)(live->coverage * 100) + "% of the frame, compiled in " + live->compileMs + " ms");
+			}
+		}
+
+		//reuse the display bitmaps instead of a new one every frame
+		Bitmap^ nextLiveBitmap()
+		{
+			liveBitmapIndex = 1 - liveBitmapIndex;
+			Bitmap^ bitmap = liveBitmaps[liveBitmapIndex];
+			if (bitmap == nullptr || bitmap->Width != liveStreamWidth || bitmap->Height != liveStreamHeight)
+			{
+				if (bitmap != nullptr) delete bitmap;
+				bitmap = gcnew Bitmap(liveStreamWidth, liveStreamHeight, System::Drawing::Imaging::PixelFormat::Format24bppRgb);
+				liveBitmaps[liveBitmapIndex] = bitmap;
+			}
+			return bitmap;
+		}
+
+		//highest green_N number in the save folder, only used to seed a new journal
+		//parse every name instead of trusting the sort order, green_10 sorts before green_9
+		int getLastSaveNumber()
+		{
+			int last = 0;
+			if (!Directory::Exists(savePath)) return last;
+			cli::array<System::String^>^ files = Directory::GetFiles(savePath, "green_*.png");
+			for (int i = 0; i < files->Length; i++)
+			{
+				System::String^ name = Path::GetFileNameWithoutExtension(files[i]);
+				int number = 0;
+				if (int::TryParse(name->Substring(name->LastIndexOf('_') + 1), number) && number > last)
+				{
+					last = number;
+				}
+			}
+			return last;
+		}
+
+		//next number for a saved picture, from the journal or the old counter when the journal is not available
+		//once the journal fails to reserve, the counter goes on from the highest number the journal or the
+		//save folder ever had and the journal stays out of the numbering, so no number is handed out twice
+		uint64_t nextSaveNumber()
+		{
+			if (journal.isOpen() && !isJournalNumberingLost)
+			{
+				uint64_t sequence = journal.reserveSequence();
+				if (sequence != 0) return sequence;
+				isJournalNumberingLost = true;
+				int lastReserved = (int)journal.nextSequence() - 1;
+				int lastSaved = getLastSaveNumber();
+				if (lastReserved > saveIncremental) saveIncremental = lastReserved;
+				if (lastSaved > saveIncremental) saveIncremental = lastSaved;
+				Console::WriteLine("capture journal could not reserve a number, numbering on from " + saveIncremental);
+			}
+			saveIncremental++;
+			return (uint64_t)saveIncremental;
 		}
 
 	protected:
@@ -451,12 +384,18 @@ namespace GreenScreen {
 	private: System::Windows::Forms::Button^  button1;
 	private: System::Windows::Forms::Button^  button2;
 	private: System::Windows::Forms::Button^  button3;
+	private: System::Windows::Forms::Button^  button4;
+	private: System::Windows::Forms::Button^  button5;
 	private: System::Windows::Forms::PictureBox^  pictureBox1;
 	private: System::Windows::Forms::CheckBox^ checkBox1;
+	private: System::Windows::Forms::CheckBox^ checkBox2;
+	private: System::Windows::Forms::CheckBox^ checkBox3;
+	private: System::Windows::Forms::CheckBox^ checkBox4;
 	private: System::Windows::Forms::Timer^  timer1;
 	private: System::Windows::Forms::HScrollBar^  hScrollBar1;
 	private: System::Windows::Forms::HScrollBar^  hScrollBar2;
 	private: System::Windows::Forms::HScrollBar^  hScrollBar3;
+	private: System::Windows::Forms::HScrollBar^  hScrollBar4;
 
 	private:
 		/// <summary>
@@ -493,6 +432,21 @@ namespace GreenScreen {
 				Directory::CreateDirectory(savePath);
 				Console::WriteLine("Add save folder");
 			}
+			if (!Directory::Exists(screenFolder))
+			{
+				Directory::CreateDirectory(screenFolder);
+				Console::WriteLine("Add screen folder");
+			}
+			if (!Directory::Exists(thumbFolder))
+			{
+				Directory::CreateDirectory(thumbFolder);
+				Console::WriteLine("Add thumbnail folder");
+			}
+			if (!Directory::Exists(clipFolder))
+			{
+				Directory::CreateDirectory(clipFolder);
+				Console::WriteLine("Add clips folder");
+			}
 			if (!Directory::Exists(tmpPath))
 			{
 				Directory::CreateDirectory(tmpPath);
@@ -535,15 +489,71 @@ namespace GreenScreen {
 				}
 			}
 
-			//GetLastSave
+			//GetLastSave, the save folder is only scanned once to seed a journal that does not exist yet
 			if (Directory::Exists(savePath))
 			{
-				cli::array<System::String^>^ files = Directory::GetFiles(savePath);
-				if (files->Length > 0)
+				bool isNewJournal = !File::Exists(journalPath);
+				uint64_t firstSequence = isNewJournal ? (uint64_t)getLastSaveNumber() + 1 : 1;
+				bool isJournalOpen = journal.open(toNativeString(journalPath), firstSequence);
+				if (!isJournalOpen && !isNewJournal)
 				{
-					System::String^ last = files[files->Length - 1];
-					cli::array<System::String^>^ cropLast = last->Split('_');
-					saveIncremental = int::Parse(cropLast[cropLast->Length - 1]->Split('.')[0]);
+					//a journal of an older record layout is never written to, keep it aside and start a new one
+					System::String^ oldPath = journalPath + "." + DateTime::Now.ToString("yyyyMMddHHmmss");
+					try
+					{
+						File::Move(journalPath, oldPath);
+						Console::WriteLine("capture journal could not be opened, kept as " + oldPath);
+						isJournalOpen = journal.open(toNativeString(journalPath), (uint64_t)getLastSaveNumber() + 1);
+					}
+					catch (System::Exception^)
+					{
+					}
+				}
+				if (isJournalOpen)
+				{
+					Console::WriteLine("capture journal ready, next picture: " + journal.nextSequence());
+				}
+				else
+				{
+					saveIncremental = getLastSaveNumber();
+					Console::WriteLine("capture journal not available, numbering from save folder: " + saveIncremental);
+				}
+
+				//clean plate of this booth and the key it was left on
+				if (pipeline.cleanPlate().load(toNativeString(savePath)))
+				{
+					Console::WriteLine("clean plate loaded");
+				}
+				if (File::Exists(keyModePath) && File::ReadAllText(keyModePath)->Trim() == "cleanplate")
+				{
+					keyingMode = keyModeCleanPlate;
+				}
+			}
+
+			//--segment model.onnx keys people with a segmentation network instead of the green, for any backdrop
+			//decided before the controls are made, the clean plate check box shows the final mode
+			//--segment-size is the square input of the model, 256 by default
+			System::String^ segmentModel = commandLineValue("--segment");
+			if (segmentModel->Length > 0)
+			{
+				int segmentSize = 0;
+				if (!Int32::TryParse(commandLineValue("--segment-size"), segmentSize) || segmentSize < 32 || segmentSize > 1024) segmentSize = 256;
+				if (!isSegmentationSupported())
+				{
+					Console::WriteLine("this build has no ONNX Runtime or opencv dnn, keeping the " + gcnew System::String(keyingMode == keyModeCleanPlate ? "clean plate" : "colour") + " key");
+				}
+				else if (pipeline.personSegmenter().load(selfieSegmentationModel(toNativeString(segmentModel), cv::Size(segmentSize, segmentSize))))
+				{
+					if (keyingMode == keyModeCleanPlate) Console::WriteLine("--segment replaces the saved clean plate key for this run");
+					keyingMode = keyModePerson;
+					//a model with a fixed input size keeps its own
+					const segmentationModel& loaded = pipeline.personSegmenter().model();
+					Console::WriteLine("person key: " + segmentModel + " at " + loaded.input.width + "x" + loaded.input.height + " on " +
+						gcnew System::String(segmentationBackend().c_str()) + (loaded.threads > 0 ? ", " + loaded.threads.ToString() + " threads" : System::String::Empty));
+				}
+				else
+				{
+					Console::WriteLine("could not load the segmentation model " + segmentModel + ", keeping the " + gcnew System::String(keyingMode == keyModeCleanPlate ? "clean plate" : "colour") + " key");
 				}
 			}
 
@@ -583,10 +593,16 @@ namespace GreenScreen {
 			this->button1 = (gcnew System::Windows::Forms::Button());
 			this->button2 = (gcnew System::Windows::Forms::Button());
 			this->button3 = (gcnew System::Windows::Forms::Button());
+			this->button4 = (gcnew System::Windows::Forms::Button());
+			this->button5 = (gcnew System::Windows::Forms::Button());
 			this->checkBox1 = (gcnew System::Windows::Forms::CheckBox());
+			this->checkBox2 = (gcnew System::Windows::Forms::CheckBox());
+			this->checkBox3 = (gcnew System::Windows::Forms::CheckBox());
+			this->checkBox4 = (gcnew System::Windows::Forms::CheckBox());
 			this->hScrollBar1 = (gcnew System::Windows::Forms::HScrollBar());
 			this->hScrollBar2 = (gcnew System::Windows::Forms::HScrollBar());
 			this->hScrollBar3 = (gcnew System::Windows::Forms::HScrollBar());
+			this->hScrollBar4 = (gcnew System::Windows::Forms::HScrollBar());
 			this->timer1 = (gcnew System::Windows::Forms::Timer(this->components));
 			(cli::safe_cast<System::ComponentModel::ISupportInitialize^>(this->pictureBox1))->BeginInit();
 			this->SuspendLayout();
@@ -627,6 +643,18 @@ namespace GreenScreen {
 			this->hScrollBar3->Value = valueVar;
 			this->hScrollBar3->Scroll += gcnew System::Windows::Forms::ScrollEventHandler(this, &MyForm::hScrollBar2_Scroll);
 			// 
+			// hScrollBar4
+			// 
+			this->hScrollBar4->AccessibleName = L"plate threshold";
+			this->hScrollBar4->Location = System::Drawing::Point(230, liveStreamHeight + 37);
+			this->hScrollBar4->Maximum = 255;
+			this->hScrollBar4->Minimum = 1;
+			this->hScrollBar4->Name = L"hScrollBar4";
+			this->hScrollBar4->Size = System::Drawing::Size(150, 10);
+			this->hScrollBar4->TabIndex = 0;
+			this->hScrollBar4->Value = (int)(plateThreshold * 10);
+			this->hScrollBar4->Scroll += gcnew System::Windows::Forms::ScrollEventHandler(this, &MyForm::hScrollBar4_Scroll);
+			// 
 			// button1
 			// 
 			this->button1->ImageAlign = System::Drawing::ContentAlignment::BottomLeft;
@@ -660,6 +688,26 @@ namespace GreenScreen {
 			this->button3->UseVisualStyleBackColor = true;
 			this->button3->Click += gcnew System::EventHandler(this, &MyForm::button3_Click);
 			// 
+			// button4
+			//
+			this->button4->Location = System::Drawing::Point(230, liveStreamHeight + 89);
+			this->button4->Name = L"button4";
+			this->button4->Size = System::Drawing::Size(70, 20);
+			this->button4->TabIndex = 1;
+			this->button4->Text = L"clip";
+			this->button4->UseVisualStyleBackColor = true;
+			this->button4->Click += gcnew System::EventHandler(this, &MyForm::button4_Click);
+			// 
+			// button5
+			//
+			this->button5->Location = System::Drawing::Point(23, liveStreamHeight + 89);
+			this->button5->Name = L"button5";
+			this->button5->Size = System::Drawing::Size(70, 20);
+			this->button5->TabIndex = 1;
+			this->button5->Text = L"plate";
+			this->button5->UseVisualStyleBackColor = true;
+			this->button5->Click += gcnew System::EventHandler(this, &MyForm::button5_Click);
+			// 
 			// pictureBox1
 			// 
 			this->pictureBox1->Location = System::Drawing::Point(offsetScreenX / 2 - 10, 27);
@@ -681,6 +729,42 @@ namespace GreenScreen {
 			this->checkBox1->Text = L"Allow Print";
 			this->checkBox1->UseVisualStyleBackColor = true;
 			this->checkBox1->CheckedChanged += gcnew System::EventHandler(this, &MyForm::checkBox1_CheckedChanged);
+			//
+			// checkBox2
+			//
+			this->checkBox2->AutoSize = true;
+			this->checkBox2->Checked = false;
+			this->checkBox2->Location = System::Drawing::Point(230 + 75, liveStreamHeight + 91);
+			this->checkBox2->Name = L"checkBox2";
+			this->checkBox2->Size = System::Drawing::Size(75, 17);
+			this->checkBox2->TabIndex = 3;
+			this->checkBox2->Text = L"Clip mode";
+			this->checkBox2->UseVisualStyleBackColor = true;
+			this->checkBox2->CheckedChanged += gcnew System::EventHandler(this, &MyForm::checkBox2_CheckedChanged);
+			//
+			// checkBox3
+			//
+			this->checkBox3->AutoSize = true;
+			this->checkBox3->Checked = keyingMode == keyModeCleanPlate;
+			this->checkBox3->Location = System::Drawing::Point(23 + 75, liveStreamHeight + 91);
+			this->checkBox3->Name = L"checkBox3";
+			this->checkBox3->Size = System::Drawing::Size(80, 17);
+			this->checkBox3->TabIndex = 3;
+			this->checkBox3->Text = L"Clean plate";
+			this->checkBox3->UseVisualStyleBackColor = true;
+			this->checkBox3->CheckedChanged += gcnew System::EventHandler(this, &MyForm::checkBox3_CheckedChanged);
+			//
+			// checkBox4
+			//
+			this->checkBox4->AutoSize = true;
+			this->checkBox4->Checked = false;
+			this->checkBox4->Location = System::Drawing::Point(23, liveStreamHeight + 71);
+			this->checkBox4->Name = L"checkBox4";
+			this->checkBox4->Size = System::Drawing::Size(55, 17);
+			this->checkBox4->TabIndex = 3;
+			this->checkBox4->Text = L"Burst";
+			this->checkBox4->UseVisualStyleBackColor = true;
+			this->checkBox4->CheckedChanged += gcnew System::EventHandler(this, &MyForm::checkBox4_CheckedChanged);
 			// 
 			// timer1
 			// 
@@ -696,86 +780,93 @@ namespace GreenScreen {
 			this->Controls->Add(this->button3);
 			this->Controls->Add(this->pictureBox1);
 			this->Controls->Add(this->checkBox1);
+			this->Controls->Add(this->button4);
+			this->Controls->Add(this->checkBox2);
+			this->Controls->Add(this->button5);
+			this->Controls->Add(this->checkBox3);
+			this->Controls->Add(this->checkBox4);
 			this->Controls->Add(this->hScrollBar1);
 			this->Controls->Add(this->hScrollBar2);
 			this->Controls->Add(this->hScrollBar3);
+			this->Controls->Add(this->hScrollBar4);
 			this->Text = L"Green Screen";
 			this->Padding = System::Windows::Forms::Padding(0);
 			this->AutoScaleMode = System::Windows::Forms::AutoScaleMode::Font;
 			(cli::safe_cast<System::ComponentModel::ISupportInitialize^>(this->pictureBox1))->EndInit();
 			this->ResumeLayout(false);
 
-			//INIALIZE ALL STUFF CAMERAS
-			//initialize Canon SDK
-			err = EdsInitializeSDK();
-			if (err == EDS_ERR_OK)
+			//pixel kernels for this cpu, --kernels scalar|sse2|avx2|avx512|neon forces one for testing
+			std::string kernelLog;
+			selectPixelKernels(toNativeString(commandLineValue("--kernels")), &kernelLog);
+			Console::WriteLine(gcnew System::String(kernelLog.c_str()));
+
+			//burst page layout, two cut strips of the shots or a grid of different shots
+			int requestedShots = 0;
+			if (Int32::TryParse(commandLineValue("--burst-shots"), requestedShots) && requestedShots > 1 && requestedShots <= 8)
 			{
-				isSDKLoaded = true;
+				burstShots = requestedShots;
 			}
+			isBurstGrid = commandLineValue("--burst-layout") == "grid";
 
-			if (err == EDS_ERR_OK)
+			//live frame time budget, --frame-budget ms and --live-fps, --governor off keeps the full quality
+			float frameBudget = 0;
+			int liveFps = 0;
+			if (!Int32::TryParse(commandLineValue("--live-fps"), liveFps) || liveFps <= 0 || liveFps > 60) liveFps = 30;
+			if (!Single::TryParse(commandLineValue("--frame-budget"), frameBudget) || frameBudget <= 0) frameBudget = 1000.0f / liveFps;
+			governor.configure(frameBudget, liveFps, commandLineValue("--governor") != "off");
+			this->timer1->Interval = governor.intervalMs();
+			Console::WriteLine("live governor: budget " + frameBudget + " ms, " + gcnew System::String(governor.describe().c_str()));
+
+			//INIALIZE ALL STUFF CAMERAS
+			if (isSimulated())
 			{
-				err = getFirstCamera(&camera);
+				cameraBackend = new SimulatedCamera();
+				printerBackend = new SimulatedPrinter();
 			}
-
-			// Set object event handler
-			if (err == EDS_ERR_OK)
+			else
 			{
-				err = EdsSetObjectEventHandler(camera, kEdsObjectEvent_All, handleObjectEvent, NULL);
+				cameraBackend = new EdsCamera();
+				printerBackend = new GdiPrinter();
 			}
 
 			//Open camera
-			if (err == EDS_ERR_OK)
+			if (cameraBackend->open())
 			{
-				err = EdsOpenSession(camera);
-				if (err == EDS_ERR_OK)
+				Console::WriteLine("access CANON success:   " + gcnew System::String(cameraBackend->name().c_str()));
+				isOpen = true;
+
+				//--raw shoots CR2/CR3, the print master is demosaiced from the sensor data instead of the camera jpeg
+				if (commandLineSwitch("--raw"))
 				{
-					const char* cdeviceName = getDeviceName(camera);
-					System::String^ deviceName;
-					deviceName = gcnew System::String(cdeviceName);
-					Console::WriteLine("access CANON success:   " + deviceName);
-					isOpen = true;
+					if (!isRawSupported())
+					{
+						Console::WriteLine("this build has no LibRaw, shooting jpeg");
+					}
+					else if (cameraBackend->setRawCapture(true))
+					{
+						Console::WriteLine("shooting RAW, " + gcnew System::String(rawDecoderInfo().c_str()));
+					}
+					else
+					{
+						Console::WriteLine("the camera did not take the RAW setting, shooting jpeg");
+					}
 				}
 			}
-			
-			// Set camera properties for save image
-			EdsInt32 saveTarget = kEdsSaveTo_Host;
-			err = EdsSetPropertyData(camera, kEdsPropID_SaveTo, 0, 4, &saveTarget);
-			EdsCapacity newCapacity = { 0x7FFFFFFF, 0x1000, 1 };
-			err = EdsSetCapacity(camera, newCapacity);
-
-			//Sleep(2000);
-			evfImage = NULL;
-			stream = NULL;
-			data = NULL;
-			size = 0;
-			isLiveStream = false;
-
-			// Start Live view  
-			// Get the output device for the live view image
-			EdsUInt32 device;
-			err = EdsGetPropertyData(camera, kEdsPropID_Evf_OutputDevice, 0, sizeof(device), &device);
-
-			// PC live view starts by setting the PC as the output device for the live view image. 
-			if (err == EDS_ERR_OK)
-			{
-				device |= kEdsEvfOutputDevice_PC;
-				err = EdsSetPropertyData(camera, kEdsPropID_Evf_OutputDevice, 0, sizeof(device), &device);
-			}
-
-			// Create memory stream
-			err = EdsCreateMemoryStream(0, &stream);
-			if (err == EDS_ERR_OK)
-			{
-				// Create EvfImageRef.
-				err = EdsCreateEvfImageRef(stream, &evfImage);
-			}
 
-			if (err == EDS_ERR_OK && isOpen) {
+			// Start Live view
+			if (isOpen && cameraBackend->startLiveView()) {
 				setRandomImageSet();
 				Sleep(2000);
 				isLiveStream = true;
 				Console::WriteLine("access to live view success");
+
+				//shared memory ring of the live composite, --share-live names it
+				System::String^ shareName = commandLineValue("--share-live");
+				if (shareName->Length == 0) shareName = "GreenScreenLive";
+				if (liveShare.open(toNativeString(shareName), liveStreamWidth, liveStreamHeight))
+				{
+					Console::WriteLine("live composite shared as: " + shareName);
+				}
 			}
 			else
 			{
@@ -790,19 +881,19 @@ namespace GreenScreen {
 		private: System::Void button2_Click(System::Object^  sender, System::EventArgs^  e)
 		{
 			Console::WriteLine("Close connections...");
-			if (isOpen)
-			{
-				// End session and release SDK
-				EdsCloseSession(camera);
-				EdsTerminateSDK();
-			}
-			if (isLiveStream)
+			if (cameraBackend)
 			{
-				EdsRelease(stream);
-				stream = NULL;
-				EdsRelease(evfImage);
-				evfImage = NULL;
+				// End session, live view and release SDK
+				cameraBackend->close();
+				delete cameraBackend;
+				cameraBackend = NULL;
 			}
+			delete printerBackend;
+			printerBackend = NULL;
+			liveShare.close();
+			if (governor.histogram(liveStageTotal).frames > 0) Console::Write(gcnew System::String(governor.report().c_str()));
+			isOpen = false;
+			isLiveStream = false;
 			Application::Exit();
 		}
 
@@ -825,6 +916,130 @@ namespace GreenScreen {
 			}
 		}
 
+		//clip mode keeps the last live frames, the rings are only allocated the first time it is enabled
+		private: System::Void checkBox2_CheckedChanged(System::Object^  sender, System::EventArgs^  e)
+		{
+			isClipMode = checkBox2->Checked;
+			if (isClipMode && !clipRecorder.isConfigured() && liveStreamWidth > 0 && liveStreamHeight > 0)
+			{
+				clipRecorder.configure(liveStreamWidth, liveStreamHeight, clipFrames);
+			}
+			Console::WriteLine("clip mode is " + isClipMode);
+		}
+
+		private: System::Void button4_Click(System::Object^  sender, System::EventArgs^  e)
+		{
+			if (!isClipMode) return;
+			System::String^ clipFile = clipFolder + "/clip_" + DateTime::Now.ToString("yyyyMMdd_HHmmss") + clipExtension;
+			if (clipRecorder.encodeAsync(toNativeString(clipFile), governor.targetFps()))
+			{
+				Console::WriteLine("encoding clip: " + clipFile);
+			}
+			else
+			{
+				Console::WriteLine("clip not ready, still encoding or not enough frames");
+			}
+		}
+
+		//clean plate key for this booth, remembered in the save folder
+		private: System::Void checkBox3_CheckedChanged(System::Object^  sender, System::EventArgs^  e)
+		{
+			//off goes back to the person key when the booth was started with a segmentation model
+			keyingMode = checkBox3->Checked ? keyModeCleanPlate : (pipeline.personSegmenter().isLoaded() ? keyModePerson : keyModeColor);
+			if (Directory::Exists(savePath))
+			{
+				File::WriteAllText(keyModePath, gcnew System::String(keyingMode == keyModeCleanPlate ? "cleanplate" : "color"));
+			}
+			if (keyingMode == keyModeCleanPlate && !pipeline.cleanPlate().isReady())
+			{
+				Console::WriteLine("clean plate mode without a plate, the colour key is used until one is taken");
+			}
+			Console::WriteLine("clean plate mode is " + checkBox3->Checked);
+		}
+
+		//burst mode: the capture button takes burstShots pictures back to back and prints them on one page
+		private: System::Void checkBox4_CheckedChanged(System::Object^  sender, System::EventArgs^  e)
+		{
+			isBurstMode = checkBox4->Checked;
+			Console::WriteLine("burst mode is " + isBurstMode + ", " + burstShots + " shots as a " + gcnew System::String(isBurstGrid ? "grid" : "strip"));
+		}
+
+		stripLayout currentBurstLayout()
+		{
+			return isBurstGrid ? gridLayout(2, (burstShots + 1) / 2) : photoStripLayout(burstShots);
+		}
+
+		//all shots are on the page: save it like a single picture and print it once, on the print worker
+		//like a single shot, the tick picks up its result
+		void finishBurst()
+		{
+			captureRecord record;
+			memset(&record, 0, sizeof(record));
+			record.captureMs = elapsedMs(captureRequestTick);
+
+			Mat page;
+			burstTimings timings;
+			if (!burstComposer.finish(page, &timings))
+			{
+				Console::WriteLine("some burst shots could not be decoded, their cells are left blank");
+			}
+			record.composeMs = timings.waitMs;
+			Console::WriteLine("burst composed, slowest shot " + timings.slowestShotMs + " ms, waited " + timings.waitMs + " ms after the last download");
+
+			uint64_t saveNumber = nextSaveNumber();
+			printSavePath = savePath + "/green_" + saveNumber + ".png";
+			printJob job;
+			job.key = currentKeySettings();
+			job.isWideScreen = isWideScreen;
+			job.allowPrint = allowPrint;
+			job.paths.master = toNativeString(printSavePath);
+			job.paths.screen = toNativeString(screenFolder + "/green_" + saveNumber + ".jpg");
+			job.paths.thumb = toNativeString(thumbFolder + "/green_" + saveNumber + ".jpg");
+			record.sequence = saveNumber;
+			describeCapture(record, job.key);
+
+			//a capture never starts while a job runs, so the worker is free; if not, nothing is lost
+			if (printWorker.startPage(pipeline, page, job, printerBackend, record)) return;
+			Console::WriteLine("the print worker is busy, the burst page is written on the form thread");
+			if (!writePrintPage(page, job, printerBackend, pipeline.printArena(), record))
+			{
+				Console::WriteLine("some output of the burst could not be written!");
+			}
+			journalCapture(record);
+			isRequesting = false;
+		}
+
+		//the theme and key a job starts with, the form may change them while it runs
+		void describeCapture(captureRecord& record, const keySettings& key)
+		{
+			record.backgroundIndex = backgroundIndex;
+			record.foregroundIndex = foregroundIndex;
+			record.hueVar = key.hueVar;
+			record.saturationVar = key.saturationVar;
+			record.valueVar = key.valueVar;
+			record.xCoordSample = key.xCoordSample;
+			record.yCoordSample = key.yCoordSample;
+			record.keyMode = key.mode;
+			record.plateThreshold = key.plateThreshold;
+		}
+
+		//commit a saved capture to the journal
+		void journalCapture(captureRecord& record)
+		{
+			if (!journal.isOpen()) return;
+			record.timestamp = (int64_t)(DateTime::UtcNow - DateTime(1970, 1, 1)).TotalMilliseconds;
+			journal.append(record);
+		}
+
+		//learn the empty set: some live frames first, then one picture for the print model
+		private: System::Void button5_Click(System::Object^  sender, System::EventArgs^  e)
+		{
+			if (!isOpen || !isLiveStream || isRequesting || plateFramesLeft > 0) return;
+			pipeline.cleanPlate().reset();
+			plateFramesLeft = plateFrames;
+			Console::WriteLine("clean plate: keep the set empty...");
+		}
+
 		//get sample
 		private: System::Void pictureBox1_Click(System::Object^ sender, System::EventArgs^ e) {
 			System::Drawing::Point^	p = this->PointToClient(Control::MousePosition);
@@ -832,6 +1047,8 @@ namespace GreenScreen {
 			{
 				xCoordSample = p->X;
 				yCoordSample = p->Y;
+				sampleWidth = liveStreamWidth;
+				sampleHeight = liveStreamHeight;
 				Console::WriteLine("Get Sample at:  " + p);
 			}
 
@@ -846,6 +1063,11 @@ namespace GreenScreen {
 			Console::WriteLine("new saturation value at: " + hScrollBar1->Value);
 		}
 
+		private: System::Void hScrollBar4_Scroll(System::Object^  sender, System::Windows::Forms::ScrollEventArgs^  e) {
+			plateThreshold = hScrollBar4->Value / 10.0f;
+			Console::WriteLine("new plate threshold at: " + plateThreshold);
+		}
+
 		private: System::Void hScrollBar3_Scroll(System::Object^  sender, System::Windows::Forms::ScrollEventArgs^  e) {
 			valueVar = hScrollBar3->Value;
 			Console::WriteLine("new value at: " + hScrollBar1->Value);
@@ -853,172 +1075,236 @@ namespace GreenScreen {
 
 		private: System::Void button1_Click(System::Object^  sender, System::EventArgs^  e)
 		{
-			if (isOpen && Directory::Exists(tmpPath) && !isRequesting)
+			if (isOpen && !isRequesting && plateFramesLeft == 0)
 			{
-				System::String^ newFile = tmpPath + "/temporal.jpg";
-				char* out = (char*)(void*)Marshal::StringToHGlobalAnsi(newFile);
-				fileName = out;
-				//take picture with canon
+				//a burst starts with an empty page, every shot is composed on it as soon as it is downloaded
+				if (isBurstMode && !burstComposer.begin(currentBurstLayout(), currentKeySettings(), background, foreground, &pipeline.personSegmenter(), &themeLayers))
+				{
+					Console::WriteLine("burst could not start, check the theme");
+					return;
+				}
+
+				//take picture with canon, it is downloaded to memory
 				Console::WriteLine("Request for picture...");
-				EdsSendCommand(camera, kEdsCameraCommand_TakePicture, 0);
-				//begin request for print in tick
-				isRequesting = true;
+				if (cameraBackend->takePicture())
+				{
+					//begin request for print in tick
+					captureRequestTick = getTickCount();
+					isRequesting = true;
+				}
+				else if (isBurstMode)
+				{
+					burstComposer.cancel();
+				}
+			}
+		}
+
+		//copy a live sized BGR frame to the back display bitmap and show it
+		void showFrame(const Mat& frame)
+		{
+			Bitmap^ result = nextLiveBitmap();
+			System::Drawing::Imaging::BitmapData^ locked = result->LockBits(System::Drawing::Rectangle(0, 0, liveStreamWidth, liveStreamHeight), System::Drawing::Imaging::ImageLockMode::WriteOnly, result->PixelFormat);
+			for (int y = 0; y < liveStreamHeight; y++)
+			{
+				unsigned char* ptr = reinterpret_cast<unsigned char*>((locked->Scan0 + y * locked->Stride).ToPointer());
+				memcpy(ptr, frame.ptr<uchar>(y), liveStreamWidth * 3);
 			}
+			result->UnlockBits(locked);
+
+			this->pictureBox1->Image = result;
+			this->pictureBox1->Refresh();
 		}
 
 				 // tick 
 		private: System::Void timer1_Tick(System::Object^  sender, System::EventArgs^  e) {
+				//CLIPS****************************
+			clipResult clip;
+			if (clipRecorder.takeResult(clip))
+			{
+				System::String^ clipPath = gcnew System::String(clip.path.c_str());
+				if (clip.ok)
+				{
+					Console::WriteLine("clip saved at: " + clipPath + " frames: " + clip.frames + " encode: " + clip.encodeMs + " ms size: " + (clip.bytes / 1024) + " KB");
+				}
+				else
+				{
+					Console::WriteLine("clip encode failed: " + clipPath + ", check the encoder is installed");
+				}
+			}
+
 				//PRINTING*************************
-			if (isRequesting)
+			if (isRequesting && isPlateRequest && cameraBackend->pollPicture(pictureBuffer))
 			{
-				if (File::Exists(tmpPath + "/temporal.jpg"))
+				if (pipeline.learnPrintPlate(&pictureBuffer[0], pictureBuffer.size(), isWideScreen) && pipeline.cleanPlate().save(toNativeString(savePath)))
 				{
-					System::String^ loadtmp = tmpPath + "/temporal.jpg";
-					char* tempFilePath = (char*)(void*)Marshal::StringToHGlobalAnsi(loadtmp);
-					Mat pic = imread(tempFilePath);
-					if (!pic.empty())
-					{
-						int printWidth = pic.cols;
-						int printHeight = pic.rows;
-						Mat roiPrint;
-						if (isWideScreen)
-						{
-							printWidth = pic.cols;
-							printHeight = pic.rows;
-							resize(background, background, cv::Size(printWidth, printHeight));
-							resize(foreground, foreground, cv::Size(printWidth, printHeight));
-							roiPrint = pic;
-						}
-						else
-						{
-							//int newWidth = decoded.cols * (decoded.rows / (liveStreamHeight * 1.00f));
-							printWidth = pic.rows;
-							printHeight = pic.cols;
-							resize(background, background, cv::Size(printWidth, printHeight));
-							resize(foreground, foreground, cv::Size(printWidth, printHeight));
-							int newWidth = printHeight * (printHeight / (printWidth * 1.00f));
-							resize(pic, pic, cv::Size(newWidth, printHeight));
-							roiPrint = pic(cv::Rect((newWidth - printWidth) *.5f, 0, printWidth, printHeight));
-						}
+					Console::WriteLine("clean plate ready");
+				}
+				else
+				{
+					Console::WriteLine("clean plate failed, take it again");
+				}
+				isPlateRequest = false;
+				isRequesting = false;
+			}
+			else if (isRequesting && burstComposer.isActive() && cameraBackend->pollPicture(pictureBuffer))
+			{
+				//hand the shot to a worker and fire the next one while it is composed
+				burstComposer.addShot(pictureBuffer);
+				Console::WriteLine("burst shot " + burstComposer.received() + " of " + burstComposer.shots() + " downloaded");
+				if (burstComposer.received() < burstComposer.shots() && cameraBackend->takePicture())
+				{
+					return;
+				}
+				finishBurst();
+			}
+			else if (isRequesting && !isPlateRequest && !burstComposer.isActive() && !printWorker.isBusy() && cameraBackend->pollPicture(pictureBuffer))
+			{
+				captureRecord record;
+				memset(&record, 0, sizeof(record));
+				record.captureMs = elapsedMs(captureRequestTick);
 
-						//compute chromaKey
-						chromaKey(roiPrint, false);
+				isRawPrint = isRawPicture(&pictureBuffer[0], pictureBuffer.size());
+				if (isRawPrint && !isRawSupported())
+				{
+					Console::WriteLine("RAW picture but this build has no LibRaw!");
+					isRequesting = false;
+					return;
+				}
 
-						//add foreground
-						Mat output;
-						overlayImage(roiPrint, foreground, output, Point2i(0, 0));
+				//the keyed preview goes on screen now, from the preview the camera stored in the file when there is one,
+				//a RAW demosaic starts on a worker meanwhile
+				int64 previewTick = getTickCount();
+				pipeline.prefetchPrint(&pictureBuffer[0], pictureBuffer.size());
+				Mat preview;
+				if (pipeline.composePreview(&pictureBuffer[0], pictureBuffer.size(), currentKeySettings(), backgroundLive, foregroundLive, liveStreamWidth, liveStreamHeight, isWideScreen, preview, &themeLayers))
+				{
+					showFrame(preview);
+					Console::WriteLine("preview from " + gcnew System::String(pipeline.lastPreviewSource()) + " on screen in " + elapsedMs(previewTick) + " ms (decode " + pipeline.lastPreviewDecodeMs() + " ms)");
+				}
 
-						//rotate image if wide
-						if (isWideScreen)
-						{
-							resize(output, output, cv::Size(printWidth, printWidth));
-							Mat rotateImg;
-							Mat dst;
-							Point2f pt(output.cols / 2, output.rows / 2);
-							Mat r = getRotationMatrix2D(pt, 90, 1.0);
-							warpAffine(output, rotateImg, r, cv::Size(output.cols, output.cols));
-							resize(rotateImg, rotateImg, cv::Size(printHeight, printWidth));
-							output = rotateImg;
-						}
+				uint64_t saveNumber = nextSaveNumber();
+				printSavePath = savePath + "/green_" + saveNumber + ".png";
+				printJob job;
+				job.key = currentKeySettings();
+				job.isWideScreen = isWideScreen;
+				job.allowPrint = allowPrint;
+				//master, screen and thumbnail from the same composite
+				job.paths.master = toNativeString(printSavePath);
+				job.paths.screen = toNativeString(screenFolder + "/green_" + saveNumber + ".jpg");
+				job.paths.thumb = toNativeString(thumbFolder + "/green_" + saveNumber + ".jpg");
+				job.layers = themeLayers;
+				record.sequence = saveNumber;
+				describeCapture(record, job.key);
+
+				//the full size job renders on the print worker, the tick picks up its result
+				printBackgroundSource = background.data;
+				printForegroundSource = foreground.data;
+				printWorker.start(pipeline, pictureBuffer, job, background, foreground, printerBackend, record);
+			}
 
-						//save image
-						saveIncremental++;
-						System::String^ saveNewPic = savePath + "/green_" + saveIncremental + ".png";
-						char* fileWrite = (char*)(void*)Marshal::StringToHGlobalAnsi(saveNewPic);
-						imwrite(fileWrite, output);
-						Console::WriteLine("new image save at: " + saveNewPic);
+			printResult finished;
+			if (printWorker.takeResult(finished))
+			{
+				captureRecord& record = finished.record;
+				if (finished.ok)
+				{
+					if (!finished.written)
+					{
+						Console::WriteLine("some output of the picture could not be written!");
+					}
+					Console::WriteLine(gcnew System::String(finished.isPage ? "new burst page save at: " : "new image save at: ") + printSavePath + " (compose " + record.composeMs + " ms, downscale " + finished.timings.downscaleMs + " ms, encode " + finished.timings.encodeMs + " ms)");
+					if (isRawPrint && !finished.isPage)
+					{
+						Console::WriteLine("RAW full size decode " + pipeline.rawDecoder().fullMs() + " ms, " + pipeline.rawDecoder().fullCores().ToString("0.0") +
+							" cores busy, OpenMP allows " + rawDecodeThreads() + " threads");
+					}
+					if (finished.printed)
+					{
+						Console::WriteLine("printing!");
+					}
 
-						if (allowPrint)
-						{
-							printInPrinter(output);
-							Console::WriteLine("printing!");
-						}
+					journalCapture(record);
 
-					}
-					isRequesting = false;
+					//keep the theme at print size unless it was changed while the job ran
+					if (!finished.isPage && background.data == printBackgroundSource) background = finished.background;
+					if (!finished.isPage && foreground.data == printForegroundSource) foreground = finished.foreground;
+
+					const arenaCounters& printCounters = pipeline.printArena().counters();
+					Console::WriteLine("print arena: " + (printCounters.peakBytes >> 20) + " MB peak, " + printCounters.blockAllocations + " arena block allocations in total");
 				}
+				else
+				{
+					Console::WriteLine("the picture could not be decoded!");
+				}
+				isRequesting = false;
 			}
-				
+
 			try
 			{
 				//LIVE STREAM**********************
 				if (isOpen && isLiveStream && !isRequesting)
 				{
 					// Download live view image data.
-					err = EdsDownloadEvfImage(camera, evfImage);
-					if (err != EDS_ERR_OK)
+					const unsigned char* data = NULL;
+					size_t size = 0;
+					int64_t downloadUs = liveShareClockUs();
+					int64 liveTick = getTickCount();
+					liveFrameCosts costs;
+					if (cameraBackend->downloadLiveView(data, size))
 					{
-						return;
-					}
-
-					// Get Pointer of evfStream
-					err = EdsGetPointer(stream, (EdsVoid**)& data);
-					if (err != EDS_ERR_OK) {
-						Console::WriteLine("Download Live View Image Error in Function EdsGetPointer: ");
-						return;
-					}
-
-					// Get Length of evfStream
-					err = EdsGetLength(stream, &size);
-					if (err != EDS_ERR_OK) {
-						Console::WriteLine("Download Live View Image Error in Function EdsGetLength: ");
-						return;
-					}
-
-					// Get image data array size
-					EdsSize imageSize;
-					err = EdsGetPropertyData(evfImage, kEdsPropID_Evf_CoordinateSystem, 0, sizeof(imageSize), &imageSize);
-					if (err == EDS_ERR_OK)
-					{
-
-						//pass raw data to opencv
-						Mat buffer = Mat(1, size, CV_8UC1, data);
-						Mat decoded = imdecode(buffer, CV_LOAD_IMAGE_COLOR);
+						costs.ms[liveStageDownload] = elapsedMs(liveTick);
 
-						if (!buffer.empty())
+						//clean plate frames are learned before they are keyed
+						if (plateFramesLeft > 0)
 						{
-							Mat resultMat;
-							int streamWidth = decoded.cols;
-							int streamHeight = decoded.rows;
-
-							Mat roi;
-							if (isWideScreen)
+							pipeline.learnLivePlate(data, size, liveStreamWidth, liveStreamHeight, isWideScreen);
+							plateFramesLeft--;
+							if (plateFramesLeft == 0 && pipeline.cleanPlate().finishLive() && cameraBackend->takePicture())
 							{
-								resize(decoded, decoded, cv::Size(liveStreamWidth, liveStreamHeight));
-								roi = decoded;
+								isPlateRequest = true;
+								isRequesting = true;
 							}
-							else
+						}
+
+						//decode, key and compose on the pipeline arena, at the quality the governor allows
+						Mat resultMat;
+						liveQuality quality = governor.quality();
+						liveTimings timings;
+						if (pipeline.composeLive(data, size, currentKeySettings(), backgroundLive, foregroundLive, liveStreamWidth, liveStreamHeight, isWideScreen, resultMat, &quality, &timings, &themeLayers))
+						{
+							int64 displayTick = getTickCount();
+							if (isClipMode) clipRecorder.push(resultMat);
+							if (liveShare.isOpen()) liveShare.publish(resultMat.data, resultMat.cols, resultMat.rows, (int)resultMat.step, liveShareBGR24, downloadUs);
+
+							showFrame(resultMat);
+
+							costs.ms[liveStageDecode] = timings.decodeMs;
+							costs.ms[liveStageKey] = timings.keyMs;
+							costs.ms[liveStageCompose] = timings.composeMs;
+							costs.ms[liveStageDisplay] = elapsedMs(displayTick);
+							costs.ms[liveStageTotal] = elapsedMs(liveTick);
+							bool isGovernorChanged = governor.frameDone(costs);
+							if (this->timer1->Interval != governor.intervalMs()) this->timer1->Interval = governor.intervalMs();
+							if (isGovernorChanged)
 							{
-								int newWidth = decoded.cols * (decoded.rows / (liveStreamHeight * 1.00f));
-								resize(decoded, decoded, cv::Size(newWidth, liveStreamHeight));
-								roi = decoded(cv::Rect((newWidth - liveStreamWidth) *.5f, 0, liveStreamWidth, liveStreamHeight));
+								Console::WriteLine("live governor: " + gcnew System::String(governor.describe().c_str()) + ", tick " + this->timer1->Interval + " ms");
 							}
 
-							// compute the chroma key for green color at default sample x,y (10,10)							
-							chromaKey(roi, true);
-
-							//add foreground;
-							overlayImage(roi, foregroundLive, resultMat, Point2i(0, 0));
-
-							System::Drawing::Imaging::PixelFormat fmt = System::Drawing::Imaging::PixelFormat::Format24bppRgb;
-							Bitmap^ result = gcnew Bitmap(liveStreamWidth, liveStreamHeight, fmt);
-							System::Drawing::Imaging::BitmapData^ data = result->LockBits(System::Drawing::Rectangle(0, 0, liveStreamWidth, liveStreamHeight), System::Drawing::Imaging::ImageLockMode::ReadOnly, fmt);
-							for (int y = 0; y < liveStreamHeight; y++)
+							//the arena stops taking blocks once live view is warm, report it every ~30 seconds;
+							//opencv's own buffers (imdecode, dilate, blur, remap) are not counted here, the soak harness counts them
+							liveFrameCount++;
+							if (liveFrameCount % 900 == 0)
 							{
-								unsigned char* ptr = reinterpret_cast<unsigned char*>((data->Scan0 + y * data->Stride).ToPointer());
-								for (int x = 0; x < liveStreamWidth; x++)
+								const arenaCounters& liveCounters = pipeline.liveArena().counters();
+								Console::WriteLine("live arena: " + (liveCounters.blockAllocations - liveAllocationsReported) + " arena block allocations in the last 900 frames, " + (liveCounters.bytesReserved >> 10) + " KB reserved");
+								liveAllocationsReported = liveCounters.blockAllocations;
+								Console::Write(gcnew System::String(governor.report().c_str()));
+								if (pipeline.personSegmenter().isLoaded())
 								{
-									Vec3b px = resultMat.at<Vec3b>(cv::Point(x, y));
-									ptr[0] = px[0];
-									ptr[1] = px[1];
-									ptr[2] = px[2];
-									ptr += 3;
+									const PersonSegmenter& segmenter = pipeline.personSegmenter();
+									Console::WriteLine("person matte: " + segmenter.inferences() + " inferences, last " + segmenter.lastInferenceMs() + " ms, " + segmenter.dropped() + " frames replaced before inference");
 								}
 							}
-							result->UnlockBits(data);
-
-							this->pictureBox1->Image = result;
-							this->pictureBox1->Refresh();
 						}
 					}
 				}
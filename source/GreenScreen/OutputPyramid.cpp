@@ -0,0 +1,121 @@
+/*
+* OutputPyramid.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "OutputPyramid.h"
+#include <vector>
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	static float msSince(int64 startTick)
+	{
+		return (float)((getTickCount() - startTick) * 1000.0 / getTickFrequency());
+	}
+
+	//scale so the longest edge is at most longEdge, never upscale
+	static void areaDownscale(const Mat& source, Mat& out, int longEdge, FrameArena* arena)
+	{
+		int longest = source.cols > source.rows ? source.cols : source.rows;
+		if (longEdge <= 0 || longest <= longEdge)
+		{
+			out = source;
+			return;
+		}
+		double scale = longEdge / (double)longest;
+		cv::Size size(cvRound(source.cols * scale), cvRound(source.rows * scale));
+		if (arena) out = arena->acquire(size, source.type());
+		resize(source, out, size, 0, 0, INTER_AREA);
+	}
+
+	//one encode job per pyramid level
+	struct pyramidLevel
+	{
+		const Mat* image;
+		const std::string* path;
+		std::vector<int> params;
+		bool written;
+	};
+
+	class pyramidEncoder : public ParallelLoopBody
+	{
+	public:
+		pyramidEncoder(std::vector<pyramidLevel>& levels) : levels(levels) {}
+
+		void operator()(const Range& range) const
+		{
+			for (int i = range.start; i < range.end; i++)
+			{
+				pyramidLevel& level = levels[i];
+				try
+				{
+					level.written = imwrite(*level.path, *level.image, level.params);
+				}
+				catch (...)
+				{
+					level.written = false;
+				}
+			}
+		}
+
+	private:
+		std::vector<pyramidLevel>& levels;
+	};
+
+	bool writeOutputPyramid(const Mat& composite, const pyramidPaths& paths, const pyramidOptions& options, pyramidTimings* timings, FrameArena* arena)
+	{
+		if (composite.empty()) return false;
+
+		//master -> screen -> thumb, each level averages the one above so the thumb never touches 18 MP
+		int64 tick = getTickCount();
+		Mat screen, thumb;
+		areaDownscale(composite, screen, options.screenLongEdge, arena);
+		areaDownscale(screen, thumb, options.thumbLongEdge, arena);
+		if (timings) timings->downscaleMs = msSince(tick);
+
+		std::vector<pyramidLevel> levels;
+		if (!paths.master.empty())
+		{
+			pyramidLevel level = { &composite, &paths.master, std::vector<int>(), false };
+			levels.push_back(level);
+		}
+		if (!paths.screen.empty())
+		{
+			pyramidLevel level = { &screen, &paths.screen, std::vector<int>(), false };
+			level.params.push_back(IMWRITE_JPEG_QUALITY);
+			level.params.push_back(options.screenQuality);
+			levels.push_back(level);
+		}
+		if (!paths.thumb.empty())
+		{
+			pyramidLevel level = { &thumb, &paths.thumb, std::vector<int>(), false };
+			level.params.push_back(IMWRITE_JPEG_QUALITY);
+			level.params.push_back(options.thumbQuality);
+			levels.push_back(level);
+		}
+
+		tick = getTickCount();
+		parallel_for_(Range(0, (int)levels.size()), pyramidEncoder(levels));
+		if (timings) timings->encodeMs = msSince(tick);
+
+		bool ok = true;
+		for (size_t i = 0; i < levels.size(); i++)
+		{
+			ok = ok && levels[i].written;
+		}
+		return ok;
+	}
+}
@@ -0,0 +1,54 @@
+/*
+* OutputPyramid.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "FrameArena.h"
+#include <string>
+
+namespace GreenScreen {
+
+	//where each level of a capture goes, an empty path skips that level
+	struct pyramidPaths
+	{
+		std::string master;		//full size png, this is the print master
+		std::string screen;		//jpeg for review screens
+		std::string thumb;		//jpeg for galleries
+	};
+
+	struct pyramidOptions
+	{
+		int screenLongEdge;
+		int thumbLongEdge;
+		int screenQuality;
+		int thumbQuality;
+
+		pyramidOptions() : screenLongEdge(1600), thumbLongEdge(320), screenQuality(90), thumbQuality(80) {}
+	};
+
+	struct pyramidTimings
+	{
+		float downscaleMs;
+		float encodeMs;		//wall time of the parallel encode, not the sum of the three
+	};
+
+	//write the print master, screen and thumbnail of one composite
+	//the smaller levels are area averaged from the level above, then the three files are encoded in parallel
+	//the screen and thumbnail buffers come from arena when one is given
+	//returns false if any of the requested files could not be written
+	bool writeOutputPyramid(const cv::Mat& composite, const pyramidPaths& paths,
+		const pyramidOptions& options = pyramidOptions(), pyramidTimings* timings = NULL, FrameArena* arena = NULL);
+}
@@ -0,0 +1,609 @@
+/*
+* PersonSegmenter.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "PersonSegmenter.h"
+#include <algorithm>
+#include <condition_variable>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//ONNX Runtime runs the model when GREENSCREEN_ONNXRUNTIME is defined, see the Release|Win32 settings of the project
+//(onnxruntime.dll next to the exe), the tools add -DGREENSCREEN_ONNXRUNTIME -I<onnxruntime>/include -L<onnxruntime>/lib -lonnxruntime
+//its C API, the C++ wrapper does not build with the v140 toolset of the project
+//without it the dnn module of an opencv 3.4 or newer, the opencv 3.0 of the project has none
+#if defined(GREENSCREEN_ONNXRUNTIME)
+#define SEGMENTER_HAS_ORT
+#include "onnxruntime_c_api.h"
+#elif CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 4)
+#define SEGMENTER_HAS_DNN
+#include "opencv2/dnn.hpp"
+#endif
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	static float msSince(int64 start)
+	{
+		return (float)((getTickCount() - start) * 1000.0 / getTickFrequency());
+	}
+
+	segmentationModel selfieSegmentationModel(const std::string& path, cv::Size input)
+	{
+		segmentationModel model;
+		model.path = path;
+		model.input = input;
+		model.scale = 1.0 / 255;
+		model.mean = Scalar(0, 0, 0);
+		model.swapRB = true;
+		model.personChannel = 0;
+		model.threads = 0;
+		return model;
+	}
+
+#ifdef SEGMENTER_HAS_ORT
+	static const OrtApi* ortApi()
+	{
+		static const OrtApi* api = OrtGetApiBase()->GetApi(ORT_API_VERSION);
+		return api;
+	}
+
+	//one environment for the process, its thread pools belong to the sessions
+	static OrtEnv* ortEnv()
+	{
+		static OrtEnv* env = NULL;
+		static std::once_flag created;
+		std::call_once(created, []()
+		{
+			if (ortApi() && ortApi()->CreateEnv(ORT_LOGGING_LEVEL_WARNING, "GreenScreen", &env) != NULL) env = NULL;
+		});
+		return env;
+	}
+
+	//false on an error status, which is released
+	static bool ortOk(OrtStatus* status)
+	{
+		if (status == NULL) return true;
+		ortApi()->ReleaseStatus(status);
+		return false;
+	}
+#endif
+
+	bool isSegmentationSupported()
+	{
+#if defined(SEGMENTER_HAS_ORT)
+		return ortApi() != NULL;
+#elif defined(SEGMENTER_HAS_DNN)
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	std::string segmentationBackend()
+	{
+#if defined(SEGMENTER_HAS_ORT)
+		return std::string("onnxruntime ") + OrtGetApiBase()->GetVersionString();
+#elif defined(SEGMENTER_HAS_DNN)
+		return "opencv dnn";
+#else
+		return "none";
+#endif
+	}
+
+	//the person channel of a network output as a CV_32FC1 plane, NCHW and NHWC outputs both occur in exported models
+	static bool personPlane(const Mat& out, int personChannel, Mat& matte)
+	{
+		if (out.empty() || out.depth() != CV_32F) return false;
+		if (out.dims == 2)
+		{
+			out.copyTo(matte);
+		}
+		else if (out.dims == 3)
+		{
+			Mat(out.size[1], out.size[2], CV_32FC1, (void*)out.ptr<float>(0)).copyTo(matte);
+		}
+		else if (out.dims == 4 && out.size[1] <= 4 && out.size[3] > 4)
+		{
+			int channel = std::min(personChannel, out.size[1] - 1);
+			Mat(out.size[2], out.size[3], CV_32FC1, (void*)out.ptr<float>(0, channel)).copyTo(matte);
+		}
+		else if (out.dims == 4)
+		{
+			int rows = out.size[1];
+			int cols = out.size[2];
+			int channels = out.size[3];
+			int channel = std::min(personChannel, channels - 1);
+			matte.create(rows, cols, CV_32FC1);
+			const float* source = out.ptr<float>(0);
+			for (int y = 0; y < rows; y++)
+			{
+				float* row = matte.ptr<float>(y);
+				for (int x = 0; x < cols; x++) row[x] = source[((size_t)y * cols + x) * channels + channel];
+			}
+		}
+		else
+		{
+			return false;
+		}
+
+		//probabilities, a model that ends in logits would need its sigmoid exported with it
+		cv::max(matte, 0.0, matte);
+		cv::min(matte, 1.0, matte);
+		return true;
+	}
+
+	struct PersonSegmenter::impl
+	{
+		segmentationModel model;
+		bool isLoaded;
+#if defined(SEGMENTER_HAS_ORT)
+		OrtSession* session;
+		OrtMemoryInfo* memory;
+		OrtValue* inputValue;		//wraps tensor, made once per model
+		std::string inputName;
+		std::string outputName;
+		bool isNHWC;				//exported from tensorflow, channels last
+		std::vector<float> tensor;
+		Mat sized;
+		Mat rgb;
+		Mat floats;
+#elif defined(SEGMENTER_HAS_DNN)
+		dnn::Net net;
+#endif
+		std::mutex netLock;			//the live thread and the print share one network
+
+		//live frames at model size: the caller fills staging, swaps it into pending, the worker swaps pending into working
+		std::thread worker;
+		std::mutex frameLock;
+		std::condition_variable frameReady;
+		Mat staging;
+		Mat pending;
+		Mat working;
+		bool hasPending;
+		bool isStopping;
+		unsigned int droppedFrames;
+
+		mutable std::mutex matteLock;
+		Mat matte;
+		bool hasMatte;
+		float inferenceMs;
+		unsigned int inferenceCount;
+
+		impl() : isLoaded(false), hasPending(false), isStopping(false), droppedFrames(0), hasMatte(false), inferenceMs(0), inferenceCount(0)
+		{
+#ifdef SEGMENTER_HAS_ORT
+			session = NULL;
+			memory = NULL;
+			inputValue = NULL;
+			isNHWC = false;
+#endif
+		}
+
+		~impl()
+		{
+			closeModel();
+		}
+
+#ifdef SEGMENTER_HAS_ORT
+		void closeModel()
+		{
+			if (inputValue) ortApi()->ReleaseValue(inputValue);
+			if (memory) ortApi()->ReleaseMemoryInfo(memory);
+			if (session) ortApi()->ReleaseSession(session);
+			inputValue = NULL;
+			memory = NULL;
+			session = NULL;
+		}
+
+		static bool tensorName(OrtSession* session, bool isInput, std::string& name)
+		{
+			OrtAllocator* allocator = NULL;
+			char* text = NULL;
+			if (!ortOk(ortApi()->GetAllocatorWithDefaultOptions(&allocator))) return false;
+			OrtStatus* status = isInput ? ortApi()->SessionGetInputName(session, 0, allocator, &text) : ortApi()->SessionGetOutputName(session, 0, allocator, &text);
+			if (!ortOk(status)) return false;
+			name = text;
+			ortApi()->AllocatorFree(allocator, text);
+			return true;
+		}
+
+		//session, names, layout and the input tensor of the model at path, the file is read here so the path is never wide
+		bool openModel(const segmentationModel& requested)
+		{
+			const OrtApi* ort = ortApi();
+			OrtEnv* env = ortEnv();
+			if (!ort || !env) return false;
+			std::ifstream file(requested.path.c_str(), std::ios::binary);
+			std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+			if (bytes.empty()) return false;
+
+			//every core but the one the form keys and shows the live view on
+			int threads = requested.threads > 0 ? requested.threads : std::max(1, (int)std::thread::hardware_concurrency() - 1);
+			OrtSessionOptions* options = NULL;
+			if (!ortOk(ort->CreateSessionOptions(&options))) return false;
+			bool ok = ortOk(ort->SetIntraOpNumThreads(options, threads)) && ortOk(ort->SetInterOpNumThreads(options, 1)) &&
+				ortOk(ort->SetSessionGraphOptimizationLevel(options, ORT_ENABLE_ALL)) &&
+				ortOk(ort->CreateSessionFromArray(env, &bytes[0], bytes.size(), options, &session));
+			ort->ReleaseSessionOptions(options);
+			if (!ok || !tensorName(session, true, inputName) || !tensorName(session, false, outputName)) return false;
+
+			//float, four dims, three channels first or last; a fixed size wins over the requested one
+			OrtTypeInfo* typeInfo = NULL;
+			if (!ortOk(ort->SessionGetInputTypeInfo(session, 0, &typeInfo))) return false;
+			const OrtTensorTypeAndShapeInfo* info = NULL;
+			ONNXTensorElementDataType type = ONNX_TENSOR_ELEMENT_DATA_TYPE_UNDEFINED;
+			size_t dims = 0;
+			int64_t shape[4] = { 0, 0, 0, 0 };
+			ok = ortOk(ort->CastTypeInfoToTensorInfo(typeInfo, &info)) && ortOk(ort->GetTensorElementType(info, &type)) &&
+				ortOk(ort->GetDimensionsCount(info, &dims)) && dims == 4 && ortOk(ort->GetDimensions(info, shape, 4));
+			ort->ReleaseTypeInfo(typeInfo);
+			if (!ok || type != ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT) return false;
+			isNHWC = shape[3] == 3 && shape[1] != 3;
+			if (!isNHWC && shape[1] != 3 && shape[1] > 0) return false;
+			int64_t fixedHeight = isNHWC ? shape[1] : shape[2];
+			int64_t fixedWidth = isNHWC ? shape[2] : shape[3];
+			model = requested;
+			if (fixedHeight > 0) model.input.height = (int)fixedHeight;
+			if (fixedWidth > 0) model.input.width = (int)fixedWidth;
+			model.threads = threads;
+
+			int64_t inputShape[4] = { 1, 3, model.input.height, model.input.width };
+			if (isNHWC)
+			{
+				inputShape[1] = model.input.height;
+				inputShape[2] = model.input.width;
+				inputShape[3] = 3;
+			}
+			tensor.assign((size_t)model.input.area() * 3, 0.0f);
+			return ortOk(ort->CreateCpuMemoryInfo(OrtArenaAllocator, OrtMemTypeDefault, &memory)) &&
+				ortOk(ort->CreateTensorWithDataAsOrtValue(memory, &tensor[0], tensor.size() * sizeof(float), inputShape, 4,
+				ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &inputValue));
+		}
+#else
+		void closeModel()
+		{
+		}
+#endif
+
+		bool run(const Mat& image, Mat& out)
+		{
+#if defined(SEGMENTER_HAS_ORT)
+			std::lock_guard<std::mutex> lock(netLock);
+			const OrtApi* ort = ortApi();
+
+			//what blobFromImage does, straight into the tensor: (pixel - mean) * scale after the channel swap
+			const Mat* source = &image;
+			if (image.size() != model.input)
+			{
+				resize(image, sized, model.input, 0, 0, INTER_AREA);
+				source = &sized;
+			}
+			if (model.swapRB)
+			{
+				cvtColor(*source, rgb, COLOR_BGR2RGB);
+				source = &rgb;
+			}
+			source->convertTo(floats, CV_32F, model.scale);
+			Scalar offset(model.mean[0] * model.scale, model.mean[1] * model.scale, model.mean[2] * model.scale);
+			if (offset[0] != 0 || offset[1] != 0 || offset[2] != 0) subtract(floats, offset, floats);
+			int rows = model.input.height;
+			int cols = model.input.width;
+			if (isNHWC)
+			{
+				Mat interleaved(rows, cols, CV_32FC3, &tensor[0]);
+				floats.copyTo(interleaved);
+			}
+			else
+			{
+				std::vector<Mat> planes;
+				for (int c = 0; c < 3; c++) planes.push_back(Mat(rows, cols, CV_32FC1, &tensor[(size_t)c * rows * cols]));
+				split(floats, planes);
+			}
+
+			const char* inputNames[1] = { inputName.c_str() };
+			const char* outputNames[1] = { outputName.c_str() };
+			const OrtValue* inputs[1] = { inputValue };
+			OrtValue* output = NULL;
+			if (!ortOk(ort->Run(session, NULL, inputNames, inputs, 1, outputNames, 1, &output))) return false;
+
+			//the output as a Mat header of its shape, personPlane copies the person channel out of it
+			float* data = NULL;
+			OrtTensorTypeAndShapeInfo* info = NULL;
+			size_t dims = 0;
+			int64_t shape[4] = { 0, 0, 0, 0 };
+			bool ok = ortOk(ort->GetTensorMutableData(output, (void**)&data)) && ortOk(ort->GetTensorTypeAndShape(output, &info)) &&
+				ortOk(ort->GetDimensionsCount(info, &dims)) && dims >= 2 && dims <= 4 && ortOk(ort->GetDimensions(info, shape, dims));
+			if (info) ort->ReleaseTensorTypeAndShapeInfo(info);
+			if (ok)
+			{
+				int sizes[4];
+				for (size_t i = 0; i < dims; i++) sizes[i] = (int)shape[i];
+				ok = personPlane(Mat((int)dims, sizes, CV_32F, data), model.personChannel, out);
+			}
+			ort->ReleaseValue(output);
+			return ok;
+#elif defined(SEGMENTER_HAS_DNN)
+			try
+			{
+				Mat blob = dnn::blobFromImage(image, model.scale, model.input, model.mean, model.swapRB, false);
+				Mat result;
+				{
+					std::lock_guard<std::mutex> lock(netLock);
+					net.setInput(blob);
+					result = net.forward();
+				}
+				return personPlane(result, model.personChannel, out);
+			}
+			catch (const cv::Exception&)
+			{
+				return false;
+			}
+#else
+			return false;
+#endif
+		}
+
+		void workerLoop()
+		{
+			Mat result;
+			while (true)
+			{
+				{
+					std::unique_lock<std::mutex> lock(frameLock);
+					frameReady.wait(lock, [this]() { return isStopping || hasPending; });
+					if (isStopping) return;
+					std::swap(pending, working);
+					hasPending = false;
+				}
+
+				int64 tick = getTickCount();
+				if (!run(working, result)) continue;
+				float ms = msSince(tick);
+
+				std::lock_guard<std::mutex> lock(matteLock);
+				std::swap(matte, result);
+				hasMatte = true;
+				inferenceMs = ms;
+				inferenceCount++;
+			}
+		}
+
+		void stopWorker()
+		{
+			{
+				std::lock_guard<std::mutex> lock(frameLock);
+				isStopping = true;
+				frameReady.notify_all();
+			}
+			if (worker.joinable()) worker.join();
+			isStopping = false;
+			hasPending = false;
+		}
+	};
+
+	PersonSegmenter::PersonSegmenter() : d(new impl())
+	{
+	}
+
+	PersonSegmenter::~PersonSegmenter()
+	{
+		d->stopWorker();
+		delete d;
+	}
+
+	bool PersonSegmenter::load(const segmentationModel& model)
+	{
+		d->stopWorker();
+		d->isLoaded = false;
+		{
+			std::lock_guard<std::mutex> lock(d->matteLock);
+			d->hasMatte = false;
+		}
+		if (model.input.area() <= 0) return false;
+#if defined(SEGMENTER_HAS_ORT)
+		d->closeModel();
+		if (!d->openModel(model))
+		{
+			d->closeModel();
+			return false;
+		}
+#elif defined(SEGMENTER_HAS_DNN)
+		try
+		{
+			d->net = dnn::readNet(model.path);
+		}
+		catch (const cv::Exception&)
+		{
+			return false;
+		}
+		if (d->net.empty()) return false;
+		d->model = model;
+#endif
+#if defined(SEGMENTER_HAS_ORT) || defined(SEGMENTER_HAS_DNN)
+		//one inference up front, the first live frames should not pay for the lazy setup of the layers
+		Mat warmUp(d->model.input, CV_8UC3, Scalar(0, 0, 0));
+		Mat unused;
+		if (!d->run(warmUp, unused)) return false;
+
+		d->isLoaded = true;
+		d->worker = std::thread(&impl::workerLoop, d);
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	bool PersonSegmenter::isLoaded() const
+	{
+		return d->isLoaded;
+	}
+
+	const segmentationModel& PersonSegmenter::model() const
+	{
+		return d->model;
+	}
+
+	void PersonSegmenter::submit(const Mat& frame)
+	{
+		if (!d->isLoaded || frame.empty()) return;
+
+		//the resize to model size is the only work done on the caller thread
+		resize(frame, d->staging, d->model.input, 0, 0, INTER_AREA);
+		std::lock_guard<std::mutex> lock(d->frameLock);
+		if (d->hasPending) d->droppedFrames++;
+		std::swap(d->staging, d->pending);
+		d->hasPending = true;
+		d->frameReady.notify_one();
+	}
+
+	bool PersonSegmenter::latestMatte(Mat& matte) const
+	{
+		std::lock_guard<std::mutex> lock(d->matteLock);
+		if (!d->hasMatte) return false;
+		d->matte.copyTo(matte);
+		return true;
+	}
+
+	bool PersonSegmenter::infer(const Mat& image, Mat& matte)
+	{
+		if (!d->isLoaded || image.empty()) return false;
+		return d->run(image, matte);
+	}
+
+	float PersonSegmenter::lastInferenceMs() const
+	{
+		std::lock_guard<std::mutex> lock(d->matteLock);
+		return d->inferenceMs;
+	}
+
+	unsigned int PersonSegmenter::inferences() const
+	{
+		std::lock_guard<std::mutex> lock(d->matteLock);
+		return d->inferenceCount;
+	}
+
+	unsigned int PersonSegmenter::dropped() const
+	{
+		std::lock_guard<std::mutex> lock(d->frameLock);
+		return d->droppedFrames;
+	}
+
+	void upsampleMatte(const Mat& matte, const Mat& guide, Mat& out, FrameArena& arena, int radius, float eps)
+	{
+		out = arena.acquire(guide.size(), CV_8UC1);
+		if (matte.empty() || guide.empty())
+		{
+			out.setTo(Scalar(255));
+			return;
+		}
+
+		size_t scratch = arena.mark();
+		Mat gray = arena.acquire(guide.size(), CV_8UC1);
+		cvtColor(guide, gray, COLOR_BGR2GRAY);
+
+		//the guide at matte size, both in 0..1
+		cv::Size low = matte.size();
+		Mat grayLow = arena.acquire(low, CV_8UC1);
+		resize(gray, grayLow, low, 0, 0, INTER_AREA);
+		Mat guideLow = arena.acquire(low, CV_32FC1);
+		grayLow.convertTo(guideLow, CV_32F, 1.0 / 255);
+
+		//local means of I, p, I*p and I*I over the window
+		cv::Size window(2 * radius + 1, 2 * radius + 1);
+		Mat products = arena.acquire(low, CV_32FC1);
+		Mat meanI = arena.acquire(low, CV_32FC1);
+		Mat meanP = arena.acquire(low, CV_32FC1);
+		Mat meanIp = arena.acquire(low, CV_32FC1);
+		Mat meanII = arena.acquire(low, CV_32FC1);
+		boxFilter(guideLow, meanI, CV_32F, window);
+		boxFilter(matte, meanP, CV_32F, window);
+		multiply(guideLow, matte, products);
+		boxFilter(products, meanIp, CV_32F, window);
+		multiply(guideLow, guideLow, products);
+		boxFilter(products, meanII, CV_32F, window);
+
+		//p ~ a * I + b in every window, eps keeps flat areas from following the noise
+		Mat a = arena.acquire(low, CV_32FC1);
+		Mat b = arena.acquire(low, CV_32FC1);
+		for (int y = 0; y < low.height; y++)
+		{
+			const float* mi = meanI.ptr<float>(y);
+			const float* mp = meanP.ptr<float>(y);
+			const float* mip = meanIp.ptr<float>(y);
+			const float* mii = meanII.ptr<float>(y);
+			float* ra = a.ptr<float>(y);
+			float* rb = b.ptr<float>(y);
+			for (int x = 0; x < low.width; x++)
+			{
+				float variance = mii[x] - mi[x] * mi[x];
+				float covariance = mip[x] - mi[x] * mp[x];
+				ra[x] = covariance / (variance + eps);
+				rb[x] = mp[x] - ra[x] * mi[x];
+			}
+		}
+		Mat meanA = arena.acquire(low, CV_32FC1);
+		Mat meanB = arena.acquire(low, CV_32FC1);
+		boxFilter(a, meanA, CV_32F, window);
+		boxFilter(b, meanB, CV_32F, window);
+
+		//bilinear a and b at full size applied to the full size guide, no full size float image is made
+		int width = guide.cols;
+		int height = guide.rows;
+		Mat columns = arena.acquire(1, width, CV_32SC1);
+		Mat columnWeights = arena.acquire(1, width, CV_32FC1);
+		int* x0 = columns.ptr<int>(0);
+		float* wx = columnWeights.ptr<float>(0);
+		float scaleX = low.width / (float)width;
+		float scaleY = low.height / (float)height;
+		for (int x = 0; x < width; x++)
+		{
+			float sx = std::max(0.0f, (x + 0.5f) * scaleX - 0.5f);
+			x0[x] = std::min((int)sx, low.width - 1);
+			wx[x] = x0[x] < low.width - 1 ? sx - x0[x] : 0.0f;
+		}
+		for (int y = 0; y < height; y++)
+		{
+			float sy = std::max(0.0f, (y + 0.5f) * scaleY - 0.5f);
+			int y0 = std::min((int)sy, low.height - 1);
+			int y1 = std::min(y0 + 1, low.height - 1);
+			float wy = sy - y0;
+			const float* a0 = meanA.ptr<float>(y0);
+			const float* a1 = meanA.ptr<float>(y1);
+			const float* b0 = meanB.ptr<float>(y0);
+			const float* b1 = meanB.ptr<float>(y1);
+			const uchar* g = gray.ptr<uchar>(y);
+			uchar* o = out.ptr<uchar>(y);
+			for (int x = 0; x < width; x++)
+			{
+				int c0 = x0[x];
+				int c1 = c0 + (wx[x] > 0 ? 1 : 0);
+				float top = a0[c0] + (a0[c1] - a0[c0]) * wx[x];
+				float bottom = a1[c0] + (a1[c1] - a1[c0]) * wx[x];
+				float ca = top + (bottom - top) * wy;
+				top = b0[c0] + (b0[c1] - b0[c0]) * wx[x];
+				bottom = b1[c0] + (b1[c1] - b1[c0]) * wx[x];
+				float cb = top + (bottom - top) * wy;
+				float q = ca * (g[x] * (1.0f / 255)) + cb;
+				o[x] = (uchar)std::max(0, std::min(255, (int)(q * 255 + 0.5f)));
+			}
+		}
+		arena.rewind(scratch);
+	}
+}
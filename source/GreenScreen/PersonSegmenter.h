@@ -0,0 +1,85 @@
+/*
+* PersonSegmenter.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include "FrameArena.h"
+#include <string>
+
+// included from the /clr form: the inference thread, the network and the locks are hidden in PersonSegmenter.cpp
+
+namespace GreenScreen {
+
+	//how a person segmentation model wants its input and where the person is in its output
+	struct segmentationModel
+	{
+		std::string path;		//onnx, NCHW or NHWC float input, with opencv dnn an int8 quantized model needs 4.6 or newer
+		cv::Size input;			//inference size, far below the live size, a model with a fixed size keeps its own
+		double scale;			//pixel multiplier after the mean is taken off
+		cv::Scalar mean;
+		bool swapRB;			//trained on RGB
+		int personChannel;		//channel of the person probability when the output has more than one
+		int threads;			//threads of one inference with ONNX Runtime, 0 takes every core but the form's
+	};
+
+	//selfie segmentation layout: 256x256 RGB in 0..1, one probability channel out
+	segmentationModel selfieSegmentationModel(const std::string& path, cv::Size input = cv::Size(256, 256));
+
+	//false when the build has neither ONNX Runtime nor an opencv with dnn, the person key falls back to the colour key
+	bool isSegmentationSupported();
+	//"onnxruntime 1.17.3", "opencv dnn" or "none", for the logs
+	std::string segmentationBackend();
+
+	//a matte for backdrops that are not green, from a small segmentation network on the cpu
+	//live frames are inferred on a thread of their own: the form decodes and shows the next frame
+	//while the network runs, every frame is keyed with the newest matte and a frame that arrives
+	//while one is still waiting replaces it, so the live view never waits for the network
+	class PersonSegmenter
+	{
+	public:
+		PersonSegmenter();
+		~PersonSegmenter();
+
+		bool load(const segmentationModel& model);
+		bool isLoaded() const;
+		const segmentationModel& model() const;
+
+		//live: hand a BGR frame over for inference and return at once, only a model sized copy is kept
+		void submit(const cv::Mat& frame);
+		//person probability of the newest finished inference at model size, CV_32FC1, false before the first
+		bool latestMatte(cv::Mat& matte) const;
+
+		//print: infer image on the calling thread, waits while the live thread uses the network
+		bool infer(const cv::Mat& image, cv::Mat& matte);
+
+		float lastInferenceMs() const;
+		unsigned int inferences() const;
+		unsigned int dropped() const;	//frames replaced before the network got to them
+
+	private:
+		struct impl;
+		impl* d;
+
+		PersonSegmenter(const PersonSegmenter&);
+		PersonSegmenter& operator=(const PersonSegmenter&);
+	};
+
+	//edge aware upsampling of a model sized matte to the size of guide with a fast guided filter:
+	//the linear coefficients are fitted at matte size against the guide brightness and applied at full size,
+	//so the edge follows the hair and the shoulders of the frame instead of the blocky network output
+	//out is CV_8UC1 at guide size, 255 keeps the pixel, allocated from arena
+	void upsampleMatte(const cv::Mat& matte, const cv::Mat& guide, cv::Mat& out, FrameArena& arena, int radius = 2, float eps = 0.001f);
+}
@@ -0,0 +1,190 @@
+/*
+* PixelKernels.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "PixelKernels.h"
+#include "opencv2/opencv.hpp"
+#include <cstdlib>
+
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+#include <intrin.h>
+#endif
+
+namespace GreenScreen {
+
+	void scalarReplaceMasked(unsigned char* dst, const unsigned char* background, const unsigned char* mask, int pixels)
+	{
+		for (int x = 0; x < pixels; x++)
+		{
+			if (mask[x] < 255)
+			{
+				dst[x * 3] = background[x * 3];
+				dst[x * 3 + 1] = background[x * 3 + 1];
+				dst[x * 3 + 2] = background[x * 3 + 2];
+			}
+		}
+	}
+
+	void scalarBlendOver(unsigned char* dst, const unsigned char* foreground, int pixels)
+	{
+		for (int x = 0; x < pixels; x++)
+		{
+			// determine the opacity of the foregrond pixel, using its fourth (alpha) channel.
+			const unsigned char* fgPx = foreground + x * 4;
+			int alpha = fgPx[3];
+
+			// but only if opacity > 0.
+			//integer and rounded, (f * a + b * (255 - a) + 127) / 255, what every simd variant computes too
+			for (int c = 0; alpha > 0 && c < 3; ++c)
+			{
+				unsigned char* outPx = dst + x * 3 + c;
+				*outPx = (unsigned char)((fgPx[c] * alpha + *outPx * (255 - alpha) + 127) / 255);
+			}
+		}
+	}
+
+	void scalarWeightedSquares(const unsigned char* values, const unsigned char* mean, const float* weight, float* out, int count)
+	{
+		for (int i = 0; i < count; i++)
+		{
+			float d = (float)values[i] - (float)mean[i];
+			out[i] = d * d * weight[i];
+		}
+	}
+
+	const pixelKernels& scalarKernels()
+	{
+		static const pixelKernels kernels = { "scalar", scalarReplaceMasked, scalarBlendOver, scalarWeightedSquares };
+		return kernels;
+	}
+
+	//what the cpu and the os support, the os has to save the wide registers for avx to be usable
+	struct cpuFeatures
+	{
+		bool sse2;
+		bool avx2;
+		bool avx512;
+		bool neon;
+	};
+
+	static cpuFeatures detectCpu()
+	{
+		cpuFeatures cpu = { false, false, false, false };
+#if defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+		int info[4];
+		__cpuid(info, 0);
+		int leaves = info[0];
+		__cpuid(info, 1);
+		cpu.sse2 = (info[3] & (1 << 26)) != 0;
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+		unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+		bool ymmSaved = (xcr0 & 0x6) == 0x6;
+		bool zmmSaved = (xcr0 & 0xE6) == 0xE6;
+		if (leaves >= 7)
+		{
+			__cpuidex(info, 7, 0);
+			cpu.avx2 = avx && ymmSaved && (info[1] & (1 << 5)) != 0;
+			//F for the basics, BW for the byte compares
+			cpu.avx512 = zmmSaved && (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+		}
+#elif defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+		__builtin_cpu_init();
+		cpu.sse2 = __builtin_cpu_supports("sse2") != 0;
+		cpu.avx2 = __builtin_cpu_supports("avx2") != 0;
+		cpu.avx512 = __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+#elif defined(__aarch64__) || defined(_M_ARM64)
+		//advanced simd is part of every armv8-a core
+		cpu.neon = true;
+#endif
+		return cpu;
+	}
+
+	static const cpuFeatures& cpu()
+	{
+		static const cpuFeatures features = detectCpu();
+		return features;
+	}
+
+	static const pixelKernels* kernelsByName(const std::string& name)
+	{
+		if (name == "scalar") return &scalarKernels();
+		if (name == "sse2") return cpu().sse2 ? sse2Kernels() : NULL;
+		if (name == "avx2") return cpu().avx2 ? avx2Kernels() : NULL;
+		if (name == "avx512") return cpu().avx512 ? avx512Kernels() : NULL;
+		if (name == "neon") return cpu().neon ? neonKernels() : NULL;
+		return NULL;
+	}
+
+	static const pixelKernels& fastestKernels()
+	{
+		const char* order[] = { "avx512", "avx2", "sse2", "neon" };
+		for (int i = 0; i < 4; i++)
+		{
+			const pixelKernels* kernels = kernelsByName(order[i]);
+			if (kernels) return *kernels;
+		}
+		return scalarKernels();
+	}
+
+	static const pixelKernels*& active()
+	{
+		static const pixelKernels* kernels = &fastestKernels();
+		return kernels;
+	}
+
+	const pixelKernels& activeKernels()
+	{
+		return *active();
+	}
+
+	std::string supportedKernelSets()
+	{
+		std::string out;
+		const char* names[] = { "sse2", "avx2", "avx512", "neon" };
+		for (int i = 0; i < 4; i++)
+		{
+			if (!kernelsByName(names[i])) continue;
+			if (!out.empty()) out += " ";
+			out += names[i];
+		}
+		return out.empty() ? "none" : out;
+	}
+
+	const pixelKernels& selectPixelKernels(const std::string& requested, std::string* log)
+	{
+		std::string wanted = requested;
+		const char* environment = getenv("GREENSCREEN_KERNELS");
+		if (wanted.empty() && environment) wanted = environment;
+
+		const pixelKernels* kernels = wanted.empty() ? &fastestKernels() : kernelsByName(wanted);
+		std::string note;
+		if (!kernels)
+		{
+			kernels = &fastestKernels();
+			note = ", " + wanted + " was requested but is not available";
+		}
+		active() = kernels;
+
+		//OpenCV dispatches its own colour conversion and resample code, scalar turns that off too
+		cv::setUseOptimized(kernels != &scalarKernels());
+
+		if (log)
+		{
+			*log = std::string("pixel kernels: ") + kernels->name + " (cpu supports: " + supportedKernelSets() + note + ")";
+		}
+		return *kernels;
+	}
+}
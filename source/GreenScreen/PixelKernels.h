@@ -0,0 +1,61 @@
+/*
+* PixelKernels.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include <string>
+
+namespace GreenScreen {
+
+	//the per pixel loops of the key and compositing, one set per instruction set
+	//every variant gives the same bytes as the scalar one, only faster
+	struct pixelKernels
+	{
+		const char* name;
+
+		//BGR pixels of dst where mask < 255 take the BGR pixel of background
+		void(*replaceMasked)(unsigned char* dst, const unsigned char* background, const unsigned char* mask, int pixels);
+
+		//blend BGRA foreground pixels over BGR dst pixels by the foreground alpha, (f * a + b * (255 - a) + 127) / 255
+		void(*blendOver)(unsigned char* dst, const unsigned char* foreground, int pixels);
+
+		//out[i] = (values[i] - mean[i])^2 * weight[i] over interleaved channel values
+		void(*weightedSquares)(const unsigned char* values, const unsigned char* mean, const float* weight, float* out, int count);
+	};
+
+	//pick the kernels for this cpu: the fastest it supports, or requested when it names a supported set
+	//requested is one of scalar, sse2, avx2, avx512, neon, empty means GREENSCREEN_KERNELS or else the fastest
+	//when requested is not supported the fastest is used and the log says so
+	//also switches the OpenCV optimizations off when scalar is requested, so a scalar run is scalar all the way
+	const pixelKernels& selectPixelKernels(const std::string& requested, std::string* log = NULL);
+
+	//the kernels in use, the fastest supported ones until selectPixelKernels is called
+	const pixelKernels& activeKernels();
+
+	//instruction sets of this cpu that a kernel set exists for, like "sse2 avx2"
+	std::string supportedKernelSets();
+
+	//the scalar loops, also the tails of the simd variants
+	void scalarReplaceMasked(unsigned char* dst, const unsigned char* background, const unsigned char* mask, int pixels);
+	void scalarBlendOver(unsigned char* dst, const unsigned char* foreground, int pixels);
+	void scalarWeightedSquares(const unsigned char* values, const unsigned char* mean, const float* weight, float* out, int count);
+
+	//the variants, a set not built for this compiler or architecture is NULL
+	const pixelKernels& scalarKernels();
+	const pixelKernels* sse2Kernels();
+	const pixelKernels* avx2Kernels();
+	const pixelKernels* avx512Kernels();
+	const pixelKernels* neonKernels();
+}
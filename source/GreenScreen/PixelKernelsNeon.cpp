@@ -0,0 +1,119 @@
+/*
+* PixelKernelsNeon.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+//neon kernels for arm64 booths, empty on every other architecture
+
+#include "PixelKernels.h"
+#include <cstddef>
+
+#if defined(__aarch64__) || defined(_M_ARM64)
+#define GREENSCREEN_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+namespace GreenScreen {
+
+#ifdef GREENSCREEN_NEON_KERNELS
+
+	//runs of 16 pixels, a run that is all subject or all background skips the per pixel test
+
+	static void neonReplaceMasked(unsigned char* dst, const unsigned char* background, const unsigned char* mask, int pixels)
+	{
+		int x = 0;
+		for (; x + 16 <= pixels; x += 16)
+		{
+			uint8x16_t m = vld1q_u8(mask + x);
+			if (vminvq_u8(m) == 255) continue;
+			if (vmaxvq_u8(m) < 255)
+			{
+				vst1q_u8(dst + x * 3, vld1q_u8(background + x * 3));
+				vst1q_u8(dst + x * 3 + 16, vld1q_u8(background + x * 3 + 16));
+				vst1q_u8(dst + x * 3 + 32, vld1q_u8(background + x * 3 + 32));
+				continue;
+			}
+			scalarReplaceMasked(dst + x * 3, background + x * 3, mask + x, 16);
+		}
+		scalarReplaceMasked(dst + x * 3, background + x * 3, mask + x, pixels - x);
+	}
+
+	//the scalar blend on one channel of 16 pixels, x / 255 is (x + 1 + (x >> 8)) >> 8 for every x it reaches
+	static uint8x16_t blendChannel(uint8x16_t foreground, uint8x16_t dst, uint8x16_t alpha, uint8x16_t inverse)
+	{
+		const uint16x8_t half = vdupq_n_u16(127);
+		const uint16x8_t one = vdupq_n_u16(1);
+		uint16x8_t low = vmlal_u8(vmlal_u8(half, vget_low_u8(foreground), vget_low_u8(alpha)), vget_low_u8(dst), vget_low_u8(inverse));
+		uint16x8_t high = vmlal_u8(vmlal_u8(half, vget_high_u8(foreground), vget_high_u8(alpha)), vget_high_u8(dst), vget_high_u8(inverse));
+		low = vaddq_u16(vaddq_u16(low, one), vshrq_n_u16(low, 8));
+		high = vaddq_u16(vaddq_u16(high, one), vshrq_n_u16(high, 8));
+		return vcombine_u8(vshrn_n_u16(low, 8), vshrn_n_u16(high, 8));
+	}
+
+	static void neonBlendOver(unsigned char* dst, const unsigned char* foreground, int pixels)
+	{
+		int x = 0;
+		for (; x + 16 <= pixels; x += 16)
+		{
+			uint8x16x4_t fg = vld4q_u8(foreground + x * 4);
+			if (vmaxvq_u8(fg.val[3]) == 0) continue;
+			if (vminvq_u8(fg.val[3]) == 255)
+			{
+				uint8x16x3_t out;
+				out.val[0] = fg.val[0];
+				out.val[1] = fg.val[1];
+				out.val[2] = fg.val[2];
+				vst3q_u8(dst + x * 3, out);
+				continue;
+			}
+			uint8x16x3_t out = vld3q_u8(dst + x * 3);
+			uint8x16_t inverse = vmvnq_u8(fg.val[3]);
+			out.val[0] = blendChannel(fg.val[0], out.val[0], fg.val[3], inverse);
+			out.val[1] = blendChannel(fg.val[1], out.val[1], fg.val[3], inverse);
+			out.val[2] = blendChannel(fg.val[2], out.val[2], fg.val[3], inverse);
+			vst3q_u8(dst + x * 3, out);
+		}
+		scalarBlendOver(dst + x * 3, foreground + x * 4, pixels - x);
+	}
+
+	static void neonWeightedSquares(const unsigned char* values, const unsigned char* mean, const float* weight, float* out, int count)
+	{
+		int i = 0;
+		for (; i + 16 <= count; i += 16)
+		{
+			uint8x16_t v = vld1q_u8(values + i);
+			uint8x16_t m = vld1q_u8(mean + i);
+			//the wrapped unsigned difference read as signed is the real difference
+			int16x8_t low = vreinterpretq_s16_u16(vsubl_u8(vget_low_u8(v), vget_low_u8(m)));
+			int16x8_t high = vreinterpretq_s16_u16(vsubl_u8(vget_high_u8(v), vget_high_u8(m)));
+			vst1q_f32(out + i, vmulq_f32(vcvtq_f32_s32(vmull_s16(vget_low_s16(low), vget_low_s16(low))), vld1q_f32(weight + i)));
+			vst1q_f32(out + i + 4, vmulq_f32(vcvtq_f32_s32(vmull_s16(vget_high_s16(low), vget_high_s16(low))), vld1q_f32(weight + i + 4)));
+			vst1q_f32(out + i + 8, vmulq_f32(vcvtq_f32_s32(vmull_s16(vget_low_s16(high), vget_low_s16(high))), vld1q_f32(weight + i + 8)));
+			vst1q_f32(out + i + 12, vmulq_f32(vcvtq_f32_s32(vmull_s16(vget_high_s16(high), vget_high_s16(high))), vld1q_f32(weight + i + 12)));
+		}
+		scalarWeightedSquares(values + i, mean + i, weight + i, out + i, count - i);
+	}
+
+	const pixelKernels* neonKernels()
+	{
+		static const pixelKernels kernels = { "neon", neonReplaceMasked, neonBlendOver, neonWeightedSquares };
+		return &kernels;
+	}
+
+#else
+
+	const pixelKernels* neonKernels() { return NULL; }
+
+#endif
+}
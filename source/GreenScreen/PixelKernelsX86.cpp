@@ -0,0 +1,359 @@
+/*
+* PixelKernelsX86.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+//sse2, avx2 and avx512 kernels, all in one generic build
+//msvc takes the intrinsics of any instruction set without /arch, gcc and clang get them per function
+//only activeKernels() decides which of them runs, so none of this is executed on a cpu without it
+
+#include "PixelKernels.h"
+#include <cstddef>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define GREENSCREEN_X86_KERNELS
+#include <immintrin.h>
+
+#if defined(__GNUC__)
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx512f,avx512bw")))
+#define GREENSCREEN_AVX512_KERNELS
+#else
+#define TARGET_SSE2
+#define TARGET_AVX2
+#define TARGET_AVX512
+//the avx512 intrinsics came with visual studio 2017
+#if defined(_MSC_VER) && _MSC_VER >= 1911
+#define GREENSCREEN_AVX512_KERNELS
+#endif
+#endif
+#endif
+
+namespace GreenScreen {
+
+#ifdef GREENSCREEN_X86_KERNELS
+
+	//a fully opaque run of foreground pixels is a plain copy
+	static void copyOpaque(unsigned char* dst, const unsigned char* foreground, int pixels)
+	{
+		for (int x = 0; x < pixels; x++)
+		{
+			dst[x * 3] = foreground[x * 4];
+			dst[x * 3 + 1] = foreground[x * 4 + 1];
+			dst[x * 3 + 2] = foreground[x * 4 + 2];
+		}
+	}
+
+	//the scalar blend on two BGRA foreground pixels over two BGRX pixels, widened to 16 bit lanes
+	//x / 255 is (x + 1 + (x >> 8)) >> 8 for every x the blend reaches, so the bytes are the scalar ones
+	TARGET_SSE2 static inline __m128i blendTwo(__m128i foreground, __m128i dst)
+	{
+		__m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(foreground, 0xFF), 0xFF);
+		__m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), alpha);
+		__m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(foreground, alpha), _mm_mullo_epi16(dst, inverse)), _mm_set1_epi16(127));
+		return _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(sum, _mm_set1_epi16(1)), _mm_srli_epi16(sum, 8)), 8);
+	}
+
+	//four pixels, the X byte of dst comes back as garbage
+	TARGET_SSE2 static inline __m128i blendFour(__m128i foreground, __m128i dst)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		__m128i low = blendTwo(_mm_unpacklo_epi8(foreground, zero), _mm_unpacklo_epi8(dst, zero));
+		__m128i high = blendTwo(_mm_unpackhi_epi8(foreground, zero), _mm_unpackhi_epi8(dst, zero));
+		return _mm_packus_epi16(low, high);
+	}
+
+	//SSE2*****************************
+	//runs of 16 pixels, a run that is all subject or all background skips the per pixel test
+
+	TARGET_SSE2 static void sse2ReplaceMasked(unsigned char* dst, const unsigned char* background, const unsigned char* mask, int pixels)
+	{
+		const __m128i opaque = _mm_set1_epi8((char)0xFF);
+		int x = 0;
+		for (; x + 16 <= pixels; x += 16)
+		{
+			int keep = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(mask + x)), opaque));
+			if (keep == 0xFFFF) continue;
+			if (keep == 0)
+			{
+				const __m128i* from = (const __m128i*)(background + x * 3);
+				__m128i* to = (__m128i*)(dst + x * 3);
+				_mm_storeu_si128(to, _mm_loadu_si128(from));
+				_mm_storeu_si128(to + 1, _mm_loadu_si128(from + 1));
+				_mm_storeu_si128(to + 2, _mm_loadu_si128(from + 2));
+				continue;
+			}
+			scalarReplaceMasked(dst + x * 3, background + x * 3, mask + x, 16);
+		}
+		scalarReplaceMasked(dst + x * 3, background + x * 3, mask + x, pixels - x);
+	}
+
+	//a run of 16 pixels with mixed alpha, sse2 has no byte shuffle so the BGR pixels go through a BGRX copy
+	TARGET_SSE2 static void sse2BlendMixed(unsigned char* dst, const unsigned char* foreground)
+	{
+		unsigned char bgrx[64];
+		for (int x = 0; x < 16; x++)
+		{
+			bgrx[x * 4] = dst[x * 3];
+			bgrx[x * 4 + 1] = dst[x * 3 + 1];
+			bgrx[x * 4 + 2] = dst[x * 3 + 2];
+			bgrx[x * 4 + 3] = 0;
+		}
+		for (int i = 0; i < 64; i += 16)
+		{
+			__m128i blended = blendFour(_mm_loadu_si128((const __m128i*)(foreground + i)), _mm_loadu_si128((const __m128i*)(bgrx + i)));
+			_mm_storeu_si128((__m128i*)(bgrx + i), blended);
+		}
+		for (int x = 0; x < 16; x++)
+		{
+			dst[x * 3] = bgrx[x * 4];
+			dst[x * 3 + 1] = bgrx[x * 4 + 1];
+			dst[x * 3 + 2] = bgrx[x * 4 + 2];
+		}
+	}
+
+	TARGET_SSE2 static void sse2BlendOver(unsigned char* dst, const unsigned char* foreground, int pixels)
+	{
+		const __m128i full = _mm_set1_epi32(255);
+		int x = 0;
+		for (; x + 16 <= pixels; x += 16)
+		{
+			const __m128i* fg = (const __m128i*)(foreground + x * 4);
+			__m128i a = _mm_loadu_si128(fg), b = _mm_loadu_si128(fg + 1), c = _mm_loadu_si128(fg + 2), d = _mm_loadu_si128(fg + 3);
+			__m128i any = _mm_srli_epi32(_mm_or_si128(_mm_or_si128(a, b), _mm_or_si128(c, d)), 24);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(any, _mm_setzero_si128())) == 0xFFFF) continue;
+			__m128i all = _mm_srli_epi32(_mm_and_si128(_mm_and_si128(a, b), _mm_and_si128(c, d)), 24);
+			if (_mm_movemask_epi8(_mm_cmpeq_epi32(all, full)) == 0xFFFF)
+			{
+				copyOpaque(dst + x * 3, foreground + x * 4, 16);
+				continue;
+			}
+			sse2BlendMixed(dst + x * 3, foreground + x * 4);
+		}
+		scalarBlendOver(dst + x * 3, foreground + x * 4, pixels - x);
+	}
+
+	//differences fit 9 bits and their squares 16 bits unsigned, so the integer part is exact like the scalar one
+	TARGET_SSE2 static void sse2WeightedSquares(const unsigned char* values, const unsigned char* mean, const float* weight, float* out, int count)
+	{
+		const __m128i zero = _mm_setzero_si128();
+		int i = 0;
+		for (; i + 16 <= count; i += 16)
+		{
+			__m128i v = _mm_loadu_si128((const __m128i*)(values + i));
+			__m128i m = _mm_loadu_si128((const __m128i*)(mean + i));
+			__m128i low = _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), _mm_unpacklo_epi8(m, zero));
+			__m128i high = _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), _mm_unpackhi_epi8(m, zero));
+			low = _mm_mullo_epi16(low, low);
+			high = _mm_mullo_epi16(high, high);
+			_mm_storeu_ps(out + i, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(low, zero)), _mm_loadu_ps(weight + i)));
+			_mm_storeu_ps(out + i + 4, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(low, zero)), _mm_loadu_ps(weight + i + 4)));
+			_mm_storeu_ps(out + i + 8, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(high, zero)), _mm_loadu_ps(weight + i + 8)));
+			_mm_storeu_ps(out + i + 12, _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(high, zero)), _mm_loadu_ps(weight + i + 12)));
+		}
+		scalarWeightedSquares(values + i, mean + i, weight + i, out + i, count - i);
+	}
+
+	//AVX2*****************************
+	//runs of 32 pixels
+
+	TARGET_AVX2 static void avx2ReplaceMasked(unsigned char* dst, const unsigned char* background, const unsigned char* mask, int pixels)
+	{
+		const __m256i opaque = _mm256_set1_epi8((char)0xFF);
+		int x = 0;
+		for (; x + 32 <= pixels; x += 32)
+		{
+			int keep = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(mask + x)), opaque));
+			if (keep == -1) continue;
+			if (keep == 0)
+			{
+				const __m256i* from = (const __m256i*)(background + x * 3);
+				__m256i* to = (__m256i*)(dst + x * 3);
+				_mm256_storeu_si256(to, _mm256_loadu_si256(from));
+				_mm256_storeu_si256(to + 1, _mm256_loadu_si256(from + 1));
+				_mm256_storeu_si256(to + 2, _mm256_loadu_si256(from + 2));
+				continue;
+			}
+			scalarReplaceMasked(dst + x * 3, background + x * 3, mask + x, 32);
+		}
+		_mm256_zeroupper();
+		scalarReplaceMasked(dst + x * 3, background + x * 3, mask + x, pixels - x);
+	}
+
+	//a run of 16 pixels with mixed alpha, the 48 BGR bytes are spread to BGRX and packed back with byte shuffles
+	//also used by the avx512 kernels, avx2 implies the ssse3 shuffles
+	TARGET_AVX2 static void shuffleBlendMixed(unsigned char* dst, const unsigned char* foreground)
+	{
+		const __m128i spread = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+		const __m128i pack = _mm_setr_epi8(0, 1, 2, 4, 5, 6, 8, 9, 10, 12, 13, 14, -1, -1, -1, -1);
+		const __m128i* fg = (const __m128i*)foreground;
+		__m128i* to = (__m128i*)dst;
+		__m128i v0 = _mm_loadu_si128(to), v1 = _mm_loadu_si128(to + 1), v2 = _mm_loadu_si128(to + 2);
+		__m128i p0 = _mm_shuffle_epi8(v0, spread);
+		__m128i p1 = _mm_shuffle_epi8(_mm_alignr_epi8(v1, v0, 12), spread);
+		__m128i p2 = _mm_shuffle_epi8(_mm_alignr_epi8(v2, v1, 8), spread);
+		__m128i p3 = _mm_shuffle_epi8(_mm_srli_si128(v2, 4), spread);
+		p0 = _mm_shuffle_epi8(blendFour(_mm_loadu_si128(fg), p0), pack);
+		p1 = _mm_shuffle_epi8(blendFour(_mm_loadu_si128(fg + 1), p1), pack);
+		p2 = _mm_shuffle_epi8(blendFour(_mm_loadu_si128(fg + 2), p2), pack);
+		p3 = _mm_shuffle_epi8(blendFour(_mm_loadu_si128(fg + 3), p3), pack);
+		_mm_storeu_si128(to, _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+		_mm_storeu_si128(to + 1, _mm_or_si128(_mm_srli_si128(p1, 4), _mm_slli_si128(p2, 8)));
+		_mm_storeu_si128(to + 2, _mm_or_si128(_mm_srli_si128(p2, 8), _mm_slli_si128(p3, 4)));
+	}
+
+	TARGET_AVX2 static void avx2BlendOver(unsigned char* dst, const unsigned char* foreground, int pixels)
+	{
+		const __m256i full = _mm256_set1_epi32(255);
+		int x = 0;
+		for (; x + 32 <= pixels; x += 32)
+		{
+			const __m256i* fg = (const __m256i*)(foreground + x * 4);
+			__m256i a = _mm256_loadu_si256(fg), b = _mm256_loadu_si256(fg + 1), c = _mm256_loadu_si256(fg + 2), d = _mm256_loadu_si256(fg + 3);
+			__m256i any = _mm256_srli_epi32(_mm256_or_si256(_mm256_or_si256(a, b), _mm256_or_si256(c, d)), 24);
+			if (_mm256_testz_si256(any, any)) continue;
+			__m256i all = _mm256_srli_epi32(_mm256_and_si256(_mm256_and_si256(a, b), _mm256_and_si256(c, d)), 24);
+			if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(all, full)) == -1)
+			{
+				copyOpaque(dst + x * 3, foreground + x * 4, 32);
+				continue;
+			}
+			shuffleBlendMixed(dst + x * 3, foreground + x * 4);
+			shuffleBlendMixed(dst + x * 3 + 48, foreground + x * 4 + 64);
+		}
+		_mm256_zeroupper();
+		scalarBlendOver(dst + x * 3, foreground + x * 4, pixels - x);
+	}
+
+	TARGET_AVX2 static void avx2WeightedSquares(const unsigned char* values, const unsigned char* mean, const float* weight, float* out, int count)
+	{
+		int i = 0;
+		for (; i + 32 <= count; i += 32)
+		{
+			__m256i low = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(values + i))),
+				_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(mean + i))));
+			__m256i high = _mm256_sub_epi16(_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(values + i + 16))),
+				_mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i*)(mean + i + 16))));
+			low = _mm256_mullo_epi16(low, low);
+			high = _mm256_mullo_epi16(high, high);
+			_mm256_storeu_ps(out + i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(low))), _mm256_loadu_ps(weight + i)));
+			_mm256_storeu_ps(out + i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(low, 1))), _mm256_loadu_ps(weight + i + 8)));
+			_mm256_storeu_ps(out + i + 16, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(high))), _mm256_loadu_ps(weight + i + 16)));
+			_mm256_storeu_ps(out + i + 24, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepu16_epi32(_mm256_extracti128_si256(high, 1))), _mm256_loadu_ps(weight + i + 24)));
+		}
+		_mm256_zeroupper();
+		scalarWeightedSquares(values + i, mean + i, weight + i, out + i, count - i);
+	}
+
+#ifdef GREENSCREEN_AVX512_KERNELS
+	//AVX512***************************
+	//runs of 64 pixels, needs F and BW
+
+	TARGET_AVX512 static void avx512ReplaceMasked(unsigned char* dst, const unsigned char* background, const unsigned char* mask, int pixels)
+	{
+		const __m512i opaque = _mm512_set1_epi8((char)0xFF);
+		int x = 0;
+		for (; x + 64 <= pixels; x += 64)
+		{
+			__mmask64 keep = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(mask + x), opaque);
+			if (keep == ~(__mmask64)0) continue;
+			if (keep == 0)
+			{
+				const unsigned char* from = background + x * 3;
+				unsigned char* to = dst + x * 3;
+				_mm512_storeu_si512(to, _mm512_loadu_si512(from));
+				_mm512_storeu_si512(to + 64, _mm512_loadu_si512(from + 64));
+				_mm512_storeu_si512(to + 128, _mm512_loadu_si512(from + 128));
+				continue;
+			}
+			scalarReplaceMasked(dst + x * 3, background + x * 3, mask + x, 64);
+		}
+		_mm256_zeroupper();
+		scalarReplaceMasked(dst + x * 3, background + x * 3, mask + x, pixels - x);
+	}
+
+	TARGET_AVX512 static void avx512BlendOver(unsigned char* dst, const unsigned char* foreground, int pixels)
+	{
+		const __m512i full = _mm512_set1_epi32(255);
+		int x = 0;
+		for (; x + 64 <= pixels; x += 64)
+		{
+			const unsigned char* fg = foreground + x * 4;
+			__m512i a = _mm512_loadu_si512(fg), b = _mm512_loadu_si512(fg + 64), c = _mm512_loadu_si512(fg + 128), d = _mm512_loadu_si512(fg + 192);
+			__m512i any = _mm512_srli_epi32(_mm512_or_si512(_mm512_or_si512(a, b), _mm512_or_si512(c, d)), 24);
+			if (_mm512_test_epi32_mask(any, any) == 0) continue;
+			__m512i all = _mm512_srli_epi32(_mm512_and_si512(_mm512_and_si512(a, b), _mm512_and_si512(c, d)), 24);
+			if (_mm512_cmpeq_epi32_mask(all, full) == 0xFFFF)
+			{
+				copyOpaque(dst + x * 3, fg, 64);
+				continue;
+			}
+			for (int i = 0; i < 64; i += 16) shuffleBlendMixed(dst + (x + i) * 3, fg + i * 4);
+		}
+		_mm256_zeroupper();
+		scalarBlendOver(dst + x * 3, foreground + x * 4, pixels - x);
+	}
+
+	TARGET_AVX512 static void avx512WeightedSquares(const unsigned char* values, const unsigned char* mean, const float* weight, float* out, int count)
+	{
+		int i = 0;
+		for (; i + 64 <= count; i += 64)
+		{
+			__m512i low = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(values + i))),
+				_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(mean + i))));
+			__m512i high = _mm512_sub_epi16(_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(values + i + 32))),
+				_mm512_cvtepu8_epi16(_mm256_loadu_si256((const __m256i*)(mean + i + 32))));
+			low = _mm512_mullo_epi16(low, low);
+			high = _mm512_mullo_epi16(high, high);
+			_mm512_storeu_ps(out + i, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(low))), _mm512_loadu_ps(weight + i)));
+			_mm512_storeu_ps(out + i + 16, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(low, 1))), _mm512_loadu_ps(weight + i + 16)));
+			_mm512_storeu_ps(out + i + 32, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm512_castsi512_si256(high))), _mm512_loadu_ps(weight + i + 32)));
+			_mm512_storeu_ps(out + i + 48, _mm512_mul_ps(_mm512_cvtepi32_ps(_mm512_cvtepu16_epi32(_mm512_extracti64x4_epi64(high, 1))), _mm512_loadu_ps(weight + i + 48)));
+		}
+		_mm256_zeroupper();
+		scalarWeightedSquares(values + i, mean + i, weight + i, out + i, count - i);
+	}
+#endif
+
+	const pixelKernels* sse2Kernels()
+	{
+		static const pixelKernels kernels = { "sse2", sse2ReplaceMasked, sse2BlendOver, sse2WeightedSquares };
+		return &kernels;
+	}
+
+	const pixelKernels* avx2Kernels()
+	{
+		static const pixelKernels kernels = { "avx2", avx2ReplaceMasked, avx2BlendOver, avx2WeightedSquares };
+		return &kernels;
+	}
+
+	const pixelKernels* avx512Kernels()
+	{
+#ifdef GREENSCREEN_AVX512_KERNELS
+		static const pixelKernels kernels = { "avx512", avx512ReplaceMasked, avx512BlendOver, avx512WeightedSquares };
+		return &kernels;
+#else
+		return NULL;
+#endif
+	}
+
+#else
+
+	const pixelKernels* sse2Kernels() { return NULL; }
+	const pixelKernels* avx2Kernels() { return NULL; }
+	const pixelKernels* avx512Kernels() { return NULL; }
+
+#endif
+}
@@ -0,0 +1,187 @@
+/*
+* PrintJob.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "PrintJob.h"
+#include <atomic>
+#include <cstring>
+#include <mutex>
+#include <thread>
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	static float msSince(int64 startTick)
+	{
+		return (float)((getTickCount() - startTick) * 1000.0 / getTickFrequency());
+	}
+
+	static void copyPath(char* to, size_t capacity, const std::string& from)
+	{
+		size_t n = from.size() < capacity - 1 ? from.size() : capacity - 1;
+		memcpy(to, from.c_str(), n);
+		to[n] = 0;
+	}
+
+	bool writePrintPage(const Mat& page, const printJob& job, PrinterBackend* printer, FrameArena& arena,
+		captureRecord& record, printJobTimings* timings, bool* printed)
+	{
+		if (printed) *printed = false;
+
+		//master, screen and thumbnail from the same composite
+		int64 stageTick = getTickCount();
+		pyramidTimings levelTimings;
+		bool written = writeOutputPyramid(page, job.paths, pyramidOptions(), &levelTimings, &arena);
+		record.saveMs = msSince(stageTick);
+		if (timings)
+		{
+			timings->downscaleMs = levelTimings.downscaleMs;
+			timings->encodeMs = levelTimings.encodeMs;
+		}
+
+		if (job.allowPrint && printer)
+		{
+			stageTick = getTickCount();
+			bool ok = printer->print(page, arena);
+			record.printMs = msSince(stageTick);
+			if (printed) *printed = ok;
+		}
+
+		copyPath(record.masterPath, sizeof(record.masterPath), job.paths.master);
+		copyPath(record.screenPath, sizeof(record.screenPath), job.paths.screen);
+		copyPath(record.thumbPath, sizeof(record.thumbPath), job.paths.thumb);
+		return written;
+	}
+
+	bool runPrintJob(KeyPipeline& pipeline, const std::vector<unsigned char>& picture, const printJob& job,
+		Mat& background, Mat& foreground, PrinterBackend* printer, captureRecord& record,
+		printJobTimings* timings, bool* written, bool* printed)
+	{
+		if (written) *written = false;
+		if (printed) *printed = false;
+		if (picture.empty()) return false;
+
+		int64 stageTick = getTickCount();
+		Mat output;
+		if (!pipeline.composePrint(&picture[0], picture.size(), job.key, background, foreground, job.isWideScreen, output, &job.layers)) return false;
+		record.composeMs = msSince(stageTick);
+
+		bool ok = writePrintPage(output, job, printer, pipeline.printArena(), record, timings, printed);
+		if (written) *written = ok;
+		return true;
+	}
+
+	struct PrintWorker::impl
+	{
+		std::vector<unsigned char> picture;		//the job owns the bytes, the camera fills the form buffer meanwhile
+		std::thread worker;
+		std::atomic<bool> busy;
+		std::mutex resultLock;
+		bool hasResult;
+		printResult result;
+
+		impl() : busy(false), hasResult(false) {}
+
+		//called last on the worker thread
+		void finish(const printResult& finished)
+		{
+			std::lock_guard<std::mutex> lock(resultLock);
+			result = finished;
+			hasResult = true;
+			busy = false;
+		}
+	};
+
+	PrintWorker::PrintWorker() : d(new impl())
+	{
+	}
+
+	PrintWorker::~PrintWorker()
+	{
+		if (d->worker.joinable()) d->worker.join();
+		delete d;
+	}
+
+	bool PrintWorker::start(KeyPipeline& pipeline, std::vector<unsigned char>& picture, const printJob& job,
+		const Mat& background, const Mat& foreground, PrinterBackend* printer, const captureRecord& record)
+	{
+		if (d->busy) return false;
+		if (d->worker.joinable()) d->worker.join();
+		d->picture.swap(picture);
+		picture.clear();
+		d->busy = true;
+
+		impl* state = d;
+		KeyPipeline* printPipeline = &pipeline;
+		d->worker = std::thread([state, printPipeline, job, background, foreground, printer, record]()
+		{
+			printResult result;
+			result.record = record;
+			result.isPage = false;
+			result.written = false;
+			result.printed = false;
+			result.timings.downscaleMs = 0;
+			result.timings.encodeMs = 0;
+			//composePrint resizes the theme in place, the headers are the worker's own
+			result.background = background;
+			result.foreground = foreground;
+			result.ok = runPrintJob(*printPipeline, state->picture, job, result.background, result.foreground, printer,
+				result.record, &result.timings, &result.written, &result.printed);
+			state->finish(result);
+		});
+		return true;
+	}
+
+	bool PrintWorker::startPage(KeyPipeline& pipeline, const Mat& page, const printJob& job, PrinterBackend* printer,
+		const captureRecord& record)
+	{
+		if (d->busy) return false;
+		if (d->worker.joinable()) d->worker.join();
+		d->busy = true;
+
+		impl* state = d;
+		FrameArena* arena = &pipeline.printArena();
+		d->worker = std::thread([state, arena, page, job, printer, record]()
+		{
+			printResult result;
+			result.ok = true;
+			result.isPage = true;
+			result.record = record;
+			result.printed = false;
+			result.timings.downscaleMs = 0;
+			result.timings.encodeMs = 0;
+			result.written = writePrintPage(page, job, printer, *arena, result.record, &result.timings, &result.printed);
+			state->finish(result);
+		});
+		return true;
+	}
+
+	bool PrintWorker::isBusy() const
+	{
+		return d->busy;
+	}
+
+	bool PrintWorker::takeResult(printResult& result)
+	{
+		std::lock_guard<std::mutex> lock(d->resultLock);
+		if (!d->hasResult) return false;
+		result = d->result;
+		d->hasResult = false;
+		d->result.background.release();
+		d->result.foreground.release();
+		return true;
+	}
+}
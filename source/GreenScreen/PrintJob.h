@@ -0,0 +1,93 @@
+/*
+* PrintJob.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "Backends.h"
+#include "CaptureJournal.h"
+#include "KeyPipeline.h"
+#include "OutputPyramid.h"
+#include <vector>
+
+namespace GreenScreen {
+
+	//what the form knows when a picture arrives
+	struct printJob
+	{
+		keySettings key;
+		bool isWideScreen;
+		bool allowPrint;
+		pyramidPaths paths;
+		LayerStack layers;		//the theme layers when it has a layer file, shared with the form, not copied
+	};
+
+	struct printJobTimings
+	{
+		float downscaleMs;
+		float encodeMs;
+	};
+
+	//write the pyramid of a composed page and print it when allowed
+	//record gets the save and print times and the written paths, returns false if a file could not be written
+	bool writePrintPage(const cv::Mat& page, const printJob& job, PrinterBackend* printer, FrameArena& arena,
+		captureRecord& record, printJobTimings* timings = NULL, bool* printed = NULL);
+
+	//compose a camera picture, write its pyramid and print it when allowed
+	//record gets the compose, save and print times and the written paths, the rest is left to the caller
+	//returns false when the picture could not be decoded, a failed write or print is logged in the timings only
+	bool runPrintJob(KeyPipeline& pipeline, const std::vector<unsigned char>& picture, const printJob& job,
+		cv::Mat& background, cv::Mat& foreground, PrinterBackend* printer, captureRecord& record,
+		printJobTimings* timings = NULL, bool* written = NULL, bool* printed = NULL);
+
+	struct printResult
+	{
+		bool ok;				//false when the picture could not be decoded
+		bool isPage;			//a composed page from startPage, background and foreground are empty
+		bool written;
+		bool printed;
+		captureRecord record;	//as given to start (capture time, theme and key) with the compose, save and print times and the paths
+		printJobTimings timings;
+		cv::Mat background;		//the theme at print size, worth keeping for the next job of the same theme
+		cv::Mat foreground;
+	};
+
+	//runs one print job at a time on a worker thread, so the form can show the preview while it renders
+	//the worker uses the print side of the pipeline only, the form must not compose prints or learn plates meanwhile
+	class PrintWorker
+	{
+	public:
+		PrintWorker();
+		~PrintWorker();
+
+		//picture is swapped out and given back empty, background and foreground are shared, not copied
+		//returns false while a job is still running
+		bool start(KeyPipeline& pipeline, std::vector<unsigned char>& picture, const printJob& job,
+			const cv::Mat& background, const cv::Mat& foreground, PrinterBackend* printer, const captureRecord& record);
+		//a page composed elsewhere, like a burst page: only its pyramid is written and printed, page is shared
+		bool startPage(KeyPipeline& pipeline, const cv::Mat& page, const printJob& job, PrinterBackend* printer,
+			const captureRecord& record);
+		bool isBusy() const;
+
+		//true once per finished job
+		bool takeResult(printResult& result);
+
+	private:
+		struct impl;
+		impl* d;
+
+		PrintWorker(const PrintWorker&);
+		PrintWorker& operator=(const PrintWorker&);
+	};
+}
@@ -0,0 +1,250 @@
+/*
+* RawDecoder.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#define NOMINMAX
+#include "RawDecoder.h"
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+//LibRaw is linked only when GREENSCREEN_LIBRAW is defined, see the Release|Win32 settings of the project
+//(libraw.dll next to the exe), the tools add -DGREENSCREEN_LIBRAW -fopenmp $(pkg-config --cflags --libs libraw_r)
+//the full size demosaic only spreads over the cores when libraw.dll itself is built with /openmp (Makefile.msvc of LibRaw),
+//a dll built without it demosaics on one thread whatever this file is built with, fullCores() in the log tells which
+#ifdef GREENSCREEN_LIBRAW
+#include "libraw/libraw.h"
+//the LibRaw headers turn LIBRAW_USE_OPENMP on from _OPENMP, the project builds this file with /openmp (Release|Win32)
+#ifdef LIBRAW_USE_OPENMP
+#include <omp.h>
+#endif
+#endif
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	static float msSince(int64 startTick)
+	{
+		return (float)((getTickCount() - startTick) * 1000.0 / getTickFrequency());
+	}
+
+	//cpu time of every thread of the process, over a wall time span it tells how many cores were busy
+	static double processCpuMs()
+	{
+#ifdef _WIN32
+		FILETIME created, exited, kernel, user;
+		if (!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+		ULARGE_INTEGER k, u;
+		k.LowPart = kernel.dwLowDateTime;
+		k.HighPart = kernel.dwHighDateTime;
+		u.LowPart = user.dwLowDateTime;
+		u.HighPart = user.dwHighDateTime;
+		return (k.QuadPart + u.QuadPart) / 10000.0;
+#else
+		timespec now;
+		if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now) != 0) return 0;
+		return now.tv_sec * 1000.0 + now.tv_nsec / 1000000.0;
+#endif
+	}
+
+	bool isRawPicture(const unsigned char* data, size_t bytes)
+	{
+		if (!data || bytes < 12) return false;
+		//CR2: little endian tiff header followed by "CR" and the major version
+		if (memcmp(data, "II*\0", 4) == 0 && data[8] == 'C' && data[9] == 'R') return true;
+		//CR3: iso base media file with the canon brand
+		if (memcmp(data + 4, "ftyp", 4) == 0 && memcmp(data + 8, "crx ", 4) == 0) return true;
+		return false;
+	}
+
+	bool isRawSupported()
+	{
+#ifdef GREENSCREEN_LIBRAW
+		return true;
+#else
+		return false;
+#endif
+	}
+
+	int rawDecodeThreads()
+	{
+#if defined(GREENSCREEN_LIBRAW) && defined(LIBRAW_USE_OPENMP)
+		return omp_get_max_threads();
+#else
+		return 1;
+#endif
+	}
+
+	std::string rawDecoderInfo()
+	{
+#ifdef GREENSCREEN_LIBRAW
+		char text[200];
+#ifdef LIBRAW_USE_OPENMP
+		snprintf(text, sizeof(text), "LibRaw %s, capabilities 0x%x, OpenMP up to %d threads when libraw.dll is built with it",
+			LibRaw::version(), LibRaw::capabilities(), rawDecodeThreads());
+#else
+		snprintf(text, sizeof(text), "LibRaw %s, capabilities 0x%x, no OpenMP in this build, the demosaic runs on one thread",
+			LibRaw::version(), LibRaw::capabilities());
+#endif
+		return text;
+#else
+		return "no LibRaw in this build";
+#endif
+	}
+
+#ifdef GREENSCREEN_LIBRAW
+	//open, unpack and process one file from memory into out, 8 bit BGR in the camera orientation
+	static bool runLibRaw(LibRaw& raw, const unsigned char* data, size_t bytes, bool isHalfSize, Mat& out)
+	{
+		raw.recycle();
+		libraw_output_params_t& params = raw.imgdata.params;
+		params.half_size = isHalfSize ? 1 : 0;
+		params.use_camera_wb = 1;
+		params.output_bps = 8;
+		params.user_qual = 3;		//AHD, half size skips the demosaic anyway
+		params.user_flip = 0;		//same as the jpeg path, the picture is never turned by its exif
+
+		if (raw.open_buffer((void*)data, bytes) != LIBRAW_SUCCESS) return false;
+		if (raw.unpack() != LIBRAW_SUCCESS) return false;
+		if (raw.dcraw_process() != LIBRAW_SUCCESS) return false;
+
+		int width = 0, height = 0, colors = 0, bps = 0;
+		raw.get_mem_image_format(&width, &height, &colors, &bps);
+		if (width <= 0 || height <= 0 || colors != 3 || bps != 8) return false;
+
+		//straight from the LibRaw buffer into BGR rows, keeps its memory between pictures of the same camera
+		out.create(height, width, CV_8UC3);
+		return raw.copy_mem_image(out.data, (int)out.step, 1) == LIBRAW_SUCCESS;
+	}
+#endif
+
+	struct RawDecoder::impl
+	{
+#ifdef GREENSCREEN_LIBRAW
+		LibRaw halfRaw;			//the preview and the print decode never share an instance
+		LibRaw fullRaw;
+#endif
+		Mat halfImage;
+		Mat fullImage;
+		std::thread worker;
+		const unsigned char* prefetchData;
+		size_t prefetchBytes;
+		bool prefetchOk;
+		float halfMs;
+		float fullMs;
+		float fullCores;
+
+		impl() : prefetchData(NULL), prefetchBytes(0), prefetchOk(false), halfMs(0), fullMs(0), fullCores(0) {}
+
+		bool decodeFullNow(const unsigned char* data, size_t bytes)
+		{
+#ifdef GREENSCREEN_LIBRAW
+			int64 startTick = getTickCount();
+			double startCpu = processCpuMs();
+			bool ok = runLibRaw(fullRaw, data, bytes, false, fullImage);
+			fullRaw.recycle();
+			fullMs = msSince(startTick);
+			fullCores = fullMs > 0 ? (float)((processCpuMs() - startCpu) / fullMs) : 0;
+			return ok;
+#else
+			return false;
+#endif
+		}
+
+		void join()
+		{
+			if (worker.joinable()) worker.join();
+		}
+	};
+
+	RawDecoder::RawDecoder() : d(new impl())
+	{
+	}
+
+	RawDecoder::~RawDecoder()
+	{
+		d->join();
+		delete d;
+	}
+
+	bool RawDecoder::prefetch(const unsigned char* data, size_t bytes)
+	{
+		if (!isRawSupported() || !isRawPicture(data, bytes)) return false;
+		d->join();
+		d->prefetchData = data;
+		d->prefetchBytes = bytes;
+		d->prefetchOk = false;
+		impl* state = d;
+		d->worker = std::thread([state, data, bytes]() { state->prefetchOk = state->decodeFullNow(data, bytes); });
+		return true;
+	}
+
+	bool RawDecoder::decodeHalf(const unsigned char* data, size_t bytes, Mat& out)
+	{
+#ifdef GREENSCREEN_LIBRAW
+		if (!isRawPicture(data, bytes)) return false;
+		int64 startTick = getTickCount();
+		bool ok = runLibRaw(d->halfRaw, data, bytes, true, d->halfImage);
+		d->halfRaw.recycle();
+		d->halfMs = msSince(startTick);
+		if (ok) out = d->halfImage;
+		return ok;
+#else
+		return false;
+#endif
+	}
+
+	bool RawDecoder::decodeFull(const unsigned char* data, size_t bytes, Mat& out)
+	{
+		if (!isRawPicture(data, bytes)) return false;
+		bool ok = false;
+		if (d->worker.joinable() && d->prefetchData == data && d->prefetchBytes == bytes)
+		{
+			d->join();
+			ok = d->prefetchOk;
+		}
+		else
+		{
+			//a prefetch of another picture is of no use any more
+			d->join();
+			ok = d->decodeFullNow(data, bytes);
+		}
+		d->prefetchData = NULL;
+		d->prefetchBytes = 0;
+		if (ok) out = d->fullImage;
+		return ok;
+	}
+
+	float RawDecoder::halfMs() const
+	{
+		return d->halfMs;
+	}
+
+	float RawDecoder::fullMs() const
+	{
+		return d->fullMs;
+	}
+
+	float RawDecoder::fullCores() const
+	{
+		return d->fullCores;
+	}
+}
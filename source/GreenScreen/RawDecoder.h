@@ -0,0 +1,68 @@
+/*
+* RawDecoder.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "opencv2/opencv.hpp"
+#include <cstddef>
+#include <string>
+
+// this header is included from the /clr form, keep it free of <thread>, <mutex> and <atomic>,
+// the implementation lives in RawDecoder.cpp which is compiled as native code
+
+namespace GreenScreen {
+
+	//CR2 (tiff with the CR marker) or CR3 (iso media with the crx brand), from the first bytes of the file
+	bool isRawPicture(const unsigned char* data, size_t bytes);
+	//false when the app is built without GREENSCREEN_LIBRAW, RAW pictures are refused then
+	bool isRawSupported();
+	//LibRaw version, capabilities() and whether this build has OpenMP, for the startup log
+	std::string rawDecoderInfo();
+	//threads the full size demosaic may spread over, 1 without OpenMP, libraw.dll must be built with OpenMP as well
+	int rawDecodeThreads();
+
+	//canon RAW files decoded from memory with LibRaw, camera white balance, 8 bit BGR out
+	//half size: every 2x2 bayer block becomes one pixel, no demosaic, for the preview
+	//full size: AHD demosaic, started on a worker by prefetch so it runs while the preview is made
+	//LibRaw spreads the demosaic over all cores when it is built with OpenMP, fullCores() shows whether it did
+	class RawDecoder
+	{
+	public:
+		RawDecoder();
+		~RawDecoder();
+
+		//start the full size decode of a picture, data must stay untouched until decodeFull is called for it
+		bool prefetch(const unsigned char* data, size_t bytes);
+
+		//out points to decoder memory and is valid until the next decode of the same size
+		bool decodeHalf(const unsigned char* data, size_t bytes, cv::Mat& out);
+		//waits for a prefetch of the same bytes, or decodes now when there is none
+		bool decodeFull(const unsigned char* data, size_t bytes, cv::Mat& out);
+
+		//last decode times, for the log
+		float halfMs() const;
+		float fullMs() const;
+		//cpu time of the process over the wall time of the last full decode, about 1 for a single threaded demosaic;
+		//the preview decode and the live view running at the same time count in as well
+		float fullCores() const;
+
+	private:
+		struct impl;
+		impl* d;
+
+		RawDecoder(const RawDecoder&);
+		RawDecoder& operator=(const RawDecoder&);
+	};
+}
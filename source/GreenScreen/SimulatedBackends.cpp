@@ -0,0 +1,148 @@
+/*
+* SimulatedBackends.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#include "SimulatedBackends.h"
+#include <chrono>
+#include <thread>
+
+namespace GreenScreen {
+
+	using namespace cv;
+
+	static void sleepMs(int ms)
+	{
+		if (ms > 0) std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+	}
+
+	static int64_t nowTick()
+	{
+		return (int64_t)getTickCount();
+	}
+
+	static int64_t msToTicks(int ms)
+	{
+		return (int64_t)(ms * getTickFrequency() / 1000.0);
+	}
+
+	void drawSimulatedScene(Mat& image, int variant)
+	{
+		//uneven green backdrop, a bit brighter at the top like under booth lights
+		for (int y = 0; y < image.rows; y++)
+		{
+			Vec3b* row = image.ptr<Vec3b>(y);
+			uchar green = (uchar)(190 - 40 * y / image.rows);
+			for (int x = 0; x < image.cols; x++)
+			{
+				row[x] = Vec3b(40, green, 50);
+			}
+		}
+		//a subject that sways from frame to frame
+		int cx = image.cols / 2 + (variant % 4 - 2) * image.cols / 40;
+		int cy = image.rows * 3 / 5;
+		ellipse(image, cv::Point(cx, cy), cv::Size(image.cols / 7, image.rows / 3), 0, 0, 360, Scalar(90, 120, 200), -1);
+		circle(image, cv::Point(cx, cy - image.rows / 3), image.rows / 9, Scalar(120, 150, 220), -1);
+	}
+
+	SimulatedCamera::SimulatedCamera(const simulatedSettings& settings)
+		: settings(settings), isOpen(false), isLiveStream(false), liveIndex(0), pictureReadyTick(0)
+	{
+	}
+
+	bool SimulatedCamera::open()
+	{
+		std::vector<int> quality;
+		quality.push_back(IMWRITE_JPEG_QUALITY);
+		quality.push_back(80);
+		Mat frame(settings.liveHeight, settings.liveWidth, CV_8UC3);
+		for (int i = 0; i < liveVariants; i++)
+		{
+			drawSimulatedScene(frame, i);
+			imencode(".jpg", frame, liveFrames[i], quality);
+		}
+		quality[1] = 95;
+		Mat picture(settings.pictureHeight, settings.pictureWidth, CV_8UC3);
+		drawSimulatedScene(picture, 0);
+		imencode(".jpg", picture, pictureFile, quality);
+		isOpen = true;
+		return true;
+	}
+
+	void SimulatedCamera::close()
+	{
+		isOpen = false;
+		isLiveStream = false;
+		pictureReadyTick = 0;
+	}
+
+	std::string SimulatedCamera::name() const
+	{
+		return "simulated camera";
+	}
+
+	bool SimulatedCamera::startLiveView()
+	{
+		isLiveStream = isOpen;
+		return isLiveStream;
+	}
+
+	bool SimulatedCamera::downloadLiveView(const unsigned char*& data, size_t& bytes)
+	{
+		if (!isLiveStream) return false;
+		sleepMs(settings.liveLatencyMs);
+		const std::vector<unsigned char>& frame = liveFrames[liveIndex];
+		liveIndex = (liveIndex + 1) % liveVariants;
+		data = &frame[0];
+		bytes = frame.size();
+		return true;
+	}
+
+	bool SimulatedCamera::takePicture()
+	{
+		if (!isOpen || pictureReadyTick != 0) return false;
+		pictureReadyTick = nowTick() + msToTicks(settings.shutterLatencyMs);
+		return true;
+	}
+
+	bool SimulatedCamera::pollPicture(std::vector<unsigned char>& picture)
+	{
+		if (pictureReadyTick == 0 || nowTick() < pictureReadyTick) return false;
+		//the transfer blocks like EdsDownload does inside the object event
+		sleepMs(settings.transferLatencyMs);
+		picture.assign(pictureFile.begin(), pictureFile.end());
+		pictureReadyTick = 0;
+		return true;
+	}
+
+	SimulatedPrinter::SimulatedPrinter(const simulatedSettings& settings) : settings(settings), printed(0)
+	{
+	}
+
+	std::string SimulatedPrinter::name() const
+	{
+		return "simulated printer";
+	}
+
+	bool SimulatedPrinter::print(const Mat& page, FrameArena& arena)
+	{
+		if (page.empty()) return false;
+		//the same page scaling the GDI printer does, so the print arena sees the real load
+		Mat to = arena.acquire(4050, 2700, CV_8UC3);
+		resize(page, to, cv::Size(2700, 4050));
+		sleepMs(settings.printLatencyMs);
+		printed++;
+		return true;
+	}
+}
@@ -0,0 +1,85 @@
+/*
+* SimulatedBackends.h
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+
+#pragma once
+#include "Backends.h"
+#include <cstdint>
+
+namespace GreenScreen {
+
+	//latencies and sizes of the simulated hardware, the defaults are close to a 600D over usb
+	struct simulatedSettings
+	{
+		int liveWidth;
+		int liveHeight;
+		int pictureWidth;
+		int pictureHeight;
+		int liveLatencyMs;		//EdsDownloadEvfImage
+		int shutterLatencyMs;	//TakePicture until the transfer event
+		int transferLatencyMs;	//download of the picture
+		int printLatencyMs;
+
+		simulatedSettings() : liveWidth(960), liveHeight(640), pictureWidth(5184), pictureHeight(3456),
+			liveLatencyMs(15), shutterLatencyMs(400), transferLatencyMs(600), printLatencyMs(200) {}
+	};
+
+	//a camera in front of a green backdrop with a subject that moves between frames
+	//the jpegs are encoded once in open(), so the cost left per frame is the same as with the EDSDK
+	class SimulatedCamera : public CameraBackend
+	{
+	public:
+		SimulatedCamera(const simulatedSettings& settings = simulatedSettings());
+
+		bool open();
+		void close();
+		std::string name() const;
+
+		bool startLiveView();
+		bool downloadLiveView(const unsigned char*& data, size_t& bytes);
+
+		bool takePicture();
+		bool pollPicture(std::vector<unsigned char>& picture);
+
+	private:
+		simulatedSettings settings;
+		bool isOpen;
+		bool isLiveStream;
+		static const int liveVariants = 8;
+		std::vector<unsigned char> liveFrames[liveVariants];
+		std::vector<unsigned char> pictureFile;
+		int liveIndex;
+		int64_t pictureReadyTick;	//0 when no picture is pending
+	};
+
+	//a printer that takes its time and counts pages
+	class SimulatedPrinter : public PrinterBackend
+	{
+	public:
+		SimulatedPrinter(const simulatedSettings& settings = simulatedSettings());
+
+		std::string name() const;
+		bool print(const cv::Mat& page, FrameArena& arena);
+
+		uint64_t pages() const { return printed; }
+
+	private:
+		simulatedSettings settings;
+		uint64_t printed;
+	};
+
+	//a scene like the camera sees it, used for the simulated camera and the soak harness themes
+	void drawSimulatedScene(cv::Mat& image, int variant);
+}
@@ -0,0 +1,105 @@
+/*
+* BurstBench.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+//burst page against single shots: compose N camera pictures one after the other at print size (the old path)
+//against the burst composer, every shot on its own worker straight into its cell of the page
+//the burst time is measured from the last shot handed over, the others are composed while the camera downloads
+//
+//build on linux from source/Tools:
+//  g++ -O2 -std=c++14 -I../GreenScreen BurstBench.cpp ../GreenScreen/BurstComposer.cpp ../GreenScreen/CleanPlate.cpp ../GreenScreen/EmbeddedPreview.cpp
+//      ../GreenScreen/FrameArena.cpp ../GreenScreen/KeyPipeline.cpp ../GreenScreen/LayerStack.cpp ../GreenScreen/PixelKernels.cpp
+//      ../GreenScreen/PersonSegmenter.cpp ../GreenScreen/PixelKernelsNeon.cpp ../GreenScreen/PixelKernelsX86.cpp ../GreenScreen/RawDecoder.cpp ../GreenScreen/SimulatedBackends.cpp
+//      $(pkg-config --cflags --libs opencv4) -pthread -o burstbench
+//
+//  ./burstbench [shots] [strip|grid]
+
+#include "BurstComposer.h"
+#include "SimulatedBackends.h"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+using namespace GreenScreen;
+
+static double msSince(int64 startTick)
+{
+	return (cv::getTickCount() - startTick) * 1000.0 / cv::getTickFrequency();
+}
+
+int main(int argc, char** argv)
+{
+	int shots = argc > 1 ? atoi(argv[1]) : 4;
+	if (shots < 2 || shots > 8) shots = 4;
+	bool isGrid = argc > 2 && strcmp(argv[2], "grid") == 0;
+	stripLayout layout = isGrid ? gridLayout(2, (shots + 1) / 2) : photoStripLayout(shots);
+	shots = layout.shots();
+
+	//one encoded camera picture per shot, like the simulated camera sends them
+	std::vector<std::vector<unsigned char> > pictures(shots);
+	for (int i = 0; i < shots; i++)
+	{
+		cv::Mat scene(3456, 5184, CV_8UC3);
+		drawSimulatedScene(scene, i);
+		cv::imencode(".jpg", scene, pictures[i]);
+	}
+	cv::Mat theme(3456, 2304, CV_8UC3, cv::Scalar(40, 90, 200));
+	cv::Mat frame(3456, 2304, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+	cv::rectangle(frame, cv::Rect(0, 0, 2304, 200), cv::Scalar(255, 255, 255, 255), -1);
+
+	keySettings key;
+	memset(&key, 0, sizeof(key));
+	key.xCoordSample = 10;
+	key.yCoordSample = 10;
+	key.hueVar = 20;
+	key.saturationVar = 50;
+	key.valueVar = 65;
+	key.mode = keyModeColor;
+
+	//old path: every shot composed at print size after its download
+	KeyPipeline pipeline;
+	cv::Mat background = theme.clone();
+	cv::Mat foreground = frame.clone();
+	cv::Mat out;
+	int64 tick = cv::getTickCount();
+	for (int i = 0; i < shots; i++)
+	{
+		pipeline.composePrint(&pictures[i][0], pictures[i].size(), key, background, foreground, false, out);
+	}
+	double singleMs = msSince(tick);
+
+	//burst: the first run sizes the arenas, the second is timed
+	BurstComposer burst;
+	cv::Mat page;
+	burstTimings timings;
+	for (int run = 0; run < 2; run++)
+	{
+		std::vector<std::vector<unsigned char> > handed = pictures;
+		tick = cv::getTickCount();
+		burst.begin(layout, key, theme, frame);
+		for (int i = 0; i < shots; i++)
+		{
+			burst.addShot(handed[i]);
+		}
+		burst.finish(page, &timings);
+	}
+	double burstMs = msSince(tick);
+
+	printf("%d shots, %s page %dx%d, cell %dx%d\n", shots, isGrid ? "grid" : "strip", layout.pageWidth, layout.pageHeight,
+		stripCell(layout, 0, 0).width, stripCell(layout, 0, 0).height);
+	printf("  one at a time at print size: %.1f ms (%.1f ms per shot)\n", singleMs, singleMs / shots);
+	printf("  burst page, all shots handed over at once: %.1f ms, slowest shot %.1f ms\n", burstMs, timings.slowestShotMs);
+	cv::imwrite("burst_page.jpg", page);
+	return 0;
+}
@@ -0,0 +1,271 @@
+/*
+* CompositeDaemon.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+//the compositing service without the booth, and a client for it
+//serve listens on the socket until q and enter, enter alone prints the stats
+//send composes one picture and writes the result, stats asks a running service
+//load runs clients in parallel against the service, each with requests in flight, and prints the latencies
+//
+//build on linux from source/Tools:
+//  g++ -O2 -std=c++14 -I../GreenScreen CompositeDaemon.cpp ../GreenScreen/CleanPlate.cpp ../GreenScreen/CompositeService.cpp
+//      ../GreenScreen/EmbeddedPreview.cpp ../GreenScreen/FrameArena.cpp ../GreenScreen/KeyPipeline.cpp ../GreenScreen/LayerStack.cpp ../GreenScreen/PixelKernels.cpp
+//      ../GreenScreen/PersonSegmenter.cpp ../GreenScreen/PixelKernelsNeon.cpp ../GreenScreen/PixelKernelsX86.cpp ../GreenScreen/RawDecoder.cpp ../GreenScreen/SimulatedBackends.cpp
+//      $(pkg-config --cflags --libs opencv4) -pthread -o compositor
+//
+//  ./compositor serve [workers] [socket] [themes]                  (themes is the folder of the theme pictures, Resource by default)
+//  ./compositor send picture.jpg background.png foreground.png out.jpg [width height] [socket]    (theme paths relative to it)
+//  ./compositor stats [socket]
+//  ./compositor load [clients] [requests] [inflight] [socket] [themes]    (simulated pictures, the themes are written to the folder)
+
+#include "CompositeService.h"
+#include "PixelKernels.h"
+#include "SimulatedBackends.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+using namespace GreenScreen;
+
+static double msSince(int64 startTick)
+{
+	return (cv::getTickCount() - startTick) * 1000.0 / cv::getTickFrequency();
+}
+
+static bool readFile(const char* path, std::vector<unsigned char>& data)
+{
+	FILE* f = fopen(path, "rb");
+	if (!f) return false;
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	data.resize(length > 0 ? length : 0);
+	size_t got = length > 0 ? fread(&data[0], 1, length, f) : 0;
+	fclose(f);
+	return length > 0 && got == (size_t)length;
+}
+
+//the key the form starts with
+static keySettings defaultKey()
+{
+	keySettings key;
+	key.xCoordSample = 10;
+	key.yCoordSample = 10;
+	key.hueVar = 20;
+	key.saturationVar = 50;
+	key.valueVar = 65;
+	key.mode = keyModeColor;
+	key.plateThreshold = 4.0f;
+	key.sampleWidth = 0;
+	key.sampleHeight = 0;
+	return key;
+}
+
+static int serve(int workers, const std::string& socketPath, const std::string& themeFolder)
+{
+	std::string kernelLog;
+	selectPixelKernels("", &kernelLog);
+	printf("%s\n", kernelLog.c_str());
+
+	CompositeService service;
+	if (!service.start(socketPath, themeFolder, workers))
+	{
+		printf("could not listen on %s with the themes of %s\n", socketPath.c_str(), themeFolder.c_str());
+		return 1;
+	}
+	printf("compositing the themes of %s on %s, enter prints the stats, q and enter stops\n", themeFolder.c_str(), socketPath.c_str());
+	std::string line;
+	while (std::getline(std::cin, line) && line != "q")
+	{
+		printf("%s", service.statsText().c_str());
+	}
+	printf("%s", service.statsText().c_str());
+	service.stop();
+	return 0;
+}
+
+static int send(int argc, char** argv)
+{
+	if (argc < 6)
+	{
+		printf("send picture.jpg background.png foreground.png out.jpg [width height] [socket]\n");
+		return 1;
+	}
+	compositeRequest request = compositeRequest();
+	request.type = compositeComposeRequest;
+	request.id = 1;
+	request.key = defaultKey();
+	request.backgroundPath = argv[3];
+	request.foregroundPath = argv[4];
+	if (!readFile(argv[2], request.picture))
+	{
+		printf("could not read %s\n", argv[2]);
+		return 1;
+	}
+	if (argc > 7)
+	{
+		request.width = atoi(argv[6]);
+		request.height = atoi(argv[7]);
+	}
+	std::string out = argv[5];
+	if (out.size() > 4 && out.compare(out.size() - 4, 4, ".png") == 0) request.flags |= compositePng;
+
+	CompositeClient client;
+	std::string socketPath = argc > 8 ? argv[8] : defaultCompositeSocket();
+	int64 tick = cv::getTickCount();
+	compositeResponse response;
+	if (!client.connect(socketPath) || !client.send(request) || !client.receive(response))
+	{
+		printf("no answer from %s\n", socketPath.c_str());
+		return 1;
+	}
+	if (response.status != compositeOk)
+	{
+		printf("status %u\n", response.status);
+		return 1;
+	}
+	FILE* f = fopen(out.c_str(), "wb");
+	if (!f || fwrite(&response.body[0], 1, response.body.size(), f) != response.body.size())
+	{
+		if (f) fclose(f);
+		printf("could not write %s\n", out.c_str());
+		return 1;
+	}
+	fclose(f);
+	printf("%dx%d in %.1f ms (queue %.1f ms, compose %.1f ms)\n", response.width, response.height, msSince(tick), response.queueMs, response.composeMs);
+	return 0;
+}
+
+static int stats(const std::string& socketPath)
+{
+	compositeRequest request = compositeRequest();
+	request.type = compositeStatsRequest;
+	CompositeClient client;
+	compositeResponse response;
+	if (!client.connect(socketPath) || !client.send(request) || !client.receive(response))
+	{
+		printf("no answer from %s\n", socketPath.c_str());
+		return 1;
+	}
+	printf("%.*s", (int)response.body.size(), (const char*)&response.body[0]);
+	return 0;
+}
+
+static int load(int clients, int requests, int inflight, const std::string& socketPath, const std::string& themeFolder)
+{
+	//two themes and one camera picture, every second request wants a quick composite at live size
+	//the themes go into the folder the service was started with, the requests name them relative to it
+	const char* themes[2][2] = { { "gs_theme0_bg.png", "gs_theme0_fg.png" }, { "gs_theme1_bg.png", "gs_theme1_fg.png" } };
+	for (int t = 0; t < 2; t++)
+	{
+		cv::imwrite(themeFolder + "/" + themes[t][0], cv::Mat(3456, 2304, CV_8UC3, cv::Scalar(40 + t * 100, 90, 200)));
+		cv::Mat frame(3456, 2304, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+		cv::rectangle(frame, cv::Rect(0, 0, 2304, 200), cv::Scalar(255, 255, 255, 255), -1);
+		cv::imwrite(themeFolder + "/" + themes[t][1], frame);
+	}
+	cv::Mat scene(3456, 5184, CV_8UC3);
+	drawSimulatedScene(scene, 0);
+	std::vector<unsigned char> picture;
+	cv::imencode(".jpg", scene, picture);
+
+	std::atomic<int> ok(0), failed(0);
+	std::vector<double> latencies;
+	std::mutex latencyLock;
+	int64 tick = cv::getTickCount();
+	std::vector<std::thread> threads;
+	for (int c = 0; c < clients; c++)
+	{
+		threads.push_back(std::thread([&, c]()
+		{
+			CompositeClient client;
+			if (!client.connect(socketPath))
+			{
+				failed += requests;
+				return;
+			}
+			std::vector<int64> sent(requests);
+			int next = 0;
+			int received = 0;
+			while (received < requests)
+			{
+				//keep inflight requests on the socket
+				while (next < requests && next - received < inflight)
+				{
+					compositeRequest request = compositeRequest();
+					request.type = compositeComposeRequest;
+					request.id = (uint32_t)next;
+					request.key = defaultKey();
+					request.backgroundPath = themes[(c + next) % 2][0];
+					request.foregroundPath = themes[(c + next) % 2][1];
+					if (next % 2 == 1)
+					{
+						request.width = 467;
+						request.height = 700;
+					}
+					request.picture = picture;
+					sent[next] = cv::getTickCount();
+					if (!client.send(request)) break;
+					next++;
+				}
+				compositeResponse response;
+				if (!client.receive(response)) break;
+				received++;
+				if (response.status != compositeOk || response.id >= (uint32_t)requests)
+				{
+					failed++;
+					continue;
+				}
+				ok++;
+				std::lock_guard<std::mutex> lock(latencyLock);
+				latencies.push_back(msSince(sent[response.id]));
+			}
+			failed += requests - received;
+		}));
+	}
+	for (size_t i = 0; i < threads.size(); i++) threads[i].join();
+	double totalMs = msSince(tick);
+
+	std::sort(latencies.begin(), latencies.end());
+	printf("%d clients x %d requests, %d in flight each: %d ok, %d failed in %.0f ms, %.1f composites/s\n",
+		clients, requests, inflight, ok.load(), failed.load(), totalMs, ok * 1000.0 / totalMs);
+	if (!latencies.empty())
+	{
+		printf("client latency p50 %.1f p90 %.1f p99 %.1f ms\n", latencies[latencies.size() / 2],
+			latencies[latencies.size() * 9 / 10], latencies[std::min(latencies.size() - 1, latencies.size() * 99 / 100)]);
+	}
+	return stats(socketPath);
+}
+
+int main(int argc, char** argv)
+{
+	std::string mode = argc > 1 ? argv[1] : "";
+	if (mode == "serve") return serve(argc > 2 ? atoi(argv[2]) : 0, argc > 3 ? argv[3] : defaultCompositeSocket(), argc > 4 ? argv[4] : "Resource");
+	if (mode == "send") return send(argc, argv);
+	if (mode == "stats") return stats(argc > 2 ? argv[2] : defaultCompositeSocket());
+	if (mode == "load")
+	{
+		int clients = argc > 2 ? atoi(argv[2]) : 4;
+		int requests = argc > 3 ? atoi(argv[3]) : 20;
+		int inflight = argc > 4 ? atoi(argv[4]) : 2;
+		return load(std::max(1, clients), std::max(1, requests), std::max(1, inflight), argc > 5 ? argv[5] : defaultCompositeSocket(),
+			argc > 6 ? argv[6] : "Resource");
+	}
+	printf("compositor serve|send|stats|load, see the top of CompositeDaemon.cpp\n");
+	return 1;
+}
@@ -0,0 +1,177 @@
+/*
+* LayerBench.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+//theme layers over the keyed picture: one full frame overlayImage per layer over the subject (what every extra
+//layer would have cost) against the compiled stack, all layers flattened into one overlay and blended in one pass
+//over the covered tiles only (blendLayers)
+//the theme has a frame, a logo, a sponsor strip at 80% and a date stamp, at the live size and at print size
+//prints the time per frame of both and the largest difference of any channel between the two pictures,
+//flattening rounds once where the sequential blends round per layer, so a difference of a level or two is expected
+//
+//build on linux from source/Tools:
+//  g++ -O2 -std=c++14 -I../GreenScreen LayerBench.cpp ../GreenScreen/CleanPlate.cpp ../GreenScreen/EmbeddedPreview.cpp ../GreenScreen/FrameArena.cpp
+//      ../GreenScreen/KeyPipeline.cpp ../GreenScreen/LayerStack.cpp ../GreenScreen/PersonSegmenter.cpp ../GreenScreen/PixelKernels.cpp ../GreenScreen/PixelKernelsNeon.cpp
+//      ../GreenScreen/PixelKernelsX86.cpp ../GreenScreen/RawDecoder.cpp ../GreenScreen/SimulatedBackends.cpp $(pkg-config --cflags --libs opencv4) -pthread -o layerbench
+//
+//  ./layerbench [frames]
+
+#include "KeyPipeline.h"
+#include "LayerStack.h"
+#include "SimulatedBackends.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+
+using namespace GreenScreen;
+
+static double msPerFrame(int64 startTick, int frames)
+{
+	return (cv::getTickCount() - startTick) * 1000.0 / cv::getTickFrequency() / frames;
+}
+
+static layerSpec benchLayer(int kind, float x, float y, float width, float height, float opacity)
+{
+	layerSpec layer;
+	layer.kind = kind;
+	layer.x = x;
+	layer.y = y;
+	layer.width = width;
+	layer.height = height;
+	layer.opacity = opacity;
+	layer.colour = cv::Scalar(255, 255, 255);
+	return layer;
+}
+
+//largest difference of any channel and how many pixels differ at all
+static int maxDifference(const cv::Mat& a, const cv::Mat& b, long long& pixels)
+{
+	int largest = 0;
+	pixels = 0;
+	for (int y = 0; y < a.rows; y++)
+	{
+		const uchar* ra = a.ptr<uchar>(y);
+		const uchar* rb = b.ptr<uchar>(y);
+		for (int x = 0; x < a.cols; x++)
+		{
+			int pixel = 0;
+			for (int c = 0; c < 3; c++) pixel = std::max(pixel, std::abs(ra[x * 3 + c] - rb[x * 3 + c]));
+			if (pixel > 0) pixels++;
+			largest = std::max(largest, pixel);
+		}
+	}
+	return largest;
+}
+
+int main(int argc, char** argv)
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 200;
+	if (frames <= 0) frames = 200;
+
+	//theme pictures at print size: a background, a frame with a clear window and soft inner edge, a logo with a round alpha
+	cv::Mat background(3456, 2304, CV_8UC3, cv::Scalar(40, 90, 200));
+	cv::Mat foreground(3456, 2304, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+	for (int inset = 0; inset < 160; inset++)
+	{
+		uchar alpha = (uchar)(inset < 120 ? 255 : 255 - (inset - 120) * 6);
+		cv::rectangle(foreground, cv::Rect(inset, inset, 2304 - 2 * inset, 3456 - 2 * inset), cv::Scalar(255, 255, 255, alpha), 1);
+	}
+	cv::Mat logo(400, 400, CV_8UC4, cv::Scalar(0, 0, 0, 0));
+	cv::circle(logo, cv::Point(200, 200), 190, cv::Scalar(30, 200, 250, 255), -1, cv::LINE_AA);
+	cv::Mat sponsor(200, 2304, CV_8UC3, cv::Scalar(20, 20, 20));
+	cv::putText(sponsor, "SPONSOR", cv::Point(900, 140), cv::FONT_HERSHEY_SIMPLEX, 4, cv::Scalar(255, 255, 255), 8, cv::LINE_AA);
+	cv::imwrite("layerbench_logo.png", logo);
+	cv::imwrite("layerbench_sponsor.png", sponsor);
+
+	std::vector<layerSpec> layers;
+	layers.push_back(benchLayer(layerBackground, 0, 0, 0, 0, 1));
+	layers.push_back(benchLayer(layerSubject, 0, 0, 0, 0, 1));
+	layers.push_back(benchLayer(layerForeground, 0, 0, 0, 0, 1));
+	layers.push_back(benchLayer(layerImage, 0.72f, 0.04f, 0.22f, 0, 1));
+	layers.back().path = "layerbench_logo.png";
+	layers.push_back(benchLayer(layerImage, 0, 0.9f, 1, 0.06f, 0.8f));
+	layers.back().path = "layerbench_sponsor.png";
+	layers.push_back(benchLayer(layerText, 0.06f, 0.84f, 0, 0.025f, 1));
+	layers.back().text = "{date}";
+
+	std::string log;
+	LayerStack stack;
+	stack.load(layers, ".", background, foreground, &log);
+	if (!log.empty()) printf("%s", log.c_str());
+
+	//the sequential path: every layer over the subject compiled alone, so it is the same picture at the same place,
+	//and blended over the whole frame with overlayImage one after the other
+	std::vector<LayerStack> singles;
+	for (size_t i = 0; i < layers.size(); i++)
+	{
+		if (layers[i].kind == layerBackground || layers[i].kind == layerSubject) continue;
+		std::vector<layerSpec> alone;
+		alone.push_back(layers[0]);
+		alone.push_back(layers[1]);
+		alone.push_back(layers[i]);
+		singles.push_back(LayerStack());
+		singles.back().load(alone, ".", background, foreground);
+	}
+
+	cv::Size sizes[] = { cv::Size(467, 700), cv::Size(2304, 3456) };
+	const char* names[] = { "live", "print" };
+	printf("%s, %d frames per size\n\n", stack.describe().c_str(), frames);
+	for (int s = 0; s < 2; s++)
+	{
+		cv::Size size = sizes[s];
+		int runs = s == 0 ? frames : std::max(1, frames / 20);
+		cv::Mat subject(size, CV_8UC3);
+		drawSimulatedScene(subject, 0);
+
+		//compiled once per size and kept, like the live frames and the print find them
+		std::shared_ptr<const compiledLayers> fused = stack.at(size);
+		std::vector<std::shared_ptr<const compiledLayers> > sequential;
+		for (size_t i = 0; i < singles.size(); i++) sequential.push_back(singles[i].at(size));
+
+		cv::Mat sequentialOut;
+		int64 tick = cv::getTickCount();
+		for (int f = 0; f < runs; f++)
+		{
+			subject.copyTo(sequentialOut);
+			for (size_t i = 0; i < sequential.size(); i++) overlayImage(sequentialOut, sequential[i]->overlay, sequentialOut, cv::Point2i(0, 0));
+		}
+		double sequentialMs = msPerFrame(tick, runs);
+
+		cv::Mat fusedOut;
+		tick = cv::getTickCount();
+		for (int f = 0; f < runs; f++)
+		{
+			subject.copyTo(fusedOut);
+			blendLayers(fusedOut, *fused);
+		}
+		double fusedMs = msPerFrame(tick, runs);
+
+		//the copy of the subject is in both, measured alone so the blend times can be told apart
+		cv::Mat copied;
+		tick = cv::getTickCount();
+		for (int f = 0; f < runs; f++) subject.copyTo(copied);
+		double copyMs = msPerFrame(tick, runs);
+
+		long long differing = 0;
+		int largest = maxDifference(sequentialOut, fusedOut, differing);
+		printf("%s %dx%d, %d layers over the subject, %.0f%% of the frame in %d runs, compiled in %.1f ms\n", names[s], size.width, size.height,
+			fused->overlayLayers, fused->coverage * 100, (int)fused->runs.size(), fused->compileMs);
+		printf("  overlayImage per layer: %.3f ms/frame\n", sequentialMs - copyMs);
+		printf("  blendLayers:            %.3f ms/frame, %.1fx\n", fusedMs - copyMs, (sequentialMs - copyMs) / std::max(0.001, fusedMs - copyMs));
+		printf("  largest difference %d, %lld pixels (%.3f%%) differ\n\n", largest, differing, 100.0 * differing / size.area());
+	}
+	return 0;
+}
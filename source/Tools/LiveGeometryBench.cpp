@@ -0,0 +1,102 @@
+/*
+* LiveGeometryBench.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+//live view geometry per frame: scale the whole EVF frame then crop (the old path)
+//against crop the source roi first and remap it with the cached tables (computeLiveGeometry)
+//prints the pixels read and written by the resample and the time per frame for each live layout
+//
+//build on linux from source/Tools:
+//  g++ -O2 -std=c++14 -I../GreenScreen LiveGeometryBench.cpp ../GreenScreen/CleanPlate.cpp ../GreenScreen/EmbeddedPreview.cpp ../GreenScreen/FrameArena.cpp
+//      ../GreenScreen/KeyPipeline.cpp ../GreenScreen/LayerStack.cpp ../GreenScreen/PersonSegmenter.cpp ../GreenScreen/PixelKernels.cpp ../GreenScreen/PixelKernelsNeon.cpp
+//      ../GreenScreen/PixelKernelsX86.cpp ../GreenScreen/RawDecoder.cpp ../GreenScreen/SimulatedBackends.cpp $(pkg-config --cflags --libs opencv4) -pthread -o livebench
+//
+//  ./livebench [frames]
+
+#include "KeyPipeline.h"
+#include "SimulatedBackends.h"
+#include <cstdio>
+#include <cstdlib>
+
+using namespace GreenScreen;
+
+struct benchLayout
+{
+	const char* name;
+	cv::Size source;
+	int liveWidth;
+	int liveHeight;
+	bool isWideScreen;
+};
+
+static double msPerFrame(int64 startTick, int frames)
+{
+	return (cv::getTickCount() - startTick) * 1000.0 / cv::getTickFrequency() / frames;
+}
+
+int main(int argc, char** argv)
+{
+	int frames = argc > 1 ? atoi(argv[1]) : 2000;
+	if (frames <= 0) frames = 2000;
+
+	//EVF sizes of the 600D/700D and the live sizes the form picks for 2:3 and 4:5 portrait and 3:2 wide themes
+	benchLayout layouts[] = {
+		{ "portrait 2:3, evf 960x640", cv::Size(960, 640), 467, 700, false },
+		{ "portrait 4:5, evf 960x640", cv::Size(960, 640), 560, 700, false },
+		{ "portrait 2:3, evf 1056x704", cv::Size(1056, 704), 467, 700, false },
+		{ "wide 3:2, evf 960x640", cv::Size(960, 640), 700, 467, true },
+	};
+
+	printf("%d frames per layout\n\n", frames);
+	for (size_t i = 0; i < sizeof(layouts) / sizeof(layouts[0]); i++)
+	{
+		const benchLayout& layout = layouts[i];
+		cv::Mat frame(layout.source, CV_8UC3);
+		drawSimulatedScene(frame, 0);
+
+		//old path: scale the full frame to the live height, then take the centre
+		int fitWidth = layout.isWideScreen ? layout.liveWidth : cvRound(layout.source.width * layout.liveHeight / (double)layout.source.height);
+		cv::Mat fitted(layout.liveHeight, fitWidth, CV_8UC3);
+		int64 tick = cv::getTickCount();
+		for (int f = 0; f < frames; f++)
+		{
+			cv::resize(frame, fitted, cv::Size(fitWidth, layout.liveHeight));
+		}
+		double scaleThenCropMs = msPerFrame(tick, frames);
+		long long oldRead = (long long)layout.source.area();
+		long long oldWritten = (long long)fitWidth * layout.liveHeight;
+
+		//new path: geometry once, then remap only the visible roi
+		tick = cv::getTickCount();
+		liveGeometry geometry;
+		computeLiveGeometry(layout.source, layout.liveWidth, layout.liveHeight, layout.isWideScreen, geometry);
+		double geometryMs = msPerFrame(tick, 1);
+		cv::Mat live(layout.liveHeight, layout.liveWidth, CV_8UC3);
+		tick = cv::getTickCount();
+		for (int f = 0; f < frames; f++)
+		{
+			applyLiveGeometry(frame, geometry, live);
+		}
+		double cropThenScaleMs = msPerFrame(tick, frames);
+		long long newRead = (long long)geometry.sourceRoi.area();
+		long long newWritten = (long long)layout.liveWidth * layout.liveHeight;
+
+		printf("%s -> live %dx%d\n", layout.name, layout.liveWidth, layout.liveHeight);
+		printf("  scale then crop: %7lld px read, %7lld px written, %.3f ms/frame\n", oldRead, oldWritten, scaleThenCropMs);
+		printf("  crop then scale: %7lld px read, %7lld px written, %.3f ms/frame (tables built once in %.2f ms)\n", newRead, newWritten, cropThenScaleMs, geometryMs);
+		printf("  resampled pixels: -%.0f%%, time: -%.0f%%\n\n", 100.0 * (oldWritten - newWritten) / oldWritten,
+			100.0 * (scaleThenCropMs - cropThenScaleMs) / scaleThenCropMs);
+	}
+	return 0;
+}
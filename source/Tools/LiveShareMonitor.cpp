@@ -0,0 +1,232 @@
+/*
+* LiveShareMonitor.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+//reads the live composite ring the form publishes and reports what a consumer gets:
+//delivered fps, frames missed between polls, torn reads and the latency from the live download
+//(capture) and from the end of the copy into the ring (publish) to the moment the reader has used the pixels
+//every pixel is read in place, nothing is copied out of the shared memory
+//
+//  --publish runs a writer with synthetic frames instead, to try the ring without the camera
+//
+//build on linux from source/Tools:
+//  g++ -O2 -std=c++14 -I../GreenScreen LiveShareMonitor.cpp ../GreenScreen/LiveShare.cpp -pthread -o livemonitor
+//
+//  ./livemonitor [--name GreenScreenLive] [--seconds 10] [--csv file]
+//  ./livemonitor --publish [--name GreenScreenLive] [--seconds 10] [--fps 30] [--size 467x700]
+
+#include "LiveShare.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace GreenScreen;
+
+struct monitorOptions
+{
+	std::string name;
+	double seconds;
+	bool isPublisher;
+	int fps;
+	int width;
+	int height;
+	const char* csvPath;
+};
+
+static bool parseOptions(int argc, char** argv, monitorOptions& options)
+{
+	options.name = "GreenScreenLive";
+	options.seconds = 10;
+	options.isPublisher = false;
+	options.fps = 30;
+	options.width = 467;
+	options.height = 700;
+	options.csvPath = NULL;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--publish") options.isPublisher = true;
+		else if (arg == "--name" && hasValue) options.name = argv[++i];
+		else if (arg == "--seconds" && hasValue) options.seconds = atof(argv[++i]);
+		else if (arg == "--fps" && hasValue) options.fps = atoi(argv[++i]);
+		else if (arg == "--csv" && hasValue) options.csvPath = argv[++i];
+		else if (arg == "--size" && hasValue)
+		{
+			if (sscanf(argv[++i], "%dx%d", &options.width, &options.height) != 2) return false;
+		}
+		else return false;
+	}
+	return options.seconds > 0 && options.fps > 0 && options.width > 0 && options.height > 0;
+}
+
+static double percentile(std::vector<double>& values, double p)
+{
+	if (values.empty()) return 0;
+	size_t n = (size_t)(p * (values.size() - 1));
+	std::nth_element(values.begin(), values.begin() + n, values.end());
+	return values[n];
+}
+
+static double average(const std::vector<double>& values)
+{
+	double sum = 0;
+	for (size_t i = 0; i < values.size(); i++) sum += values[i];
+	return values.empty() ? 0 : sum / values.size();
+}
+
+static int runPublisher(const monitorOptions& options)
+{
+	LiveSharePublisher publisher;
+	if (!publisher.open(options.name, options.width, options.height))
+	{
+		fprintf(stderr, "could not create the ring %s\n", options.name.c_str());
+		return 1;
+	}
+	std::vector<unsigned char> frame((size_t)options.width * options.height * 3);
+	int64_t periodUs = 1000000 / options.fps;
+	int64_t startUs = liveShareClockUs();
+	int64_t nextUs = startUs;
+	int64_t worstUs = 0;
+	for (uint64_t n = 0; liveShareClockUs() - startUs < (int64_t)(options.seconds * 1000000); n++)
+	{
+		//a moving gradient stands in for the composite
+		int64_t captureUs = liveShareClockUs();
+		for (int y = 0; y < options.height; y++)
+		{
+			memset(&frame[(size_t)y * options.width * 3], (int)((y + n) & 255), (size_t)options.width * 3);
+		}
+		int64_t publishStartUs = liveShareClockUs();
+		publisher.publish(&frame[0], options.width, options.height, options.width * 3, liveShareBGR24, captureUs);
+		worstUs = std::max(worstUs, liveShareClockUs() - publishStartUs);
+
+		nextUs += periodUs;
+		int64_t waitUs = nextUs - liveShareClockUs();
+		if (waitUs > 0) std::this_thread::sleep_for(std::chrono::microseconds(waitUs));
+	}
+	printf("published %llu frames of %dx%d, slowest publish %.3f ms\n", (unsigned long long)publisher.published(),
+		options.width, options.height, worstUs / 1000.0);
+	return 0;
+}
+
+static int runMonitor(const monitorOptions& options)
+{
+	LiveShareReader reader;
+	FILE* csv = options.csvPath ? fopen(options.csvPath, "w") : NULL;
+	if (csv) fprintf(csv, "sequence,capture_to_read_ms,publish_to_read_ms,missed,torn\n");
+
+	std::vector<double> captureLatency;
+	std::vector<double> publishLatency;
+	uint64_t lastSequence = 0;
+	uint64_t delivered = 0;
+	uint64_t missed = 0;
+	uint64_t torn = 0;
+	uint64_t checksum = 0;
+	uint64_t secondDelivered = 0;
+	int64_t startUs = liveShareClockUs();
+	int64_t secondUs = startUs;
+	int64_t lastFrameUs = startUs;
+	int64_t firstFrameUs = 0;
+
+	while (liveShareClockUs() - startUs < (int64_t)(options.seconds * 1000000))
+	{
+		//no ring yet, or the writer restarted and left this one behind
+		if (!reader.isOpen() || liveShareClockUs() - lastFrameUs > 2000000)
+		{
+			if (reader.open(options.name))
+			{
+				lastSequence = reader.latestSequence();
+				lastFrameUs = liveShareClockUs();
+			}
+			else
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(100));
+				continue;
+			}
+		}
+
+		liveShareFrame frame;
+		if (!reader.acquireLatest(lastSequence, frame))
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(500));
+			continue;
+		}
+
+		//use every pixel where it is, a real consumer would hand these rows to its encoder
+		uint64_t sum = 0;
+		for (int y = 0; y < frame.height; y++)
+		{
+			const unsigned char* row = frame.pixels + (size_t)y * frame.stride;
+			for (int x = 0; x < frame.width * 3; x++) sum += row[x];
+		}
+		int64_t readUs = liveShareClockUs();
+		bool isTorn = !reader.isStillValid(frame);
+		uint64_t gap = lastSequence > 0 && frame.sequence > lastSequence + 1 ? frame.sequence - lastSequence - 1 : 0;
+		lastSequence = frame.sequence;
+		lastFrameUs = readUs;
+		if (isTorn)
+		{
+			torn++;
+			continue;
+		}
+		if (firstFrameUs == 0) firstFrameUs = readUs;
+		checksum += sum;
+		missed += gap;
+		delivered++;
+		secondDelivered++;
+		double fromCapture = (readUs - frame.captureUs) / 1000.0;
+		double fromPublish = (readUs - frame.publishUs) / 1000.0;
+		captureLatency.push_back(fromCapture);
+		publishLatency.push_back(fromPublish);
+		if (csv) fprintf(csv, "%llu,%.3f,%.3f,%llu,%d\n", (unsigned long long)frame.sequence, fromCapture, fromPublish, (unsigned long long)gap, isTorn ? 1 : 0);
+
+		if (readUs - secondUs >= 1000000)
+		{
+			printf("%6.1f fps, %dx%d, capture to read %.2f ms\n", secondDelivered * 1000000.0 / (readUs - secondUs), frame.width, frame.height, fromCapture);
+			secondDelivered = 0;
+			secondUs = readUs;
+		}
+	}
+	if (csv) fclose(csv);
+
+	if (delivered == 0)
+	{
+		printf("no frames from %s\n", options.name.c_str());
+		return 1;
+	}
+	double activeSeconds = (lastFrameUs - firstFrameUs) / 1000000.0;
+	printf("\n%llu frames delivered, %.1f fps, %llu missed, %llu torn (checksum %llu)\n", (unsigned long long)delivered,
+		activeSeconds > 0 ? (delivered - 1) / activeSeconds : 0.0, (unsigned long long)missed, (unsigned long long)torn, (unsigned long long)checksum);
+	printf("capture to read: avg %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", average(captureLatency),
+		percentile(captureLatency, 0.5), percentile(captureLatency, 0.99), percentile(captureLatency, 1.0));
+	printf("publish to read: avg %.2f ms, p50 %.2f ms, p99 %.2f ms, max %.2f ms\n", average(publishLatency),
+		percentile(publishLatency, 0.5), percentile(publishLatency, 0.99), percentile(publishLatency, 1.0));
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	monitorOptions options;
+	if (!parseOptions(argc, argv, options))
+	{
+		fprintf(stderr, "usage: livemonitor [--publish] [--name n] [--seconds s] [--fps f] [--size WxH] [--csv file]\n");
+		return 2;
+	}
+	return options.isPublisher ? runPublisher(options) : runMonitor(options);
+}
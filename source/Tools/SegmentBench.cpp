@@ -0,0 +1,147 @@
+/*
+* SegmentBench.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+//person key on this machine: the time of one inference on the calling thread (what a print pays)
+//and the live matte rate, simulated live frames handed to the segmenter at 30 fps the way the form does,
+//with the guided upsample of the newest matte on the live thread
+//the person key is meant to keep 15 mattes a second on a 4 core booth pc, below that the subject trails the matte
+//
+//build on linux from source/Tools, with ONNX Runtime:
+//  g++ -O2 -std=c++14 -DGREENSCREEN_ONNXRUNTIME -I../GreenScreen -I<onnxruntime>/include SegmentBench.cpp ../GreenScreen/CleanPlate.cpp
+//      ../GreenScreen/EmbeddedPreview.cpp ../GreenScreen/FrameArena.cpp ../GreenScreen/KeyPipeline.cpp ../GreenScreen/LayerStack.cpp
+//      ../GreenScreen/PersonSegmenter.cpp ../GreenScreen/PixelKernels.cpp ../GreenScreen/PixelKernelsNeon.cpp ../GreenScreen/PixelKernelsX86.cpp
+//      ../GreenScreen/RawDecoder.cpp ../GreenScreen/SimulatedBackends.cpp $(pkg-config --cflags --libs opencv4) -L<onnxruntime>/lib -lonnxruntime -pthread -o segmentbench
+//  without -DGREENSCREEN_ONNXRUNTIME and the onnxruntime paths it measures the opencv dnn path
+//
+//  ./segmentbench selfie_segmentation.onnx [size] [seconds] [threads]
+
+#include "PersonSegmenter.h"
+#include "SimulatedBackends.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+using namespace GreenScreen;
+
+static double msSince(int64 startTick)
+{
+	return (cv::getTickCount() - startTick) * 1000.0 / cv::getTickFrequency();
+}
+
+static double percentile(std::vector<double> values, double fraction)
+{
+	if (values.empty()) return 0;
+	std::sort(values.begin(), values.end());
+	return values[std::min(values.size() - 1, (size_t)(fraction * values.size()))];
+}
+
+int main(int argc, char** argv)
+{
+	if (argc < 2)
+	{
+		printf("usage: segmentbench model.onnx [size] [seconds] [threads]\n");
+		return 2;
+	}
+	int size = argc > 2 ? atoi(argv[2]) : 256;
+	if (size < 32 || size > 1024) size = 256;
+	int seconds = argc > 3 ? atoi(argv[3]) : 10;
+	if (seconds <= 0) seconds = 10;
+	int threads = argc > 4 ? atoi(argv[4]) : 0;
+	const int liveFps = 30;
+	const float targetFps = 15;
+
+	if (!isSegmentationSupported())
+	{
+		printf("this build has no ONNX Runtime or opencv dnn\n");
+		return 1;
+	}
+	segmentationModel requested = selfieSegmentationModel(argv[1], cv::Size(size, size));
+	requested.threads = threads;
+	PersonSegmenter segmenter;
+	int64 tick = cv::getTickCount();
+	if (!segmenter.load(requested))
+	{
+		printf("could not load %s\n", argv[1]);
+		return 1;
+	}
+	double loadMs = msSince(tick);
+	const segmentationModel& model = segmenter.model();
+	printf("%s on %s, input %dx%d, %d cores, %s threads, loaded in %.0f ms\n\n", argv[1], segmentationBackend().c_str(),
+		model.input.width, model.input.height, (int)std::thread::hardware_concurrency(),
+		model.threads > 0 ? std::to_string(model.threads).c_str() : "default", loadMs);
+
+	//live sized frames of the simulated camera, a few variants so the network does not see one picture
+	std::vector<cv::Mat> frames;
+	for (int variant = 0; variant < 4; variant++)
+	{
+		cv::Mat frame(640, 960, CV_8UC3);
+		drawSimulatedScene(frame, variant);
+		frames.push_back(frame);
+	}
+
+	//one inference at a time on this thread, what the print and the burst cells wait for
+	std::vector<double> inferMs;
+	cv::Mat matte;
+	int64 benchStart = cv::getTickCount();
+	for (int i = 0; i < 200 && (i < 10 || msSince(benchStart) < seconds * 500.0); i++)
+	{
+		tick = cv::getTickCount();
+		if (!segmenter.infer(frames[i % frames.size()], matte))
+		{
+			printf("inference failed\n");
+			return 1;
+		}
+		inferMs.push_back(msSince(tick));
+	}
+	printf("infer: %d runs, p50 %.2f ms, p90 %.2f ms, %.1f inferences/s back to back\n", (int)inferMs.size(),
+		percentile(inferMs, 0.5), percentile(inferMs, 0.9), 1000.0 / percentile(inferMs, 0.5));
+
+	//live: submit every frame and upsample the newest matte, the worker drops what it cannot keep up with
+	FrameArena arena;
+	cv::Mat mask;
+	std::vector<double> liveMs;
+	unsigned int inferencesBefore = segmenter.inferences();
+	unsigned int droppedBefore = segmenter.dropped();
+	int submitted = 0;
+	auto frameTime = std::chrono::milliseconds(1000 / liveFps);
+	auto next = std::chrono::steady_clock::now();
+	int64 liveStart = cv::getTickCount();
+	while (msSince(liveStart) < seconds * 1000.0)
+	{
+		const cv::Mat& frame = frames[submitted % frames.size()];
+		tick = cv::getTickCount();
+		arena.reset();
+		segmenter.submit(frame);
+		if (segmenter.latestMatte(matte)) upsampleMatte(matte, frame, mask, arena);
+		liveMs.push_back(msSince(tick));
+		submitted++;
+		next += frameTime;
+		std::this_thread::sleep_until(next);
+	}
+	double liveSeconds = msSince(liveStart) / 1000.0;
+	unsigned int inferences = segmenter.inferences() - inferencesBefore;
+	unsigned int dropped = segmenter.dropped() - droppedBefore;
+	double matteFps = inferences / liveSeconds;
+	printf("live: %d frames at %d fps over %.1f s, live thread p50 %.2f ms p90 %.2f ms per frame\n", submitted, liveFps, liveSeconds,
+		percentile(liveMs, 0.5), percentile(liveMs, 0.9));
+	printf("  %u mattes, %.1f mattes/s, %u frames replaced before inference, last inference %.2f ms\n", inferences, matteFps,
+		dropped, segmenter.lastInferenceMs());
+	printf("\n%s: %.1f mattes/s against %.0f wanted on %d cores\n", matteFps >= targetFps ? "PASS" : "FAIL", matteFps, targetFps,
+		(int)std::thread::hardware_concurrency());
+	return matteFps >= targetFps ? 0 : 1;
+}
@@ -0,0 +1,493 @@
+/*
+* SoakHarness.cpp
+
+* Disclaimer: IMPORTANT: this software is supplied to you by Maniak Experiencial
+* in consideration of your agreement to the following terms, and your use,
+* installation, modification or redistribution of this software constitutes acceptance of these terms.
+* If you do not agree with these terms, please do not use, install, modify or redistribute this software.
+
+* you are able to use this code or binaries in free or commercial projects, under personal, non- exclusive
+* license, you must retain this notice and the following text and disclaimers in all such redistributions of the Software.
+* be used to endorse or promote products derived from this Software.
+
+* Author(s): Jorge Calleros Ramirez.
+*/
+
+//headless soak test of the booth loop: live view, capture, compose, save, print and journal, thousands of times
+//runs on the simulated camera and printer, so it needs neither the EDSDK nor windows
+//fails (exit code 1) when memory, handles or per cycle latency keep growing, or the arenas keep allocating blocks
+//reports the heap allocations of a warm live frame, with glibc every malloc of the frame including opencv's,
+//elsewhere only operator new, opencv's own buffers are not seen there
+//
+//build on linux from source/Tools:
+//  g++ -O2 -std=c++14 -pthread -I../GreenScreen SoakHarness.cpp ../GreenScreen/CaptureJournal.cpp ../GreenScreen/CleanPlate.cpp ../GreenScreen/EmbeddedPreview.cpp
+//      ../GreenScreen/FrameArena.cpp ../GreenScreen/KeyPipeline.cpp ../GreenScreen/LayerStack.cpp ../GreenScreen/OutputPyramid.cpp ../GreenScreen/PersonSegmenter.cpp
+//      ../GreenScreen/PixelKernels.cpp ../GreenScreen/PixelKernelsNeon.cpp ../GreenScreen/PixelKernelsX86.cpp
+//      ../GreenScreen/PrintJob.cpp ../GreenScreen/RawDecoder.cpp ../GreenScreen/SimulatedBackends.cpp $(pkg-config --cflags --libs opencv4) -o soak
+//
+//  ./soak --cycles 5000 --picture 2592x1728 --csv soak.csv
+
+#include "CaptureJournal.h"
+#include "KeyPipeline.h"
+#include "PixelKernels.h"
+#include "PrintJob.h"
+#include "SimulatedBackends.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <Windows.h>
+#include <Psapi.h>
+#include <process.h>
+#else
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+using namespace GreenScreen;
+
+//heap allocations made by the thread that set isCountingHeap, only the live loop does
+static thread_local bool isCountingHeap = false;
+static uint64_t heapAllocations = 0;
+
+static inline void countHeap()
+{
+	if (isCountingHeap) heapAllocations++;
+}
+
+#if defined(__GLIBC__)
+//malloc of the executable wins over the one of libc for every library, opencv and libstdc++ included
+extern "C"
+{
+	void* __libc_malloc(size_t size);
+	void* __libc_calloc(size_t count, size_t size);
+	void* __libc_realloc(void* p, size_t size);
+	void* __libc_memalign(size_t alignment, size_t size);
+
+	void* malloc(size_t size) noexcept { countHeap(); return __libc_malloc(size); }
+	void* calloc(size_t count, size_t size) noexcept { countHeap(); return __libc_calloc(count, size); }
+	void* realloc(void* p, size_t size) noexcept { countHeap(); return __libc_realloc(p, size); }
+	void* memalign(size_t alignment, size_t size) noexcept { countHeap(); return __libc_memalign(alignment, size); }
+	void* aligned_alloc(size_t alignment, size_t size) noexcept { countHeap(); return __libc_memalign(alignment, size); }
+	int posix_memalign(void** out, size_t alignment, size_t size) noexcept
+	{
+		countHeap();
+		*out = __libc_memalign(alignment, size);
+		return *out || size == 0 ? 0 : ENOMEM;
+	}
+}
+#else
+//the operator new of the harness and of the pipeline sources built into it, opencv allocates in its own dll
+void* operator new(size_t size)
+{
+	countHeap();
+	void* p = malloc(size ? size : 1);
+	if (!p) throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept
+{
+	free(p);
+}
+#endif
+
+struct soakOptions
+{
+	int cycles;
+	int warmup;				//cycles before the baseline window, arenas and caches fill up here
+	int liveFrames;			//live view frames between two captures
+	simulatedSettings hardware;
+	double maxRssGrowthMb;
+	int maxHandleGrowth;
+	double maxLatencyDrift;	//relative growth of the median cycle time
+	bool keepFiles;
+	std::string csvPath;
+	std::string kernels;	//empty for the fastest the cpu supports
+
+	soakOptions() : cycles(1000), warmup(20), liveFrames(30), maxRssGrowthMb(16), maxHandleGrowth(4),
+		maxLatencyDrift(0.25), keepFiles(false)
+	{
+		//fast hardware by default, the latencies only stretch the run
+		hardware.liveLatencyMs = 0;
+		hardware.shutterLatencyMs = 0;
+		hardware.transferLatencyMs = 0;
+		hardware.printLatencyMs = 0;
+	}
+};
+
+struct cycleSample
+{
+	float cycleMs;			//processing of the capture: compose + save + print
+	float liveMs;			//average live frame
+	double rssMb;
+	int handles;
+	uint64_t liveAllocations;
+	uint64_t printAllocations;
+	uint64_t liveHeapAllocations;	//over the live frames of the cycle
+};
+
+static double residentMb()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.WorkingSetSize / (1024.0 * 1024.0);
+#else
+	FILE* f = fopen("/proc/self/statm", "r");
+	if (!f) return 0;
+	long pages = 0, resident = 0;
+	int got = fscanf(f, "%ld %ld", &pages, &resident);
+	fclose(f);
+	if (got != 2) return 0;
+	return resident * (double)sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+#endif
+}
+
+static int openHandles()
+{
+#ifdef _WIN32
+	DWORD count = 0;
+	GetProcessHandleCount(GetCurrentProcess(), &count);
+	return (int)count;
+#else
+	DIR* dir = opendir("/proc/self/fd");
+	if (!dir) return 0;
+	int count = 0;
+	while (readdir(dir)) count++;
+	closedir(dir);
+	//., .. and the descriptor of the listing itself
+	return count - 3;
+#endif
+}
+
+static std::string makeWorkFolder()
+{
+#ifdef _WIN32
+	char temp[MAX_PATH];
+	GetTempPathA(MAX_PATH, temp);
+	std::string folder = std::string(temp) + "greenscreen-soak-" + std::to_string(_getpid());
+	CreateDirectoryA(folder.c_str(), NULL);
+	return folder;
+#else
+	char folder[] = "/tmp/greenscreen-soak-XXXXXX";
+	if (!mkdtemp(folder)) return "";
+	return folder;
+#endif
+}
+
+static void removeFolder(const std::string& folder)
+{
+#ifdef _WIN32
+	RemoveDirectoryA(folder.c_str());
+#else
+	rmdir(folder.c_str());
+#endif
+}
+
+static float msSince(int64 startTick)
+{
+	return (float)((cv::getTickCount() - startTick) * 1000.0 / cv::getTickFrequency());
+}
+
+static bool parseSize(const char* text, int& width, int& height)
+{
+	return sscanf(text, "%dx%d", &width, &height) == 2 && width > 0 && height > 0;
+}
+
+static void usage()
+{
+	printf("usage: soak [--cycles N] [--warmup N] [--live-frames N] [--picture WxH] [--live WxH]\n"
+		"            [--camera-latency MS] [--transfer-latency MS] [--live-latency MS] [--print-latency MS]\n"
+		"            [--max-rss-growth-mb MB] [--max-handle-growth N] [--max-latency-drift F]\n"
+		"            [--kernels scalar|sse2|avx2|avx512|neon] [--csv FILE] [--keep-files]\n");
+}
+
+static bool parseOptions(int argc, char** argv, soakOptions& options)
+{
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		const char* value = i + 1 < argc ? argv[i + 1] : NULL;
+		if (arg == "--keep-files") { options.keepFiles = true; continue; }
+		if (!value) return false;
+		i++;
+		if (arg == "--cycles") options.cycles = atoi(value);
+		else if (arg == "--warmup") options.warmup = atoi(value);
+		else if (arg == "--live-frames") options.liveFrames = atoi(value);
+		else if (arg == "--picture") { if (!parseSize(value, options.hardware.pictureWidth, options.hardware.pictureHeight)) return false; }
+		else if (arg == "--live") { if (!parseSize(value, options.hardware.liveWidth, options.hardware.liveHeight)) return false; }
+		else if (arg == "--camera-latency") options.hardware.shutterLatencyMs = atoi(value);
+		else if (arg == "--transfer-latency") options.hardware.transferLatencyMs = atoi(value);
+		else if (arg == "--live-latency") options.hardware.liveLatencyMs = atoi(value);
+		else if (arg == "--print-latency") options.hardware.printLatencyMs = atoi(value);
+		else if (arg == "--max-rss-growth-mb") options.maxRssGrowthMb = atof(value);
+		else if (arg == "--max-handle-growth") options.maxHandleGrowth = atoi(value);
+		else if (arg == "--max-latency-drift") options.maxLatencyDrift = atof(value);
+		else if (arg == "--csv") options.csvPath = value;
+		else if (arg == "--kernels") options.kernels = value;
+		else return false;
+	}
+	return options.cycles > 0 && options.warmup >= 0 && options.liveFrames >= 0;
+}
+
+//a background gradient and a BGRA frame with a transparent centre, like a theme of the Resource folder
+static void makeTheme(int width, int height, cv::Mat& background, cv::Mat& foreground)
+{
+	background.create(height, width, CV_8UC3);
+	for (int y = 0; y < height; y++)
+	{
+		cv::Vec3b* row = background.ptr<cv::Vec3b>(y);
+		for (int x = 0; x < width; x++)
+		{
+			row[x] = cv::Vec3b((uchar)(255 * x / width), 80, (uchar)(255 * y / height));
+		}
+	}
+	foreground.create(height, width, CV_8UC4);
+	foreground.setTo(cv::Scalar(0, 0, 0, 0));
+	int border = std::max(4, width / 40);
+	cv::rectangle(foreground, cv::Rect(0, 0, width, height), cv::Scalar(255, 255, 255, 255), border * 2);
+}
+
+static float median(std::vector<float> values)
+{
+	if (values.empty()) return 0;
+	std::nth_element(values.begin(), values.begin() + values.size() / 2, values.end());
+	return values[values.size() / 2];
+}
+
+//median latency, highest rss and handles of the cycles [first, last)
+struct windowStats
+{
+	float cycleMs;
+	double rssMb;
+	int handles;
+};
+
+static windowStats window(const std::vector<cycleSample>& samples, size_t first, size_t last)
+{
+	windowStats out = { 0, 0, 0 };
+	std::vector<float> latencies;
+	for (size_t i = first; i < last; i++)
+	{
+		latencies.push_back(samples[i].cycleMs);
+		out.rssMb = std::max(out.rssMb, samples[i].rssMb);
+		out.handles = std::max(out.handles, samples[i].handles);
+	}
+	out.cycleMs = median(latencies);
+	return out;
+}
+
+int main(int argc, char** argv)
+{
+	soakOptions options;
+	if (!parseOptions(argc, argv, options))
+	{
+		usage();
+		return 2;
+	}
+
+	std::string kernelLog;
+	selectPixelKernels(options.kernels, &kernelLog);
+	printf("%s\n", kernelLog.c_str());
+
+	std::string folder = makeWorkFolder();
+	if (folder.empty())
+	{
+		printf("could not create the work folder\n");
+		return 2;
+	}
+
+	SimulatedCamera camera(options.hardware);
+	SimulatedPrinter printer(options.hardware);
+	if (!camera.open() || !camera.startLiveView())
+	{
+		printf("could not open the simulated camera\n");
+		return 2;
+	}
+
+	KeyPipeline pipeline;
+	CaptureJournal journal;
+	std::string journalPath = folder + "/captures.journal";
+	journal.open(journalPath);
+
+	int liveWidth = options.hardware.liveWidth;
+	int liveHeight = options.hardware.liveHeight;
+	cv::Mat background, foreground, backgroundLive, foregroundLive;
+	makeTheme(options.hardware.pictureWidth, options.hardware.pictureHeight, background, foreground);
+	makeTheme(liveWidth, liveHeight, backgroundLive, foregroundLive);
+
+	keySettings key;
+	key.xCoordSample = 10;
+	key.yCoordSample = 10;
+	key.hueVar = 20;
+	key.saturationVar = 50;
+	key.valueVar = 65;
+	key.mode = keyModeColor;
+	key.plateThreshold = 4.0f;
+	key.sampleWidth = 0;
+	key.sampleHeight = 0;
+
+	FILE* csv = options.csvPath.empty() ? NULL : fopen(options.csvPath.c_str(), "w");
+	if (csv) fprintf(csv, "cycle,capture_ms,compose_ms,save_ms,print_ms,cycle_ms,live_ms,rss_mb,handles,live_block_allocations,print_block_allocations,live_heap_allocations\n");
+
+	printf("soak: %d cycles, picture %dx%d, live %dx%d, %d live frames per cycle, work folder %s\n",
+		options.cycles, options.hardware.pictureWidth, options.hardware.pictureHeight, liveWidth, liveHeight, options.liveFrames, folder.c_str());
+
+	std::vector<cycleSample> samples;
+	samples.reserve(options.cycles);
+	std::vector<unsigned char> picture;
+	int failedCycles = 0;
+	int64 runTick = cv::getTickCount();
+
+	for (int cycle = 0; cycle < options.cycles; cycle++)
+	{
+		//live view between captures, like the timer does
+		int64 liveTick = cv::getTickCount();
+		uint64_t heapBefore = heapAllocations;
+		isCountingHeap = true;
+		for (int i = 0; i < options.liveFrames; i++)
+		{
+			const unsigned char* data = NULL;
+			size_t bytes = 0;
+			cv::Mat composed;
+			if (camera.downloadLiveView(data, bytes))
+			{
+				pipeline.composeLive(data, bytes, key, backgroundLive, foregroundLive, liveWidth, liveHeight, true, composed);
+			}
+		}
+		isCountingHeap = false;
+		uint64_t liveHeap = heapAllocations - heapBefore;
+		float liveMs = options.liveFrames > 0 ? msSince(liveTick) / options.liveFrames : 0;
+
+		//capture -> compose -> save -> print -> journal
+		captureRecord record;
+		memset(&record, 0, sizeof(record));
+		int64 captureTick = cv::getTickCount();
+		camera.takePicture();
+		while (!camera.pollPicture(picture))
+		{
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		record.captureMs = msSince(captureTick);
+
+		//the preview the form shows while the print renders
+		cv::Mat preview;
+		pipeline.composePreview(&picture[0], picture.size(), key, backgroundLive, foregroundLive, liveWidth, liveHeight, true, preview);
+
+		uint64_t sequence = journal.isOpen() ? journal.reserveSequence() : (uint64_t)cycle + 1;
+		std::string name = "/green_" + std::to_string((unsigned long long)sequence);
+		printJob job;
+		job.key = key;
+		job.isWideScreen = true;
+		job.allowPrint = true;
+		job.paths.master = folder + name + ".png";
+		job.paths.screen = folder + name + "_screen.jpg";
+		job.paths.thumb = folder + name + "_thumb.jpg";
+
+		bool written = false;
+		bool printed = false;
+		if (!runPrintJob(pipeline, picture, job, background, foreground, &printer, record, NULL, &written, &printed) || !written || !printed)
+		{
+			failedCycles++;
+		}
+		if (journal.isOpen())
+		{
+			record.sequence = sequence;
+			journal.append(record);
+		}
+		if (!options.keepFiles)
+		{
+			remove(job.paths.master.c_str());
+			remove(job.paths.screen.c_str());
+			remove(job.paths.thumb.c_str());
+		}
+
+		cycleSample sample;
+		sample.cycleMs = record.composeMs + record.saveMs + record.printMs;
+		sample.liveMs = liveMs;
+		sample.rssMb = residentMb();
+		sample.handles = openHandles();
+		sample.liveAllocations = pipeline.liveArena().counters().blockAllocations;
+		sample.printAllocations = pipeline.printArena().counters().blockAllocations;
+		sample.liveHeapAllocations = liveHeap;
+		samples.push_back(sample);
+
+		if (csv)
+		{
+			fprintf(csv, "%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%.2f,%d,%llu,%llu,%llu\n", cycle, record.captureMs, record.composeMs, record.saveMs, record.printMs,
+				sample.cycleMs, sample.liveMs, sample.rssMb, sample.handles, (unsigned long long)sample.liveAllocations, (unsigned long long)sample.printAllocations,
+				(unsigned long long)sample.liveHeapAllocations);
+		}
+		if ((cycle + 1) % 100 == 0)
+		{
+			printf("cycle %d: %.1f ms per capture, %.2f ms per live frame, rss %.1f MB, %d handles\n",
+				cycle + 1, sample.cycleMs, sample.liveMs, sample.rssMb, sample.handles);
+			fflush(stdout);
+		}
+	}
+
+	if (csv) fclose(csv);
+	journal.close();
+	camera.close();
+	if (!options.keepFiles)
+	{
+		remove(journalPath.c_str());
+		removeFolder(folder);
+	}
+
+	//baseline right after the warmup against the end of the run
+	size_t cycles = samples.size();
+	size_t warmup = std::min((size_t)options.warmup, cycles / 2);
+	size_t span = std::max((size_t)1, std::min((size_t)std::max(options.cycles / 10, 20), (cycles - warmup) / 2));
+	windowStats first = window(samples, warmup, warmup + span);
+	windowStats last = window(samples, cycles - span, cycles);
+
+	//the journal is a mapped file and its pages count as resident, that growth is expected
+	double journalMb = (cycles - warmup) * sizeof(captureRecord) / (1024.0 * 1024.0);
+	double rssGrowth = last.rssMb - first.rssMb - journalMb;
+	int handleGrowth = last.handles - first.handles;
+	double drift = first.cycleMs > 0 ? (last.cycleMs - first.cycleMs) / first.cycleMs : 0;
+	uint64_t liveAllocations = samples.back().liveAllocations - samples[warmup].liveAllocations;
+	uint64_t printAllocations = samples.back().printAllocations - samples[warmup].printAllocations;
+	uint64_t liveHeap = 0;
+	uint64_t liveHeapMax = 0;
+	for (size_t i = warmup; i < cycles; i++)
+	{
+		liveHeap += samples[i].liveHeapAllocations;
+		liveHeapMax = std::max(liveHeapMax, samples[i].liveHeapAllocations);
+	}
+	double liveFrames = (double)(cycles - warmup) * options.liveFrames;
+
+	printf("\n%d cycles in %.1f s, %llu pages printed, %d failed cycles\n", (int)cycles, msSince(runTick) / 1000.0f,
+		(unsigned long long)printer.pages(), failedCycles);
+	printf("rss: %.1f MB -> %.1f MB (%+.1f MB without the journal, limit %.1f)\n", first.rssMb, last.rssMb, rssGrowth, options.maxRssGrowthMb);
+	printf("handles: %d -> %d (%+d, limit %d)\n", first.handles, last.handles, handleGrowth, options.maxHandleGrowth);
+	printf("median cycle: %.1f ms -> %.1f ms (%+.0f%%, limit %.0f%%)\n", first.cycleMs, last.cycleMs, drift * 100, options.maxLatencyDrift * 100);
+	printf("arena block allocations after warmup: live %llu, print %llu\n", (unsigned long long)liveAllocations, (unsigned long long)printAllocations);
+#if defined(__GLIBC__)
+	const char* heapCounted = "every malloc, opencv included";
+#else
+	const char* heapCounted = "operator new only, opencv not seen";
+#endif
+	printf("heap allocations per live frame after warmup: %.1f (%s), at most %llu in the %d live frames of a cycle\n",
+		liveFrames > 0 ? liveHeap / liveFrames : 0.0, heapCounted, (unsigned long long)liveHeapMax, options.liveFrames);
+
+	bool ok = true;
+	if (failedCycles > 0) { printf("FAIL: some captures were not composed, written or printed\n"); ok = false; }
+	if (rssGrowth > options.maxRssGrowthMb) { printf("FAIL: resident memory keeps growing\n"); ok = false; }
+	if (handleGrowth > options.maxHandleGrowth) { printf("FAIL: handles keep growing\n"); ok = false; }
+	if (drift > options.maxLatencyDrift) { printf("FAIL: cycle latency drifts up\n"); ok = false; }
+	if (liveAllocations > 0 || printAllocations > 0) { printf("FAIL: the arenas still allocate blocks after the warmup\n"); ok = false; }
+	printf(ok ? "PASS\n" : "\n");
+	return ok ? 0 : 1;
+}